@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "pub-index.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <fmt/format.h>
+
+/*
+ * Publish cost for uws+pub fanout: full scan of session map (old implementation) versus
+ * PubIndex. Only small fixed number of subscribers is waiting at tail, rest are lagging behind
+ * at random ring positions, so publish cost with index should not depend on total number of
+ * subscribers.
+ */
+
+struct Subscriber
+{
+	uint64_t position = 0;
+
+	Subscriber * pub_prev = nullptr;
+	Subscriber * pub_next = nullptr;
+	uint64_t seq = 0;
+	bool pub_linked = false;
+};
+
+constexpr unsigned ring_size = 1024;
+constexpr unsigned active = 16;
+constexpr unsigned count = 100000;
+
+using clock_type = std::chrono::steady_clock;
+
+template <typename F>
+double timeit(F f)
+{
+	auto start = clock_type::now();
+	for (auto i = 0u; i < count; i++)
+		f(i);
+	std::chrono::duration<double, std::nano> dt = clock_type::now() - start;
+	return dt.count() / count;
+}
+
+void bench(unsigned subscribers)
+{
+	std::mt19937 rng(subscribers);
+	std::vector<Subscriber> users(subscribers);
+	std::map<uint64_t, Subscriber *> sessions;
+	for (auto i = 0u; i < subscribers; i++)
+		sessions.emplace(i, &users[i]);
+
+	// Lagging subscribers are pinned in the middle of the ring and never evicted
+	auto lag = [&rng](unsigned i) -> uint64_t { return i < active ? ring_size : rng() % (ring_size / 2) + ring_size / 4; };
+
+	for (auto i = 0u; i < subscribers; i++)
+		users[i].position = lag(i);
+
+	uint64_t tail = ring_size;
+	auto scan = timeit([&](unsigned) {
+		for (auto & [a, u] : sessions) {
+			if (u->position == tail)
+				u->position++;
+		}
+		tail++;
+	});
+
+	PubIndex<Subscriber> index;
+	index.reset(0);
+	for (auto i = 0u; i < ring_size; i++)
+		index.push([](auto) {});
+	for (auto i = 0u; i < subscribers; i++)
+		index.insert(&users[i], lag(i));
+
+	auto indexed = timeit([&](unsigned) {
+		index.push([&index](Subscriber * u) { index.move(u, u->seq + 1); });
+		index.pop([](Subscriber *) {});
+	});
+
+	fmt::print("{:>8} subscribers: scan {:10.1f}ns, index {:6.1f}ns per message\n", subscribers, scan, indexed);
+}
+
+int main()
+{
+	for (auto n : { 16u, 128u, 1024u, 8192u, 20000u })
+		bench(n);
+	return 0;
+}
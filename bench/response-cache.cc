@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "response-cache.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include <fmt/format.h>
+
+/*
+ * Response cache cost on request path of uws+http: lookup of hot keys that are all in cache and
+ * mixed workload where cache holds only part of keys, so misses are followed by insert with LRU
+ * eviction. Keys look like REST urls with query string and one selected header.
+ */
+
+constexpr unsigned count = 1000000;
+
+using clock_type = std::chrono::steady_clock;
+
+void bench(unsigned keys, size_t limit, size_t body)
+{
+	ResponseCache cache;
+	cache.init(limit, std::chrono::seconds(60));
+
+	std::vector<std::string> urls;
+	for (auto i = 0u; i < keys; i++)
+		urls.push_back(fmt::format("/api/v1/items/{}?format=json\napplication/json", i));
+
+	std::mt19937 rng(keys);
+	std::vector<unsigned> requests;
+	for (auto i = 0u; i < 4096; i++)
+		requests.push_back(rng() % keys);
+
+	unsigned hit = 0, miss = 0, evict = 0;
+	auto start = clock_type::now();
+	for (auto i = 0u; i < count; i++) {
+		auto & key = urls[requests[i % requests.size()]];
+		auto now = clock_type::now();
+		if (cache.lookup(key, now)) {
+			hit++;
+			continue;
+		}
+		miss++;
+		ResponseCache::Entry entry = { "200 OK", {{"Content-Type", "application/json"}}, std::string(body, 'x') };
+		evict += cache.insert(key, std::move(entry), now);
+	}
+	std::chrono::duration<double, std::nano> dt = clock_type::now() - start;
+	fmt::print("Keys {:6}, cache {:>6}kb: {:6.1f}ns per request, hit {:5.1f}%, {} evictions\n",
+		keys, limit / 1024, dt.count() / count, 100. * hit / count, evict);
+}
+
+int main()
+{
+	bench(1000, 16 * 1024 * 1024, 1024);
+	bench(100000, 16 * 1024 * 1024, 1024);
+	bench(100000, 1024 * 1024, 1024);
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "router.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <fmt/format.h>
+
+/*
+ * Endpoint lookup cost: exact std::map lookup followed by wildcard upper_bound probe (old
+ * implementation) versus radix tree Router. Routes look like REST API: /api/v1/<group>/<item>
+ * exact endpoints and /static/<group>/ prefixes, requests are mix of exact and prefix paths.
+ */
+
+using Map = std::map<std::string, unsigned, std::less<>>;
+
+const unsigned * map_lookup(const Map &nodes, const Map &wildcard, std::string_view uri)
+{
+	auto it = nodes.find(uri);
+	if (it != nodes.end())
+		return &it->second;
+	it = wildcard.upper_bound(uri);
+	if (it == wildcard.begin())
+		return nullptr;
+	--it;
+	if (uri.substr(0, it->first.size()) == it->first)
+		return &it->second;
+	return nullptr;
+}
+
+constexpr unsigned count = 1000000;
+
+using clock_type = std::chrono::steady_clock;
+
+template <typename F>
+double timeit(const std::vector<std::string> &requests, F f)
+{
+	unsigned long sum = 0;
+	auto start = clock_type::now();
+	for (auto i = 0u; i < count; i++) {
+		auto r = f(requests[i % requests.size()]);
+		sum += r ? *r : 0;
+	}
+	std::chrono::duration<double, std::nano> dt = clock_type::now() - start;
+	if (sum == 0)
+		fmt::print("Empty lookup result\n");
+	return dt.count() / count;
+}
+
+void bench(unsigned groups, unsigned items)
+{
+	Map nodes, wildcard;
+	Router<unsigned> router;
+
+	unsigned value = 0;
+	for (auto g = 0u; g < groups; g++) {
+		for (auto i = 0u; i < items; i++) {
+			auto path = fmt::format("/api/v1/group-{}/item-{}", g, i);
+			nodes.emplace(path, ++value);
+			router.add(path, false, router.method_any, value);
+		}
+		auto path = fmt::format("/static/group-{}/", g);
+		wildcard.emplace(path, ++value);
+		router.add(path, true, router.method_any, value);
+	}
+
+	std::mt19937 rng(groups * items);
+	std::vector<std::string> requests;
+	for (auto i = 0u; i < 4096; i++) {
+		auto g = rng() % groups;
+		if (i % 2)
+			requests.push_back(fmt::format("/api/v1/group-{}/item-{}", g, rng() % items));
+		else
+			requests.push_back(fmt::format("/static/group-{}/file-{}.js", g, rng() % 100));
+	}
+
+	auto m = timeit(requests, [&nodes, &wildcard](std::string_view uri) { return map_lookup(nodes, wildcard, uri); });
+	auto r = timeit(requests, [&router](std::string_view uri) { return router.lookup(uri, 1); });
+
+	fmt::print("{:>5} routes: map {:6.1f}ns, router {:6.1f}ns per lookup\n", value, m, r);
+}
+
+int main()
+{
+	bench(10, 10);
+	bench(20, 20);
+	bench(50, 10);
+	return 0;
+}
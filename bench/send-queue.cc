@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "send-queue.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+/*
+ * Heap allocations per message for LWS session queues: fresh buffer for each message (copy with
+ * new/delete) versus SendQueue with BufferPool. Several sessions are fed with SSE framed messages
+ * of varying size and drained in batches like writable callbacks do. Allocations are counted by
+ * replaced global operator new after warmup round.
+ */
+
+constexpr size_t headroom = 16; // LWS_PRE on 64-bit platforms
+constexpr unsigned sessions = 64;
+constexpr unsigned depth = 8; // Messages queued before session becomes writable
+constexpr unsigned messages = 2000000;
+
+static size_t allocations = 0;
+
+void * operator new(size_t size)
+{
+	allocations++;
+	if (auto ptr = malloc(size); ptr)
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void * operator new[](size_t size) { return operator new(size); }
+void operator delete(void * ptr) noexcept { free(ptr); }
+void operator delete[](void * ptr) noexcept { free(ptr); }
+void operator delete(void * ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void * ptr, size_t) noexcept { free(ptr); }
+
+using clock_type = std::chrono::steady_clock;
+
+/// Write SSE framed payload into buffer, return framed size
+size_t frame(unsigned char * buf, const std::string &payload)
+{
+	memcpy(buf, "data: ", 6);
+	memcpy(buf + 6, payload.data(), payload.size());
+	buf[6 + payload.size()] = '\n';
+	buf[6 + payload.size() + 1] = '\n';
+	return payload.size() + 8;
+}
+
+struct Copy
+{
+	struct Entry { unsigned char * data; size_t size; };
+	std::vector<std::vector<Entry>> queues;
+	unsigned long sum = 0;
+
+	Copy() : queues(sessions) { for (auto & q : queues) q.reserve(depth); }
+
+	void push(unsigned s, const std::string &payload)
+	{
+		auto buf = new unsigned char[headroom + payload.size() + 8];
+		queues[s].push_back({ buf, frame(buf + headroom, payload) });
+	}
+
+	void drain(unsigned s)
+	{
+		for (auto & e : queues[s]) {
+			sum += e.data[headroom + e.size - 1];
+			delete [] e.data;
+		}
+		queues[s].clear();
+	}
+};
+
+struct Pool
+{
+	std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>(4 * 1024 * 1024);
+	std::vector<std::unique_ptr<SendQueue>> queues;
+	unsigned long sum = 0;
+
+	Pool()
+	{
+		for (auto i = 0u; i < sessions; i++)
+			queues.emplace_back(new SendQueue(headroom, pool));
+	}
+
+	void push(unsigned s, const std::string &payload)
+	{
+		frame(queues[s]->push(payload.size() + 8), payload);
+	}
+
+	void drain(unsigned s)
+	{
+		auto & q = *queues[s];
+		while (!q.empty()) {
+			sum += q.front()[q.front_size() - 1];
+			q.pop();
+		}
+	}
+};
+
+template <typename Q>
+void bench(const char * name, const std::vector<std::string> &payloads)
+{
+	Q q;
+	auto round = [&q, &payloads](unsigned count) {
+		for (auto i = 0u; i < count; i++) {
+			auto s = i % sessions;
+			q.push(s, payloads[i % payloads.size()]);
+			if (i / sessions % depth == depth - 1)
+				q.drain(s);
+		}
+		for (auto s = 0u; s < sessions; s++)
+			q.drain(s);
+	};
+
+	round(sessions * depth * 16); // Warmup: fill pool and grow rings
+
+	allocations = 0;
+	auto start = clock_type::now();
+	round(messages);
+	std::chrono::duration<double, std::nano> dt = clock_type::now() - start;
+	auto allocs = allocations;
+
+	if (!q.sum)
+		fmt::print("Empty result\n");
+	fmt::print("{:>6}: {:6.1f}ns per message, {:.3f} allocations per message ({} total)\n", name, dt.count() / messages, (double) allocs / messages, allocs);
+}
+
+int main()
+{
+	std::vector<std::string> payloads;
+	for (auto size : { 16, 100, 250, 600, 1500, 4000, 12000 })
+		payloads.push_back(std::string(size, 'x'));
+
+	bench<Copy>("copy", payloads);
+	bench<Pool>("pool", payloads);
+	return 0;
+}
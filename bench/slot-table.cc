@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "slot-table.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <fmt/format.h>
+
+/*
+ * Session lookup cost on post: std::map keyed by address (old implementation) versus SlotTable.
+ * Sessions are churned before measurement so slots are reused with new generations, lookups are
+ * done in random order like posts for different clients.
+ */
+
+struct Session { unsigned long value = 0; };
+
+constexpr unsigned count = 1000000;
+
+using clock_type = std::chrono::steady_clock;
+
+template <typename F>
+double timeit(const std::vector<uint64_t> &order, F f)
+{
+	unsigned long sum = 0;
+	auto start = clock_type::now();
+	for (auto i = 0u; i < count; i++)
+		sum += f(order[i % order.size()]);
+	std::chrono::duration<double, std::nano> dt = clock_type::now() - start;
+	if (sum == 0)
+		fmt::print("Empty lookup result\n");
+	return dt.count() / count;
+}
+
+void bench(unsigned sessions)
+{
+	std::mt19937 rng(sessions);
+	std::vector<Session> data(sessions);
+
+	std::map<uint64_t, Session *> map;
+	SlotTable<Session *> table;
+
+	std::vector<uint64_t> maddr, taddr;
+	uint64_t next = 0;
+	for (auto i = 0u; i < sessions; i++) {
+		data[i].value = i + 1;
+		map.emplace(++next, &data[i]);
+		maddr.push_back(next);
+		taddr.push_back(table.insert(&data[i]));
+	}
+
+	// Reconnect half of sessions
+	for (auto i = 0u; i < sessions / 2; i++) {
+		auto idx = rng() % sessions;
+		map.erase(maddr[idx]);
+		map.emplace(++next, &data[idx]);
+		maddr[idx] = next;
+		table.erase(taddr[idx]);
+		taddr[idx] = table.insert(&data[idx]);
+	}
+
+	std::vector<unsigned> order(count);
+	for (auto & i : order)
+		i = rng() % sessions;
+	std::vector<uint64_t> morder, torder;
+	for (auto i : order) {
+		morder.push_back(maddr[i]);
+		torder.push_back(taddr[i]);
+	}
+
+	auto m = timeit(morder, [&map](uint64_t addr) {
+		auto it = map.find(addr);
+		return it == map.end() ? 0 : it->second->value;
+	});
+
+	auto t = timeit(torder, [&table](uint64_t addr) {
+		auto r = table.lookup(addr);
+		return r ? (*r)->value : 0;
+	});
+
+	fmt::print("{:>8} sessions: map {:6.1f}ns, slot table {:6.1f}ns per lookup\n", sessions, m, t);
+}
+
+int main()
+{
+	for (auto n : { 100u, 1000u, 10000u, 100000u })
+		bench(n);
+	return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "static-cache.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
+#include <fmt/format.h>
+
+/*
+ * Static file serving costs for uws+static: small file lookup in memory cache versus reading it on
+ * each request with open/fstat/read/close, large file transfer into socket with read/send copy
+ * loop versus sendfile. Socket is AF_UNIX pair drained by separate thread.
+ */
+
+constexpr unsigned lookups = 200000;
+constexpr size_t small_size = 4096;
+constexpr size_t large_size = 64 * 1024 * 1024;
+constexpr unsigned transfers = 16;
+
+using clock_type = std::chrono::steady_clock;
+
+struct Dir
+{
+	std::string path;
+
+	Dir()
+	{
+		char tmpl[] = "/tmp/tll-bench-static-XXXXXX";
+		path = mkdtemp(tmpl);
+	}
+
+	~Dir()
+	{
+		for (auto name : { "small", "large" })
+			unlink((path + "/" + name).c_str());
+		rmdir(path.c_str());
+	}
+
+	void create(const char * name, size_t size)
+	{
+		std::vector<char> buf(size, 'x');
+		auto f = fopen((path + "/" + name).c_str(), "w");
+		fwrite(buf.data(), 1, buf.size(), f);
+		fclose(f);
+	}
+};
+
+void bench_lookup(const Dir &dir)
+{
+	StaticCache cache;
+	cache.init(dir.path, 1024 * 1024, 64 * 1024 * 1024);
+
+	unsigned long sum = 0;
+	auto start = clock_type::now();
+	for (auto i = 0u; i < lookups; i++) {
+		int error;
+		auto f = cache.lookup("small", error);
+		sum += f ? f->data[i % f->size] : 0;
+	}
+	std::chrono::duration<double, std::nano> dt = clock_type::now() - start;
+	fmt::print("Lookup  cached: {:8.1f}ns\n", dt.count() / lookups);
+
+	std::vector<char> buf(small_size);
+	auto full = dir.path + "/small";
+	start = clock_type::now();
+	for (auto i = 0u; i < lookups; i++) {
+		auto fd = open(full.c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat st;
+		fstat(fd, &st);
+		auto r = read(fd, buf.data(), std::min<size_t>(buf.size(), st.st_size));
+		close(fd);
+		sum += r > 0 ? buf[i % r] : 0;
+	}
+	dt = clock_type::now() - start;
+	fmt::print("Lookup    read: {:8.1f}ns\n", dt.count() / lookups);
+	if (!sum)
+		fmt::print("Empty result\n");
+}
+
+template <typename F>
+void bench_transfer(const Dir &dir, const char * name, F send)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
+		return fmt::print("Failed to create socket pair\n");
+
+	std::thread reader([fd = fds[1]]() {
+		std::vector<char> buf(256 * 1024);
+		while (read(fd, buf.data(), buf.size()) > 0) {}
+	});
+
+	auto full = dir.path + "/large";
+	auto start = clock_type::now();
+	for (auto i = 0u; i < transfers; i++) {
+		auto fd = open(full.c_str(), O_RDONLY | O_CLOEXEC);
+		send(fds[0], fd);
+		close(fd);
+	}
+	std::chrono::duration<double> dt = clock_type::now() - start;
+	close(fds[0]);
+	reader.join();
+	close(fds[1]);
+
+	fmt::print("Transfer {:>8}: {:8.1f} MB/s\n", name, transfers * large_size / dt.count() / 1024 / 1024);
+}
+
+int main()
+{
+	Dir dir;
+	dir.create("small", small_size);
+	dir.create("large", large_size);
+
+	bench_lookup(dir);
+
+	bench_transfer(dir, "copy", [](int sock, int fd) {
+		std::vector<char> buf(64 * 1024);
+		ssize_t r;
+		while ((r = read(fd, buf.data(), buf.size())) > 0) {
+			for (ssize_t off = 0; off < r; ) {
+				auto w = send(sock, buf.data() + off, r - off, MSG_NOSIGNAL);
+				if (w <= 0)
+					return;
+				off += w;
+			}
+		}
+	});
+
+	bench_transfer(dir, "sendfile", [](int sock, int fd) {
+		off_t offset = 0;
+		while (offset < (off_t) large_size) {
+			if (sendfile(sock, fd, &offset, large_size - offset) <= 0)
+				return;
+		}
+	});
+	return 0;
+}
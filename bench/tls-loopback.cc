@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "uws-tls.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <fmt/format.h>
+
+/*
+ * Loopback TLS benchmark for uwss:// server side: handshake rate with full handshake and with
+ * ticket resumption, bulk transfer from server to client with and without kTLS. Server uses
+ * TLSContext and TLSConnection from uws-tls.h on blocking sockets, client is plain OpenSSL.
+ */
+
+constexpr unsigned handshakes = 500;
+constexpr size_t bulk_size = 256 * 1024 * 1024;
+
+using clock_type = std::chrono::steady_clock;
+
+struct Files
+{
+	std::string cert = "/tmp/tll-bench-tls-cert.pem";
+	std::string key = "/tmp/tll-bench-tls-key.pem";
+
+	~Files()
+	{
+		unlink(cert.c_str());
+		unlink(key.c_str());
+	}
+};
+
+bool selfsigned(const Files &files)
+{
+	auto pkey = EVP_EC_gen("P-256");
+	if (!pkey)
+		return false;
+	auto x509 = X509_new();
+	ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+	X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+	X509_set_pubkey(x509, pkey);
+	auto name = X509_get_subject_name(x509);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) "localhost", -1, -1, 0);
+	X509_set_issuer_name(x509, name);
+	X509_sign(x509, pkey, EVP_sha256());
+
+	auto f = fopen(files.cert.c_str(), "w");
+	PEM_write_X509(f, x509);
+	fclose(f);
+	f = fopen(files.key.c_str(), "w");
+	PEM_write_PrivateKey(f, pkey, nullptr, nullptr, 0, nullptr, nullptr);
+	fclose(f);
+
+	X509_free(x509);
+	EVP_PKEY_free(pkey);
+	return true;
+}
+
+int listen_socket(unsigned short &port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if (bind(fd, (sockaddr *) &addr, len) || listen(fd, 128) || getsockname(fd, (sockaddr *) &addr, &len))
+		return -1;
+	port = ntohs(addr.sin_port);
+	return fd;
+}
+
+int connect_socket(unsigned short port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, (sockaddr *) &addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/// Serve count connections: handshake, send size bytes and wait for client to close
+/// Server context, kTLS option is cleared when it is not requested
+std::optional<std::string> server_context(TLSContext &ctx, const Files &files, bool ktls)
+{
+	if (auto r = ctx.init(files.cert, files.key, true); r)
+		return r;
+#ifdef SSL_OP_ENABLE_KTLS
+	if (!ktls)
+		SSL_CTX_clear_options(ctx.get(), SSL_OP_ENABLE_KTLS);
+#endif
+	return std::nullopt;
+}
+
+void server(TLSContext * ctx, int lfd, unsigned count, size_t size, bool * ktls)
+{
+	std::vector<char> buf(16 * 1024, 'x');
+	for (auto i = 0u; i < count; i++) {
+		auto fd = accept(lfd, nullptr, nullptr);
+		if (fd == -1)
+			return;
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		TLSConnection c;
+		c.init(ctx->get(), fd);
+		if (c.handshake() != TLSConnection::Result::Done) {
+			fmt::print("Handshake failed: {}\n", c.error);
+			continue;
+		}
+		*ktls = c.ktls_send();
+		for (size_t sent = 0; sent < size; ) {
+			auto r = SSL_write(c.ssl(), buf.data(), std::min(buf.size(), size - sent));
+			if (r <= 0)
+				break;
+			sent += r;
+		}
+		char tmp;
+		SSL_read(c.ssl(), &tmp, 1);
+	}
+}
+
+/// Connect, optionally resume session, read size bytes and return session for next connection
+SSL_SESSION * client(SSL_CTX * ctx, unsigned short port, SSL_SESSION * session, size_t size, bool * resumed)
+{
+	auto fd = connect_socket(port);
+	if (fd == -1)
+		return nullptr;
+	auto ssl = SSL_new(ctx);
+	SSL_set_fd(ssl, fd);
+	if (session)
+		SSL_set_session(ssl, session);
+	if (SSL_connect(ssl) != 1) {
+		fmt::print("Client handshake failed: {}\n", tls_error());
+		SSL_free(ssl);
+		close(fd);
+		return nullptr;
+	}
+	*resumed = SSL_session_reused(ssl);
+
+	std::vector<char> buf(64 * 1024);
+	for (size_t recv = 0; recv < size; ) {
+		auto r = SSL_read(ssl, buf.data(), buf.size());
+		if (r <= 0)
+			break;
+		recv += r;
+	}
+	auto next = SSL_get1_session(ssl);
+	SSL_shutdown(ssl); // Session of connection closed without close_notify is not resumable
+	SSL_free(ssl);
+	close(fd);
+	return next;
+}
+
+void bench_handshake(SSL_CTX * cctx, TLSContext &sctx, bool resume)
+{
+	unsigned short port;
+	auto lfd = listen_socket(port);
+	bool ktls = false;
+	std::thread thread(server, &sctx, lfd, handshakes, 1, &ktls);
+
+	SSL_SESSION * session = nullptr;
+	unsigned reused = 0;
+	auto start = clock_type::now();
+	for (auto i = 0u; i < handshakes; i++) {
+		bool r = false;
+		auto next = client(cctx, port, resume ? session : nullptr, 1, &r);
+		reused += r;
+		if (session)
+			SSL_SESSION_free(session);
+		session = next;
+	}
+	std::chrono::duration<double> dt = clock_type::now() - start;
+	thread.join();
+	close(lfd);
+	if (session)
+		SSL_SESSION_free(session);
+
+	fmt::print("Handshake {:>8}: {:8.0f} per second, {} of {} resumed\n", resume ? "resumed" : "full", handshakes / dt.count(), reused, handshakes);
+}
+
+void bench_bulk(SSL_CTX * cctx, const Files &files, bool ktls)
+{
+	TLSContext sctx;
+	if (auto r = server_context(sctx, files, ktls); r)
+		return fmt::print("Failed to init server context: {}\n", *r);
+
+	unsigned short port;
+	auto lfd = listen_socket(port);
+	bool active = false;
+	std::thread thread(server, &sctx, lfd, 1, bulk_size, &active);
+
+	bool resumed;
+	auto start = clock_type::now();
+	auto session = client(cctx, port, nullptr, bulk_size, &resumed);
+	std::chrono::duration<double> dt = clock_type::now() - start;
+	thread.join();
+	close(lfd);
+	if (session)
+		SSL_SESSION_free(session);
+
+	fmt::print("Bulk ktls={:<3}: {:8.1f} MB/s, kernel TLS {}\n", ktls ? "yes" : "no", bulk_size / dt.count() / 1024 / 1024, active ? "active" : "not active");
+}
+
+int main()
+{
+	Files files;
+	if (!selfsigned(files)) {
+		fmt::print("Failed to generate certificate: {}\n", tls_error());
+		return 1;
+	}
+
+	auto cctx = SSL_CTX_new(TLS_client_method());
+	SSL_CTX_set_session_cache_mode(cctx, SSL_SESS_CACHE_CLIENT);
+
+	TLSContext sctx;
+	if (auto r = server_context(sctx, files, false); r) {
+		fmt::print("Failed to init server context: {}\n", *r);
+		return 1;
+	}
+
+	bench_handshake(cctx, sctx, false);
+	bench_handshake(cctx, sctx, true);
+
+	bench_bulk(cctx, files, false);
+	bench_bulk(cctx, files, true);
+
+	SSL_CTX_free(cctx);
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "uring.h"
+
+#include <chrono>
+#include <vector>
+
+#include <fcntl.h>
+
+#include <fmt/format.h>
+
+/*
+ * Fanout of small message to many sockets, like uws+pub broadcast: one send() syscall per socket
+ * versus one io_uring submission for the whole batch. Submission does not wait for completions,
+ * they are reaped from completion ring as in server. Peers are drained between rounds and drain
+ * time is not measured.
+ */
+
+constexpr unsigned rounds = 200;
+
+using clock_type = std::chrono::steady_clock;
+
+struct Pair { int fd[2]; };
+
+void drain(std::vector<Pair> &pairs)
+{
+	char buf[4096];
+	for (auto & p : pairs)
+		while (read(p.fd[1], buf, sizeof(buf)) > 0) {}
+}
+
+void bench(URing &ring, unsigned sockets, size_t size)
+{
+	std::vector<Pair> pairs(sockets);
+	for (auto & p : pairs) {
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, p.fd))
+			return fmt::print("Failed to create socket pair: {}\n", strerror(errno));
+	}
+
+	std::vector<char> data(size, 'x');
+
+	std::chrono::duration<double, std::nano> syscalls = {}, batched = {};
+	unsigned long errors = 0, late = 0;
+	auto complete = [&errors, &data](uint64_t, int r) { if (r != (int) data.size()) errors++; };
+	for (auto r = 0u; r < rounds; r++) {
+		auto start = clock_type::now();
+		for (auto & p : pairs) {
+			if (send(p.fd[0], data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) data.size())
+				errors++;
+		}
+		syscalls += clock_type::now() - start;
+		drain(pairs);
+
+		start = clock_type::now();
+		for (auto i = 0u; i < sockets; i++) {
+			if (!ring.send(pairs[i].fd[0], data.data(), data.size(), i)) {
+				ring.submit();
+				ring.reap(complete);
+				ring.send(pairs[i].fd[0], data.data(), data.size(), i);
+			}
+		}
+		ring.submit();
+		ring.reap(complete);
+		batched += clock_type::now() - start;
+		late += ring.inflight();
+		ring.drain(complete);
+		drain(pairs);
+	}
+
+	for (auto & p : pairs) {
+		close(p.fd[0]);
+		close(p.fd[1]);
+	}
+
+	auto total = rounds * sockets;
+	fmt::print("{:>6} sockets, {:>5} bytes: send {:6.1f}ns, io_uring {:6.1f}ns per message ({:+.0f}%), {} late, {} errors\n",
+		sockets, size, syscalls.count() / total, batched.count() / total, 100 * (batched / syscalls - 1), late, errors);
+}
+
+int main()
+{
+	URing ring;
+	if (auto r = ring.init(256); r) {
+		fmt::print("Failed to init io_uring: {}\n", strerror(r));
+		return 1;
+	}
+
+	for (auto n : { 16u, 128u, 1000u })
+		for (auto size : { 64u, 1024u })
+			bench(ring, n, size);
+	return 0;
+}
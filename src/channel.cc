@@ -11,15 +11,18 @@
 
 #include "tll/channel/base.h"
 #include "tll/channel/module.h"
-#include "tll/util/ownedmsg.h"
+#include "tll/util/size.h"
 #include "names.h"
 #include "lws_scheme.h"
 #include "ev-backend.h"
+#include "ev-deadline.h"
+#include "ev-loop.h"
+#include "send-queue.h"
+#include "slot-table.h"
 
-#ifdef __linux__
-#include <sys/timerfd.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#endif
 
 #if 0
 #include <uv.h>
@@ -43,6 +46,17 @@ int tll_lws_drop(lws * wsi, http_status s, int r = 1)
 		lws_return_http_status(wsi, s, NULL);
 	return r;
 }
+
+/// Check if request has non-empty body: parsed Content-Length is positive or body is chunked
+bool tll_lws_http_has_body(lws * wsi)
+{
+	char buf[64];
+	if (lws_hdr_copy(wsi, buf, sizeof(buf), WSI_TOKEN_HTTP_CONTENT_LENGTH) > 0 && atoll(buf) > 0)
+		return true;
+	if (lws_hdr_copy(wsi, buf, sizeof(buf), WSI_TOKEN_HTTP_TRANSFER_ENCODING) > 0)
+		return strcasestr(buf, "chunked") != nullptr;
+	return false;
+}
 }
 
 using namespace tll;
@@ -61,24 +75,30 @@ class WSServer : public tll::channel::Base<WSServer>
 	lws_context * _lws = nullptr;
 	void * _loop_ptr[1] = {};
 
+#if 0
 	int _timerfd = -1;
 
-#if 0
 	uv_loop_t _uv_loop = {};
 	//uv_timer_t _uv_timer = {};
 	uv_poll_t _uv_timer = {};
 
 #else
 	struct ev_loop * _ev_loop = nullptr;
-	struct ev_io _ev_timer = {};
+	EvDeadline _deadline; // Wakes processor for next lws timeout
+	EvLoop * _ev_master = nullptr; // Shared loop owner, own loop is not created when set
+	bool _ev_released = false; // Shared loop owner is destroyed while channel was open
 #endif
 
  public:
+	/// Session data allocated by LWS, it is zero initialized and constructors are not called
 	struct user_t {
 		node_ptr_t channel = {};
 		tll_addr_t addr;
 		unsigned short close = 0;
-		tll::util::OwnedMessage pending;
+		bool write_full = false;
+		bool http_started = false; // Headers of HTTP response are written, no more data is accepted
+		bool http_body = false; // Request body is not yet received, response is delayed until it is complete
+		SendQueue * queue = nullptr; // Created on connect and destroyed on disconnect
 	};
 
 	static constexpr std::string_view channel_protocol() { return "ws"; }
@@ -90,6 +110,9 @@ class WSServer : public tll::channel::Base<WSServer>
 
 	int _process(long timeout, int flags);
 
+	/// Upper bound for timer sleep, loop is woken at least this often even if lws has no timeouts
+	static constexpr std::chrono::milliseconds timer_max = std::chrono::milliseconds(1000);
+
 	template <typename T>
 	int node_add(std::string_view prefix, T * ptr)
 	{
@@ -116,6 +139,18 @@ class WSServer : public tll::channel::Base<WSServer>
 	}
 
  private:
+	/// Arm timer for next lws timeout, called only after loop run
+	int _rearm();
+
+	/// Stop using shared loop that is destroyed before the channel
+	void _ev_release();
+
+	/**
+	 * Service expired lws timers and return time to the next one, zero if there is buffered data
+	 * that needs another loop run. Not a getter: used only on process path after loop run.
+	 */
+	std::chrono::milliseconds _timeout() { return std::chrono::milliseconds(lws_service_adjust_timeout(_lws, timer_max.count(), 0)); }
+
 	int _lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
 
 	static int _lws_callback_s(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
@@ -136,8 +171,13 @@ class WSNode : public tll::channel::Base<T>
 
 	std::string _prefix;
 
-	std::map<uint64_t, lws *> _sessions;
-	tll_addr_t _addr;
+	SlotTable<lws *> _sessions;
+
+	size_t _high_water = 256 * 1024;
+	size_t _low_water = 64 * 1024;
+
+	std::shared_ptr<BufferPool> _pool; // Message buffers for queues of all sessions
+	BufferPool::Counters _pool_reported; // Pool counters already added to stat
 
 	using user_t = WSServer::user_t;
 
@@ -145,6 +185,15 @@ class WSNode : public tll::channel::Base<T>
 	static constexpr std::string_view param_prefix() { return "ws"; }
 	static constexpr auto process_policy() { return Base::ProcessPolicy::Never; }
 
+	struct StatType : public Base::StatType
+	{
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'p', 'h', 'i', 't'> pool_hit;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'p', 'm', 'i', 's', 's'> pool_miss;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'p', 'b', 'i', 'g'> pool_oversize;
+	};
+
+	tll::stat::BlockT<StatType> * stat() { return static_cast<tll::stat::BlockT<StatType> *>(this->internal.stat); }
+
 	int _init(const tll::Channel::Url &, tll::Channel *master);
 	int _open(const tll::ConstConfig &);
 	int _close();
@@ -161,15 +210,44 @@ class WSNode : public tll::channel::Base<T>
 		return 0;
 	}
 
-	tll::util::OwnedMessage copy(const tll_msg_t *msg) { return msg; }
+	/// Copy message payload into new queue entry, overriden by nodes that need framing
+	void push(SendQueue &queue, const tll_msg_t *msg)
+	{
+		memcpy(queue.push(msg->size), msg->data, msg->size);
+	}
 
  protected:
 	int _connected(lws * wsi, user_t * user);
 	int _disconnected(lws * wsi, user_t * user);
 
-	tll_addr_t _next_addr()
+	/// Write queued entries while socket is not choked, report WriteReady when queue is below low-water
+	int _drain(lws * wsi, user_t * user, lws_write_protocol protocol);
+
+	/// Emit control message without body
+	void _callback_control(int msgid, tll_addr_t addr)
+	{
+		tll_msg_t msg = {};
+		msg.type = TLL_MESSAGE_CONTROL;
+		msg.msgid = msgid;
+		msg.addr = addr;
+		this->_callback(&msg);
+	}
+
+	/// Add buffer pool counters changed since last call to stat block
+	void _stat_pool()
 	{
-		return { ++_addr.u64 }; // TODO: Check for duplicates
+		auto s = stat();
+		if (!s)
+			return;
+		auto page = s->acquire();
+		if (!page)
+			return;
+		auto & c = _pool->counters();
+		page->pool_hit.update(c.hit - _pool_reported.hit);
+		page->pool_miss.update(c.miss - _pool_reported.miss);
+		page->pool_oversize.update(c.oversize - _pool_reported.oversize);
+		_pool_reported = c;
+		s->release(page);
 	}
 };
 
@@ -188,18 +266,13 @@ class WSSSE : public WSNode<WSSSE>
 
 	int lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
 
-	tll::util::OwnedMessage copy(const tll_msg_t *msg)
+	void push(SendQueue &queue, const tll_msg_t *msg)
 	{
-		tll::util::OwnedMessage omsg = {};
-		tll_msg_copy_info(omsg, msg);
-		omsg.size = msg->size + 6 + 2;
-		char * buf = new char[omsg.size]; 
-		omsg.data = buf;
+		auto buf = queue.push(msg->size + 6 + 2);
 		memcpy(buf, "data: ", 6);
 		memcpy(buf + 6, msg->data, msg->size);
 		buf[6 + msg->size] = '\n';
 		buf[6 + msg->size + 1] = '\n';
-		return omsg;
 	}
 };
 
@@ -209,16 +282,6 @@ class WSWS : public WSNode<WSWS>
 	static constexpr std::string_view channel_protocol() { return "ws+ws"; }
 
 	int lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
-
-	tll::util::OwnedMessage copy(const tll_msg_t *msg)
-	{
-		tll::util::OwnedMessage omsg = {};
-		tll_msg_copy_info(omsg, msg);
-		omsg.size = msg->size + LWS_PRE;
-		omsg.data = new char[omsg.size];
-		memcpy(((unsigned char *) omsg.data) + LWS_PRE, msg->data, msg->size);
-		return omsg;
-	}
 };
 
 int WSServer::_init(const Channel::Url &url, Channel * master)
@@ -234,11 +297,11 @@ int WSServer::_init(const Channel::Url &url, Channel * master)
 	_protocols.push_back(lws_protocols {});
 
 	_info.protocols = _protocols.data();
-	_info.port = 8080;
 	_info.foreign_loops = _loop_ptr;
 	//_info.options = LWS_SERVER_OPTION_HTTP_HEADERS_SECURITY_BEST_PRACTICES_ENFORCE;
 
 	auto reader = channel_props_reader(url);
+	_info.port = reader.getT<unsigned short>("port", 8080);
 	/*
 	_table = reader.getT<std::string>("table");
 	if ((internal.caps & (caps::Input | caps::Output)) == caps::Input)
@@ -247,40 +310,34 @@ int WSServer::_init(const Channel::Url &url, Channel * master)
 	if (!reader)
 		return _log.fail(EINVAL, "Invalid url: {}", reader.error());
 
+	if (master) {
+		_ev_master = channel_cast<EvLoop>(master);
+		if (!_ev_master)
+			return _log.fail(EINVAL, "Master {} must be ev:// channel", master->name());
+		_log.info("Use shared event loop of {}", master->name());
+	}
+
 	return 0;
 }
 
-namespace {
 #if 0
+namespace {
 void poll_cb_uv(uv_poll_t* handle, int status, int events)
 {
 	int64_t buf;
 	auto r = read(handle->io_watcher.fd, &buf, sizeof(buf));
 	(void) r;
 }
-#else
-void poll_cb_ev(struct ev_loop *, ev_io *ev, int)
-{
-	int64_t buf;
-	auto r = read(ev->fd, &buf, sizeof(buf));
-	(void) r;
 }
 #endif
-}
 
 
 int WSServer::_open(const ConstConfig &s)
 {
+	if (_ev_released)
+		return _log.fail(EINVAL, "Shared event loop is destroyed");
+
 #ifdef __linux__
-	auto _timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (_timerfd == -1)
-		return _log.fail(EINVAL, "Failed to create timer fd: {}", strerror(errno));
-
-	struct itimerspec its = {};
-	its.it_interval = { 0, 100000000 };
-	its.it_value = { 0, 100000000 };
-	if (timerfd_settime(_timerfd, 0, &its, nullptr))
-		return _log.fail(EINVAL, "Failed to rearm timerfd: {}", strerror(errno));
 #if 0
 	if (uv_loop_init(&_uv_loop))
 		return _log.fail(EINVAL, "Failed to init libuv event loop");
@@ -294,16 +351,21 @@ int WSServer::_open(const ConstConfig &s)
 	_loop_ptr[0] = &_uv_loop;
 	_info.options |= LWS_SERVER_OPTION_LIBUV;
 #else
-	_ev_loop = ev_loop_new(EVFLAG_NOENV | EVFLAG_NOSIGMASK);
-	if (!_ev_loop)
-		return _log.fail(EINVAL, "Faield to ini libev event loop");
+	int fd = -1;
+	if (_ev_master) {
+		_ev_loop = _ev_master->loop();
+	} else {
+		_ev_loop = ev_loop_new(EVFLAG_NOENV | EVFLAG_NOSIGMASK);
+		if (!_ev_loop)
+			return _log.fail(EINVAL, "Faield to ini libev event loop");
 
-	ev_io_init(&_ev_timer, poll_cb_ev, _timerfd, EV_READ);
-	ev_io_start(_ev_loop, &_ev_timer);
+		if (auto r = _deadline.init(_ev_loop); r)
+			return _log.fail(EINVAL, "Failed to create timer fd: {}", strerror(r));
 
-	ev_run(_ev_loop, EVRUN_NOWAIT);
+		ev_run(_ev_loop, EVRUN_NOWAIT);
 
-	auto fd = tll_ev_backend_fd(_ev_loop);
+		fd = tll_ev_backend_fd(_ev_loop);
+	}
 
 	_loop_ptr[0] = _ev_loop;
 	_info.options |= LWS_SERVER_OPTION_LIBEV;
@@ -318,11 +380,23 @@ int WSServer::_open(const ConstConfig &s)
 	if (!_lws)
 		return _log.fail(EINVAL, "Failed to create LWS context");
 
+	if (_ev_master) {
+		// Events are dispatched by loop owner, nothing to process here
+		_update_dcaps(0, dcaps::Process);
+		return _ev_master->attach(self(), [this]() -> std::chrono::nanoseconds { return _timeout(); }, [this]() { _ev_release(); });
+	}
+
+	// Deadline of lws timers is known after the first loop run
+	if (auto r = _deadline.arm(std::chrono::nanoseconds(0)); r)
+		return _log.fail(EINVAL, "Failed to arm timerfd: {}", strerror(r));
 	return 0;
 }
 
 int WSServer::_close()
 {
+	if (_ev_master)
+		_ev_master->detach(self());
+
 	if (_lws) {
 		lws_context_destroy(_lws);
 		_lws = nullptr;
@@ -330,12 +404,12 @@ int WSServer::_close()
 
 	this->_update_fd(-1);
 
+#if 0
 	if (_timerfd != -1) {
 		::close(_timerfd);
 		_timerfd = -1;
 	}
 
-#if 0
 	uv_close((uv_handle_t *) &_uv_timer, nullptr);
 
 	_log.debug("Close UV loop");
@@ -344,10 +418,10 @@ int WSServer::_close()
 	for (auto i = 0u; i < 100000 && uv_loop_close(&_uv_loop) == UV_EBUSY; i++)
 		uv_run(&_uv_loop, UV_RUN_ONCE);
 #else
-	if (_ev_loop) {
+	_deadline.reset();
+	if (_ev_loop && !_ev_master)
 		ev_loop_destroy(_ev_loop);
-		_ev_loop = nullptr;
-	}
+	_ev_loop = nullptr;
 #endif
 
 	return 0;
@@ -360,11 +434,28 @@ int WSHTTP::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void
 	_log.trace("Callback {}", lws_callback_name(reason));
 	switch (reason) {
 	case LWS_CALLBACK_HTTP:
+		user->http_body = tll_lws_http_has_body(wsi);
 		if (_connected(wsi, user))
 			return tll_lws_drop(wsi, HTTP_STATUS_INTERNAL_SERVER_ERROR);
 		break;
 
-	case LWS_CALLBACK_HTTP_BODY:
+	// Body is passed in chunks as they are received from the socket, without buffering.
+	// Application can stop reading with rx_pause control message if it can not keep up.
+	case LWS_CALLBACK_HTTP_BODY: {
+		tll_msg_t msg = {};
+		msg.type = TLL_MESSAGE_DATA;
+		msg.addr = user->addr;
+		msg.data = in;
+		msg.size = len;
+		_callback_data(&msg);
+		break;
+	}
+
+	case LWS_CALLBACK_HTTP_BODY_COMPLETION:
+		user->http_body = false;
+		_callback_control(lws_scheme::body_complete::id, user->addr);
+		if (user->close || (user->queue && !user->queue->empty()))
+			lws_callback_on_writable(wsi);
 		break;
 
 	case LWS_CALLBACK_CLOSED_HTTP:
@@ -374,24 +465,35 @@ int WSHTTP::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void
 	case LWS_CALLBACK_HTTP_WRITEABLE: {
 		if (user->close)
 			return tll_lws_drop(wsi, (http_status) user->close);
+		if (!user->queue)
+			return -1;
+		if (user->http_body) // Rescheduled on body completion
+			return 0;
 
-		unsigned char buf[LWS_PRE + LWS_RECOMMENDED_MIN_HEADER_SPACE];
-		auto start = &buf[LWS_PRE];
-                auto p = start;
-		auto end = &buf[sizeof(buf) - 1];
-
-		if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK, "application/octet-stream", user->pending.size, &p, end))
-			return _log.fail(1, "Failed to set text/event-stream content type");
-
-		if (lws_finalize_write_http_header(wsi, start, &p, end))
-			return _log.fail(1, "Failed to finalize headers");
-
-		if (lws_write(wsi, (unsigned char *) user->pending.data, user->pending.size, LWS_WRITE_HTTP) < (long) user->pending.size)
-			return _log.fail(-1, "Failed to write data");
-
-		user->pending = {};
+		// All messages posted before socket became writable are sent as one response
+		if (!user->http_started) {
+			unsigned char buf[LWS_PRE + LWS_RECOMMENDED_MIN_HEADER_SPACE];
+			auto start = &buf[LWS_PRE];
+			auto p = start;
+			auto end = &buf[sizeof(buf) - 1];
+
+			if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK, "application/octet-stream", user->queue->bytes(), &p, end))
+				return _log.fail(1, "Failed to set text/event-stream content type");
+
+			if (lws_finalize_write_http_header(wsi, start, &p, end))
+				return _log.fail(1, "Failed to finalize headers");
+			user->http_started = true;
+			if (!user->queue->empty() && lws_send_pipe_choked(wsi)) {
+				lws_callback_on_writable(wsi);
+				return 0;
+			}
+		}
 
-		return -1;
+		if (_drain(wsi, user, LWS_WRITE_HTTP))
+			return -1;
+		if (user->queue->empty())
+			return -1;
+		return 0;
 	}
 
 	default:
@@ -441,12 +543,9 @@ int WSSSE::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void
 		break;
 
 	case LWS_CALLBACK_HTTP_WRITEABLE:
-		if (user->pending.size) {
-			if (lws_write(wsi, (unsigned char *) user->pending.data, user->pending.size, LWS_WRITE_HTTP) < (long) user->pending.size)
-				return _log.fail(-1, "Failed to write data");
-			user->pending = {};
-		}
-		if (user->close)
+		if (_drain(wsi, user, LWS_WRITE_HTTP))
+			return -1;
+		if (user->close && (!user->queue || user->queue->empty()))
 			return tll_lws_drop(wsi, (http_status) user->close);
 		break;
 
@@ -473,13 +572,9 @@ int WSWS::lws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *
 		break;
 
 	case LWS_CALLBACK_SERVER_WRITEABLE:
-		if (user->pending.size) {
-			const long size = user->pending.size - LWS_PRE;
-			if (lws_write(wsi, ((unsigned char *) user->pending.data) + LWS_PRE, size, LWS_WRITE_TEXT) < size)
-				return _log.fail(-1, "Failed to write data");
-			user->pending = {};
-		}
-		if (user->close)
+		if (_drain(wsi, user, LWS_WRITE_TEXT))
+			return -1;
+		if (user->close && (!user->queue || user->queue->empty()))
 			return tll_lws_drop(wsi, (http_status) user->close, -1);
 		break;
 
@@ -582,6 +677,24 @@ int WSServer::_process(long timeout, int flags)
 #endif
 	if (r < 0)
 		return _log.fail(EINVAL, "LWS process failed: {}", r);
+	return _rearm();
+}
+
+void WSServer::_ev_release()
+{
+	_log.error("Shared event loop is destroyed while channel is open");
+	_close();
+	_ev_master = nullptr;
+	_ev_released = true;
+	state(tll::state::Error);
+}
+
+int WSServer::_rearm()
+{
+	// Expired timers are serviced inside and time to the next one is returned, zero if there is
+	// buffered data that needs another loop run
+	if (auto r = _deadline.arm(_timeout()); r)
+		return _log.fail(EINVAL, "Failed to rearm timerfd: {}", strerror(r));
 	return 0;
 }
 
@@ -602,6 +715,18 @@ int WSNode<T>::_init(const Channel::Url &url, Channel * master)
 		_prefix = "/";
 	else if (_prefix[0] != '/')
 		_prefix = "/" + _prefix;
+
+	auto reader = this->channel_props_reader(url);
+	_high_water = reader.getT<tll::util::Size>("high-water", _high_water);
+	_low_water = reader.getT<tll::util::Size>("low-water", _low_water);
+	auto pool_size = reader.getT<tll::util::Size>("pool-size", 4 * 1024 * 1024);
+	if (!reader)
+		return this->_log.fail(EINVAL, "Invalid url: {}", reader.error());
+	if (_low_water > _high_water)
+		return this->_log.fail(EINVAL, "Low-water mark {} is larger then high-water mark {}", _low_water, _high_water);
+
+	_pool = std::make_shared<BufferPool>(pool_size);
+	_pool_reported = {};
 	return 0;
 }
 
@@ -610,7 +735,6 @@ int WSNode<T>::_open(const ConstConfig &props)
 {
 	if (_master->node_add(_prefix, static_cast<T *>(this)))
 		return this->_log.fail(EINVAL, "Failed to register node");
-	_addr = {};
 	return 0;
 }
 
@@ -625,27 +749,83 @@ int WSNode<T>::_close()
 template <typename T>
 int WSNode<T>::_post_control(const tll_msg_t *msg, int flags)
 {
-	if (msg->msgid != lws_scheme::disconnect::id)
+	switch (msg->msgid) {
+	case lws_scheme::disconnect::id: {
+		auto wsi = _sessions.lookup(msg->addr.u64);
+		if (!wsi)
+			return this->_log.fail(ENOENT, "Failed to disconnect: session 0x{:x} not found", msg->addr.u64);
+		auto user = static_cast<user_t *>(lws_wsi_user(*wsi));
+		user->close = 200;
+		lws_callback_on_writable(*wsi);
 		return 0;
-	auto it = _sessions.find(msg->addr.u64);
-	if (it == _sessions.end())
-		return this->_log.fail(ENOENT, "Failed to disconnect: session 0x{:x} not found", msg->addr.u64);
-	auto user = static_cast<user_t *>(lws_wsi_user(it->second));
-	user->close = 200;
-	lws_callback_on_writable(it->second);
-	return 0;
+	}
+
+	case lws_scheme::rx_pause::id:
+	case lws_scheme::rx_resume::id: {
+		auto wsi = _sessions.lookup(msg->addr.u64);
+		if (!wsi)
+			return this->_log.fail(ENOENT, "Failed to change flow control: session 0x{:x} not found", msg->addr.u64);
+		const bool enable = msg->msgid == lws_scheme::rx_resume::id;
+		this->_log.debug("{} reading from session 0x{:x}", enable ? "Resume" : "Pause", msg->addr.u64);
+		if (lws_rx_flow_control(*wsi, enable) < 0)
+			return this->_log.fail(EINVAL, "Failed to change flow control for session 0x{:x}", msg->addr.u64);
+		return 0;
+	}
+
+	default:
+		return 0;
+	}
 }
 
 template <typename T>
 int WSNode<T>::_post_data(const tll_msg_t *msg, int flags)
 {
-	auto it = _sessions.find(msg->addr.u64);
-	if (it == _sessions.end())
+	auto wsi = _sessions.lookup(msg->addr.u64);
+	if (!wsi)
 		return this->_log.fail(ENOENT, "Failed to post: session 0x{:x} not found", msg->addr.u64);
-	auto user = static_cast<user_t *>(lws_wsi_user(it->second));
+	auto user = static_cast<user_t *>(lws_wsi_user(*wsi));
+	if (!user->queue)
+		return this->_log.fail(ENOENT, "Failed to post: session 0x{:x} is not connected", msg->addr.u64);
+	if (user->http_started)
+		return this->_log.fail(EINVAL, "Failed to post: response for session 0x{:x} is already started", msg->addr.u64);
+	if (user->write_full)
+		return EAGAIN;
+
+	if (user->queue->empty())
+		lws_callback_on_writable(*wsi);
+	static_cast<T *>(this)->push(*user->queue, msg);
+	_stat_pool();
+
+	if (user->queue->bytes() >= _high_water) {
+		this->_log.debug("Session 0x{:x} queue is above high-water mark", msg->addr.u64);
+		user->write_full = true;
+		_callback_control(lws_scheme::write_full::id, msg->addr);
+	}
+	return 0;
+}
+
+template <typename T>
+int WSNode<T>::_drain(lws * wsi, WSServer::user_t * user, lws_write_protocol protocol)
+{
+	auto queue = user->queue;
+	if (!queue || queue->empty())
+		return 0;
 
-	user->pending = static_cast<T *>(this)->copy(msg);
-	lws_callback_on_writable(it->second);
+	do {
+		const long size = queue->front_size();
+		if (lws_write(wsi, queue->front(), size, protocol) < size)
+			return this->_log.fail(EINVAL, "Failed to write data");
+		queue->pop();
+	} while (!queue->empty() && !lws_send_pipe_choked(wsi));
+
+	if (!queue->empty())
+		lws_callback_on_writable(wsi);
+
+	if (user->write_full && queue->bytes() <= _low_water) {
+		this->_log.debug("Session 0x{:x} queue is below low-water mark", user->addr.u64);
+		user->write_full = false;
+		_callback_control(lws_scheme::write_ready::id, user->addr);
+	}
 	return 0;
 }
 
@@ -665,8 +845,8 @@ int WSNode<T>::_connected(lws * wsi, WSServer::user_t * user)
 	data->path.offset = sizeof(data->path);
 	memcpy(data + 1, uri->data(), uri->size());
 
-	user->addr = _next_addr();
-	_sessions.insert(std::make_pair(user->addr.u64, wsi));
+	user->addr = { _sessions.insert(wsi) };
+	user->queue = new SendQueue(LWS_PRE, _pool);
 
 	tll_msg_t msg = {};
 	msg.type = TLL_MESSAGE_CONTROL;
@@ -681,9 +861,7 @@ int WSNode<T>::_connected(lws * wsi, WSServer::user_t * user)
 template <typename T>
 int WSNode<T>::_disconnected(lws * wsi, WSServer::user_t * user)
 {
-	auto it = _sessions.find(user->addr.u64);
-	if (it != _sessions.end())
-		_sessions.erase(it);
+	_sessions.erase(user->addr.u64);
 
 	lws_scheme::disconnect data = {};
 	tll_msg_t msg = {};
@@ -694,7 +872,8 @@ int WSNode<T>::_disconnected(lws * wsi, WSServer::user_t * user)
 	msg.size = sizeof(data);
 	this->_callback(&msg);
 
-	user->pending = {};
+	delete user->queue;
+	user->queue = nullptr;
 	return 0;
 }
 
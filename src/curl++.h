@@ -66,6 +66,7 @@ template <> struct _curlinfo<CURLINFO_PRIVATE> { using type = void *; };
 template <> struct _curlinfo<CURLINFO_RESPONSE_CODE> { using type = long; };
 template <> struct _curlinfo<CURLINFO_CONTENT_LENGTH_DOWNLOAD_T> { using type = curl_off_t; };
 template <> struct _curlinfo<CURLINFO_EFFECTIVE_URL> { using type = const char *; };
+template <> struct _curlinfo<CURLINFO_TOTAL_TIME_T> { using type = curl_off_t; };
 }
 
 template <CURLINFO info>
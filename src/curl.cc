@@ -585,6 +585,34 @@ int ChCURL::_connect(curl_session_t * s)
 	return 0;
 }
 
+void ChCURL::_stat_connect()
+{
+	auto s = stat();
+	if (!s)
+		return;
+	auto page = s->acquire();
+	if (!page)
+		return;
+	page->connect.update(1);
+	s->release(page);
+}
+
+void ChCURL::_stat_disconnect(curl_session_t * session, bool complete)
+{
+	auto s = stat();
+	if (!s)
+		return;
+	auto page = s->acquire();
+	if (!page)
+		return;
+	page->disconnect.update(1);
+	if (complete) {
+		if (auto t = tll::curl::getinfo<CURLINFO_TOTAL_TIME_T>(session->curl); t)
+			page->latency.update(*t * 1000);
+	}
+	s->release(page);
+}
+
 int ChCURL::_post(const tll_msg_t *msg, int flags)
 {
 	if (msg->type != TLL_MESSAGE_DATA) {
@@ -768,6 +796,7 @@ size_t curl_session_t::read(char * data, size_t size)
 void curl_session_t::connected()
 {
 	state = tll::state::Active;
+	parent->_stat_connect();
 
 	wsize = tll::curl::getinfo<CURLINFO_CONTENT_LENGTH_DOWNLOAD_T>(curl);
 	if (wsize)
@@ -853,6 +882,8 @@ size_t curl_session_t::write(char * data, size_t size)
 void curl_session_t::finalize(int code, bool skip)
 {
 	parent->_log.debug("Finalize transfer: {}", code);
+	if (state == tll::state::Active)
+		parent->_stat_disconnect(this, !skip && !code);
 	state = tll::state::Closing;
 
 	parent->_update_dcaps(dcaps::Pending | dcaps::Process);
@@ -9,8 +9,11 @@
 #define _TLL_CHANNEL_CURL_H
 
 #include "tll/channel/base.h"
+#include "tll/stat.h"
 #include "tll/util/time.h"
 
+#include "stat-latency.h"
+
 #include <map>
 #include <vector>
 
@@ -90,6 +93,15 @@ class ChCURL : public tll::channel::Base<ChCURL>
 	static constexpr auto process_policy() { return ProcessPolicy::Custom; }
 	static constexpr auto child_policy() { return ChildPolicy::Many; }
 
+	struct StatType : public Base::StatType
+	{
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'c', 'o', 'n', 'n'> connect;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'd', 'i', 's', 'c'> disconnect;
+		LatencyStat latency; // Total transfer time reported by curl
+	};
+
+	tll::stat::BlockT<StatType> * stat() { return static_cast<tll::stat::BlockT<StatType> *>(this->internal.stat); }
+
 	~ChCURL() { _free(); }
 
 	std::optional<const tll_channel_impl_t *> _init_replace(const tll::Channel::Url &url, tll::Channel * master);
@@ -103,6 +115,8 @@ class ChCURL : public tll::channel::Base<ChCURL>
 
  private:
 	int _connect(curl_session_t * s);
+	void _stat_connect();
+	void _stat_disconnect(curl_session_t * s, bool complete);
 };
 
 #endif//_TLL_CHANNEL_CURL_H
@@ -0,0 +1,42 @@
+/*
+ * Configure time probe for offset of backend fd in struct ev_loop, it is not exported by libev.
+ * Creates epoll loop and looks for int field that holds epoll descriptor, prints its offset or
+ * nothing if it is not found.
+ */
+
+#define _GNU_SOURCE
+
+#include <ev.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static int is_epoll(int fd)
+{
+	char path[64], link[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	ssize_t r = readlink(path, link, sizeof(link) - 1);
+	if (r < 0)
+		return 0;
+	link[r] = 0;
+	return strcmp(link, "anon_inode:[eventpoll]") == 0;
+}
+
+int main()
+{
+	struct ev_loop * l = ev_loop_new(EVBACKEND_EPOLL | EVFLAG_NOENV);
+	if (!l || ev_backend(l) != EVBACKEND_EPOLL)
+		return 0;
+	// Loop structure is larger then this, backend fd is stored near the start
+	for (size_t off = 0; off < 1024; off += sizeof(int)) {
+		int fd;
+		memcpy(&fd, ((char *) l) + off, sizeof(fd));
+		if (fd > 2 && fd < 1024 && is_epoll(fd)) {
+			printf("%zu", off);
+			break;
+		}
+	}
+	ev_loop_destroy(l);
+	return 0;
+}
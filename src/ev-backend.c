@@ -1,15 +1,19 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include "ev-backend.h"
+#include <ev.h>
 
-static const size_t backend_fd_offset = 196;
+#include "ev-backend.h"
 
 int tll_ev_backend_fd(struct ev_loop *l)
 {
-#ifdef __linux__
-	return *(int *) (((uint8_t *) l) + backend_fd_offset);
+	// Offset is found by configure time probe (ev-backend-probe.c) against installed libev
+#if defined(__linux__) && defined(TLL_EV_BACKEND_FD_OFFSET)
+	if (ev_backend(l) != EVBACKEND_EPOLL)
+		return -1;
+	return *(int *) (((uint8_t *) l) + TLL_EV_BACKEND_FD_OFFSET);
 #else
+	(void) l;
 	return -1;
 #endif
 }
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_WS_EV_DEADLINE_H
+#define _TLL_WS_EV_DEADLINE_H
+
+#include <ev.h>
+
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+/**
+ * One-shot timerfd watched by libev loop
+ *
+ * TLL processor polls backend fd of libev loop, but expired libev timers do not make it readable.
+ * Instead of periodic ticks timer is armed after each loop run to the nearest deadline of the
+ * library that owns the loop, so idle channel is woken only when there is work to do.
+ */
+class EvDeadline
+{
+	int _fd = -1;
+	ev_io _io = {};
+	struct ev_loop * _loop = nullptr;
+	long long _armed = 0; // Absolute CLOCK_MONOTONIC time in ns, zero when disarmed or fired
+	unsigned long long _wakeups = 0;
+
+ public:
+	EvDeadline() = default;
+	EvDeadline(const EvDeadline &) = delete;
+	~EvDeadline() { reset(); }
+
+	unsigned long long wakeups() const { return _wakeups; }
+
+	/// Create timerfd and start watching it in the loop, return errno on failure
+	int init(struct ev_loop * loop)
+	{
+		reset();
+		_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (_fd == -1)
+			return errno;
+		_loop = loop;
+		ev_io_init(&_io, _callback, _fd, EV_READ);
+		_io.data = this;
+		ev_io_start(_loop, &_io);
+		return 0;
+	}
+
+	void reset()
+	{
+		if (_loop)
+			ev_io_stop(_loop, &_io);
+		_loop = nullptr;
+		if (_fd != -1)
+			::close(_fd);
+		_fd = -1;
+		_armed = 0;
+	}
+
+	/**
+	 * Fire after timeout, zero timeout means that there is pending work and loop should be run
+	 * again as soon as possible. Timer that is already armed to earlier time is not changed, it
+	 * wakes the loop and is armed again after the run.
+	 */
+	int arm(std::chrono::nanoseconds timeout)
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		auto deadline = ts.tv_sec * 1000000000ll + ts.tv_nsec + std::max<long long>(timeout.count(), 1);
+		if (_armed && _armed <= deadline)
+			return 0;
+
+		itimerspec its = {};
+		its.it_value = { (time_t) (deadline / 1000000000), (long) (deadline % 1000000000) };
+		if (timerfd_settime(_fd, TFD_TIMER_ABSTIME, &its, nullptr))
+			return errno;
+		_armed = deadline;
+		return 0;
+	}
+
+	/// Time left for libev timer, rounded up to microseconds so it is expired when timerfd fires
+	static std::chrono::nanoseconds remaining(struct ev_loop * loop, ev_timer * timer)
+	{
+		auto us = std::ceil(ev_timer_remaining(loop, timer) * 1000000);
+		return std::chrono::microseconds(us > 0 ? (long long) us : 0);
+	}
+
+ private:
+	static void _callback(struct ev_loop *, ev_io * io, int)
+	{
+		auto self = static_cast<EvDeadline *>(io->data);
+		uint64_t buf;
+		auto r = read(self->_fd, &buf, sizeof(buf));
+		(void) r;
+		self->_armed = 0;
+		self->_wakeups++;
+	}
+};
+
+#endif//_TLL_WS_EV_DEADLINE_H
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#include "ev-loop.h"
+
+#include "tll/channel/module.h"
+
+#include "ev-backend.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace tll;
+
+int EvLoop::_init(const tll::Channel::Url &url, tll::Channel *master)
+{
+	auto reader = channel_props_reader(url);
+	if (!reader)
+		return _log.fail(EINVAL, "Invalid url: {}", reader.error());
+
+	_loop = ev_loop_new(EVFLAG_NOENV | EVFLAG_NOSIGMASK);
+	if (!_loop)
+		return _log.fail(EINVAL, "Failed to init libev event loop");
+	return 0;
+}
+
+void EvLoop::_free()
+{
+	_release_attached();
+	_deadline.reset();
+	if (_loop)
+		ev_loop_destroy(_loop);
+	_loop = nullptr;
+}
+
+int EvLoop::_open(const tll::ConstConfig &)
+{
+	if (auto r = _deadline.init(_loop); r)
+		return _log.fail(EINVAL, "Failed to create timer fd: {}", strerror(r));
+
+	ev_run(_loop, EVRUN_NOWAIT);
+
+	auto fd = tll_ev_backend_fd(_loop);
+	if (fd == -1)
+		return _log.fail(EINVAL, "Backend fd of libev loop is not available");
+	_update_fd(fd);
+	_update_dcaps(dcaps::CPOLLIN);
+	return rearm();
+}
+
+int EvLoop::_close()
+{
+	auto attached = std::count_if(_timers.begin(), _timers.end(), [](auto & t) { return t.channel != nullptr; });
+	if (attached)
+		return _log.fail(EBUSY, "Can not close loop with {} attached channels, close them first", attached);
+	_update_fd(-1);
+	_deadline.reset();
+	return 0;
+}
+
+int EvLoop::_process(long timeout, int flags)
+{
+	auto r = ev_run(_loop, EVRUN_NOWAIT);
+	if (r < 0)
+		return _log.fail(EINVAL, "ev_run failed: {}", r);
+
+	_running = true;
+	for (auto & t : _timers) {
+		if (t.channel)
+			t.deadline = std::chrono::steady_clock::now() + t.timer();
+	}
+	_running = false;
+	_timers.remove_if([](auto & t) { return t.channel == nullptr; });
+	return rearm();
+}
+
+int EvLoop::attach(tll::Channel * channel, Timer timer, Release release)
+{
+	// Deadline is not known until callback is called, run the loop as soon as possible
+	_timers.push_back({ channel, std::move(timer), std::move(release), std::chrono::steady_clock::now() });
+	return rearm();
+}
+
+void EvLoop::detach(tll::Channel * channel)
+{
+	for (auto & t : _timers) {
+		if (t.channel == channel)
+			t.channel = nullptr;
+	}
+	if (!_running)
+		_timers.remove_if([](auto & t) { return t.channel == nullptr; });
+}
+
+void EvLoop::_release_attached()
+{
+	std::vector<std::pair<tll::Channel *, Release>> channels;
+	for (auto & t : _timers) {
+		if (t.channel)
+			channels.emplace_back(t.channel, t.release);
+	}
+	for (auto & [c, release] : channels) {
+		_log.error("Loop is destroyed with attached channel {}, it is moved to Error state", c->name());
+		release();
+	}
+	_timers.clear();
+}
+
+int EvLoop::rearm()
+{
+	if (state() != tll::state::Active && state() != tll::state::Opening)
+		return 0;
+
+	auto now = std::chrono::steady_clock::now();
+	std::chrono::nanoseconds timeout = timer_max;
+	for (auto & t : _timers) {
+		if (t.channel)
+			timeout = std::min<std::chrono::nanoseconds>(timeout, std::max<std::chrono::nanoseconds>(t.deadline - now, {}));
+	}
+	if (auto r = _deadline.arm(timeout); r)
+		return _log.fail(EINVAL, "Failed to rearm timerfd: {}", strerror(r));
+	return 0;
+}
+
+TLL_DEFINE_IMPL(EvLoop);
+
+TLL_DEFINE_MODULE(EvLoop);
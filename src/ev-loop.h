@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_WS_EV_LOOP_H
+#define _TLL_WS_EV_LOOP_H
+
+#include "tll/channel/base.h"
+
+#include "ev-deadline.h"
+
+#include <chrono>
+#include <functional>
+#include <list>
+
+/**
+ * Owner of libev loop shared by several channels
+ *
+ * Attached channels (lws server and uwsc clients) register their watchers in this loop instead of
+ * creating their own, so processor polls only one backend fd and each event is dispatched directly
+ * without nested wakeups. Loop is created on init and lives as long as the channel. Attached
+ * channels must be closed before the owner: close fails with EBUSY while any of them is attached.
+ * If owner is destroyed anyway attached channels are asked to release the loop and move to Error
+ * state, so none of them is left with watchers in freed loop and without knowing about it.
+ *
+ * Each attached channel provides callback that is called only after loop run: it may service
+ * expired work of its library and returns time to its next timer. Owner keeps returned deadlines
+ * and arms wakeup timer to the nearest one, callbacks are not used as getters outside of the run.
+ */
+class EvLoop : public tll::channel::Base<EvLoop>
+{
+ public:
+	using Timer = std::function<std::chrono::nanoseconds ()>;
+	using Release = std::function<void ()>;
+
+ private:
+	struct Attached
+	{
+		tll::Channel * channel = nullptr; // Reset when channel is detached while callbacks are running
+		Timer timer;
+		Release release; // Stop watchers and move to Error state, called when owner is destroyed
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	struct ev_loop * _loop = nullptr;
+	EvDeadline _deadline;
+	std::list<Attached> _timers; // Stable entries, callbacks may attach or detach channels
+	bool _running = false;
+
+ public:
+	static constexpr std::string_view channel_protocol() { return "ev"; }
+
+	/// Upper bound for timer sleep when no attached channel has closer deadline
+	static constexpr std::chrono::milliseconds timer_max = std::chrono::milliseconds(1000);
+
+	struct ev_loop * loop() { return _loop; }
+
+	int _init(const tll::Channel::Url &, tll::Channel *master);
+	int _open(const tll::ConstConfig &);
+	int _close();
+	void _free();
+
+	int _process(long timeout, int flags);
+
+	/// Register timer callback of attached channel, it is called after the next loop run
+	int attach(tll::Channel * channel, Timer timer, Release release);
+	void detach(tll::Channel * channel);
+
+	/// Arm wakeup timer to the nearest known deadline of attached channels
+	int rearm();
+
+ private:
+	/// Release loop in channels that are still attached, they detach themselves
+	void _release_attached();
+};
+
+#endif//_TLL_WS_EV_LOOP_H
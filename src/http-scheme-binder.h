@@ -5,7 +5,7 @@
 
 namespace http_scheme {
 
-static constexpr std::string_view scheme_string = R"(yamls+gz://eJyNUFFPgzAYfN+v6FsTA4mbE5U3AlWWKCyOPRsCn9JktA3tTJTw3/06cDK3Rd/u613ueucSkdfgE0onhEhluBTaJy0tlHIto1VeAEW+Mka96KKCGmiHWhDbWvsICKFPYCpZoqo1HwrNuDC3zk5hrcI0SViYIe05hEbskWUMj2s8Hph9niKKWRAhnCFMl9kiTVZ43eC1DLIwRnxncbqy+isL1xbNEWXPQWj9MJGuk4jdLxJmrS67buJ+t4shL6GxHV85bMrh4y5pB77qeYf0Bag2DRdvu6Jj2Xu+2cIJ1T4nlEJAYWwQL7HZ2cC6n2xvNUz4O7CQ5SgPd516RxrNPw813vxIo3JT/dmuH0H/6C6G2UYFI66Lw46zsx3/83loGnlq9y9TNbxS)";
+static constexpr std::string_view scheme_string = R"(yamls+gz://eNqNUtFugjAUffcr+tZkkUSdc5tvBuo02dAIZo+GQDeaAW1ocXGGf98tMKYIc2/n9pzc23PuNVDixXSKMO4hxIViPJFTdMS+EIZmpPB8ioEPlRI76Yc0pjgHLU2yWE4BIIRfqAp5AKqjOghoxhL10C8UupW5sm1iukBP+ghb5Jm4BIo7KJ6Ifh4CWpCZBXAEcLV2lyvbgeoeqvXMNReAHzVeOVp/q+FWozEgdzMzdT+YiLe2ReZLm+hWgzzvGT/uFtQLaKo9vjEaBdXHDXSs+LDk+6g0gKVKWfJeGD2V7b0ooy2qeo7Jk4T6Sg9iATjrHBiXkdWtqgibA30enMyDXIeTC41kX+eayfhCIzwVXnVXhiB/dTdVbJfdUi9u1dVBWEz651mMOrP4j0mapjz9K3kn4p+Qvszics9F/IPGoa55xPxD56FGXOpbH+j78rIC64N0PpjQZ5rnnRZE2bj+XzWo6SJIuRD0ZO1Z+7oq3U5x5UVX1XRPEyVbZHU4rylTdJ5FUZ3MsEFuYIOHmh31vgEyqi2Z)";
 
 enum class Method: int8_t
 {
@@ -51,7 +51,7 @@ struct Header
 
 struct Connect
 {
-	static constexpr size_t meta_size() { return 27; }
+	static constexpr size_t meta_size() { return 35; }
 	static constexpr std::string_view meta_name() { return "Connect"; }
 	static constexpr int meta_id() { return 1; }
 
@@ -83,6 +83,10 @@ struct Connect
 		using type_headers = tll::scheme::binder::List<Buf, Header::binder_type<Buf>, tll_scheme_offset_ptr_t>;
 		const type_headers get_headers() const { return this->template _get_binder<type_headers>(19); }
 		type_headers get_headers() { return this->template _get_binder<type_headers>(19); }
+
+		using type_params = tll::scheme::binder::List<Buf, Header::binder_type<Buf>, tll_scheme_offset_ptr_t>;
+		const type_params get_params() const { return this->template _get_binder<type_params>(27); }
+		type_params get_params() { return this->template _get_binder<type_params>(27); }
 	};
 
 	template <typename Buf>
@@ -123,6 +127,101 @@ struct Disconnect
 	static binder_type<Buf> bind_reset(Buf &buf) { return tll::scheme::make_binder_reset<binder_type, Buf>(buf); }
 };
 
+struct SlowConsumer
+{
+	static constexpr size_t meta_size() { return 25; }
+	static constexpr std::string_view meta_name() { return "SlowConsumer"; }
+	static constexpr int meta_id() { return 10; }
+
+	enum class Policy: int8_t
+	{
+		Close = 0,
+		Skip = 1,
+		Pause = 2,
+	};
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return SlowConsumer::meta_size(); }
+		static constexpr auto meta_name() { return SlowConsumer::meta_name(); }
+		static constexpr auto meta_id() { return SlowConsumer::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+
+		using type_policy = Policy;
+		type_policy get_policy() const { return this->template _get_scalar<type_policy>(0); }
+		void set_policy(type_policy v) { return this->template _set_scalar<type_policy>(0, v); }
+
+		using type_dropped = uint64_t;
+		type_dropped get_dropped() const { return this->template _get_scalar<type_dropped>(1); }
+		void set_dropped(type_dropped v) { return this->template _set_scalar<type_dropped>(1, v); }
+
+		using type_dropped_total = uint64_t;
+		type_dropped_total get_dropped_total() const { return this->template _get_scalar<type_dropped_total>(9); }
+		void set_dropped_total(type_dropped_total v) { return this->template _set_scalar<type_dropped_total>(9, v); }
+
+		using type_events = uint64_t;
+		type_events get_events() const { return this->template _get_scalar<type_events>(17); }
+		void set_events(type_events v) { return this->template _set_scalar<type_events>(17, v); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+
+	template <typename Buf>
+	static binder_type<Buf> bind_reset(Buf &buf) { return tll::scheme::make_binder_reset<binder_type, Buf>(buf); }
+};
+
+struct WriteFull
+{
+	static constexpr size_t meta_size() { return 0; }
+	static constexpr std::string_view meta_name() { return "WriteFull"; }
+	static constexpr int meta_id() { return 11; }
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return WriteFull::meta_size(); }
+		static constexpr auto meta_name() { return WriteFull::meta_name(); }
+		static constexpr auto meta_id() { return WriteFull::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+
+	template <typename Buf>
+	static binder_type<Buf> bind_reset(Buf &buf) { return tll::scheme::make_binder_reset<binder_type, Buf>(buf); }
+};
+
+struct WriteReady
+{
+	static constexpr size_t meta_size() { return 0; }
+	static constexpr std::string_view meta_name() { return "WriteReady"; }
+	static constexpr int meta_id() { return 12; }
+
+	template <typename Buf>
+	struct binder_type : public tll::scheme::Binder<Buf>
+	{
+		using tll::scheme::Binder<Buf>::Binder;
+
+		static constexpr auto meta_size() { return WriteReady::meta_size(); }
+		static constexpr auto meta_name() { return WriteReady::meta_name(); }
+		static constexpr auto meta_id() { return WriteReady::meta_id(); }
+		void view_resize() { this->_view_resize(meta_size()); }
+	};
+
+	template <typename Buf>
+	static binder_type<Buf> bind(Buf &buf, size_t offset = 0) { return binder_type<Buf>(tll::make_view(buf).view(offset)); }
+
+	template <typename Buf>
+	static binder_type<Buf> bind_reset(Buf &buf) { return tll::scheme::make_binder_reset<binder_type, Buf>(buf); }
+};
+
 } // namespace http_scheme
 
 template <>
@@ -147,3 +246,19 @@ struct tll::conv::dump<http_scheme::Method> : public to_string_from_string_buf<h
 		return tll::conv::to_string_buf<int8_t, Buf>((int8_t) v, buf);
 	}
 };
+
+template <>
+struct tll::conv::dump<http_scheme::SlowConsumer::Policy> : public to_string_from_string_buf<http_scheme::SlowConsumer::Policy>
+{
+	template <typename Buf>
+	static inline std::string_view to_string_buf(const http_scheme::SlowConsumer::Policy &v, Buf &buf)
+	{
+		switch (v) {
+		case http_scheme::SlowConsumer::Policy::Close: return "Close";
+		case http_scheme::SlowConsumer::Policy::Pause: return "Pause";
+		case http_scheme::SlowConsumer::Policy::Skip: return "Skip";
+		default: break;
+		}
+		return tll::conv::to_string_buf<int8_t, Buf>((int8_t) v, buf);
+	}
+};
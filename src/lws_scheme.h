@@ -11,6 +11,16 @@ static constexpr std::string_view scheme = R"(yamls://
   id: 2
   fields:
     - { name: code, type: uint16 }
+- name: write_full
+  id: 3
+- name: write_ready
+  id: 4
+- name: body_complete
+  id: 5
+- name: rx_pause
+  id: 6
+- name: rx_resume
+  id: 7
 )";
 
 struct connect {
@@ -22,4 +32,24 @@ struct disconnect {
 	static constexpr int id = 2;
 	uint16_t code;
 };
+
+struct write_full {
+	static constexpr int id = 3;
+};
+
+struct write_ready {
+	static constexpr int id = 4;
+};
+
+struct body_complete {
+	static constexpr int id = 5;
+};
+
+struct rx_pause {
+	static constexpr int id = 6;
+};
+
+struct rx_resume {
+	static constexpr int id = 7;
+};
 }
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_UWS_PUB_INDEX_H
+#define _TLL_UWS_PUB_INDEX_H
+
+#include <cstdint>
+#include <deque>
+
+/**
+ * Index of publish subscribers by ring position
+ *
+ * Keeps intrusive list of subscribers for each sequence number in [head, tail] range where head is
+ * sequence number of first message in the ring and tail is position after last message. Publishing
+ * new message touches only subscribers waiting at tail and eviction of head message touches only
+ * subscribers that still point to it, so cost does not depend on total number of subscribers.
+ *
+ * T must have following fields: ``T * pub_prev``, ``T * pub_next``, ``uint64_t seq`` and ``bool
+ * pub_linked``.
+ */
+template <typename T>
+class PubIndex
+{
+	struct List { T * head = nullptr; };
+
+	uint64_t _head = 0;
+	std::deque<List> _lists = { List {} };
+
+	List & _list(uint64_t seq) { return _lists[seq - _head]; }
+
+ public:
+	uint64_t head() const { return _head; }
+	uint64_t tail() const { return _head + _lists.size() - 1; }
+
+	bool head_empty() const { return _lists.front().head == nullptr; }
+
+	/// Call f for each subscriber that points to head message
+	template <typename F>
+	void head_for_each(F f)
+	{
+		for (auto u = _lists.front().head; u; u = u->pub_next)
+			f(u);
+	}
+
+	void reset(uint64_t seq = 0)
+	{
+		_head = seq;
+		_lists.clear();
+		_lists.emplace_back();
+	}
+
+	/// Link subscriber at position seq, seq must be in [head, tail] range
+	void insert(T * u, uint64_t seq)
+	{
+		auto & l = _list(seq);
+		u->seq = seq;
+		u->pub_prev = nullptr;
+		u->pub_next = l.head;
+		if (l.head)
+			l.head->pub_prev = u;
+		l.head = u;
+		u->pub_linked = true;
+	}
+
+	void remove(T * u)
+	{
+		if (!u->pub_linked)
+			return;
+		if (u->pub_prev)
+			u->pub_prev->pub_next = u->pub_next;
+		else
+			_list(u->seq).head = u->pub_next;
+		if (u->pub_next)
+			u->pub_next->pub_prev = u->pub_prev;
+		u->pub_prev = u->pub_next = nullptr;
+		u->pub_linked = false;
+	}
+
+	void move(T * u, uint64_t seq)
+	{
+		remove(u);
+		insert(u, seq);
+	}
+
+	/**
+	 * Append new message at tail and call f for each subscriber that was waiting for it.
+	 * Callback is allowed to move or remove subscriber.
+	 */
+	template <typename F>
+	void push(F f)
+	{
+		_lists.emplace_back();
+		for (auto u = _lists[_lists.size() - 2].head; u; ) {
+			auto next = u->pub_next;
+			f(u);
+			u = next;
+		}
+	}
+
+	/**
+	 * Drop head message and call f for each subscriber that pointed to it.
+	 * Subscribers are unlinked before callback.
+	 */
+	template <typename F>
+	void pop(F f)
+	{
+		auto l = _lists.front();
+		_lists.pop_front();
+		_head++;
+		if (_lists.empty())
+			_lists.emplace_back();
+		for (auto u = l.head; u; ) {
+			auto next = u->pub_next;
+			u->pub_prev = u->pub_next = nullptr;
+			u->pub_linked = false;
+			f(u);
+			u = next;
+		}
+	}
+};
+
+#endif//_TLL_UWS_PUB_INDEX_H
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_WS_RESPONSE_CACHE_H
+#define _TLL_WS_RESPONSE_CACHE_H
+
+#include <chrono>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * LRU cache of complete HTTP responses with TTL and limit on total size
+ *
+ * Expired entry is not returned by lookup but is kept until it is replaced by new response for the
+ * same key or pushed out by size limit. Responses larger then the limit are not stored.
+ */
+class ResponseCache
+{
+ public:
+	using clock = std::chrono::steady_clock;
+
+	struct Entry
+	{
+		std::string status;
+		std::vector<std::pair<std::string, std::string>> headers;
+		std::string body;
+		clock::time_point expire = {};
+
+		size_t size() const
+		{
+			auto r = status.size() + body.size();
+			for (auto & [k, v] : headers)
+				r += k.size() + v.size();
+			return r;
+		}
+	};
+
+ private:
+	struct Item
+	{
+		std::string key;
+		Entry entry;
+		size_t size = 0; // Key and entry size
+	};
+
+	std::list<Item> _lru; // Most recently used first
+	std::unordered_map<std::string_view, std::list<Item>::iterator> _index; // Keys point into _lru
+	size_t _size = 0;
+	size_t _limit = 0;
+	clock::duration _ttl = {};
+
+ public:
+	void init(size_t limit, clock::duration ttl)
+	{
+		clear();
+		_limit = limit;
+		_ttl = ttl;
+	}
+
+	void clear()
+	{
+		_index.clear();
+		_lru.clear();
+		_size = 0;
+	}
+
+	size_t size() const { return _size; }
+	size_t count() const { return _lru.size(); }
+
+	/// Find fresh entry and mark it as recently used
+	const Entry * lookup(std::string_view key, clock::time_point now)
+	{
+		auto it = _index.find(key);
+		if (it == _index.end() || it->second->entry.expire <= now)
+			return nullptr;
+		_lru.splice(_lru.begin(), _lru, it->second);
+		return &it->second->entry;
+	}
+
+	/// Store response, return number of entries evicted to fit it into the limit
+	unsigned insert(std::string_view key, Entry &&entry, clock::time_point now)
+	{
+		auto size = key.size() + entry.size();
+		if (size > _limit)
+			return 0;
+
+		if (auto it = _index.find(key); it != _index.end())
+			_erase(it->second);
+
+		unsigned evicted = 0;
+		while (_size + size > _limit && _lru.size()) {
+			_erase(std::prev(_lru.end()));
+			evicted++;
+		}
+
+		entry.expire = now + _ttl;
+		_lru.push_front({ std::string(key), std::move(entry), size });
+		_index.emplace(_lru.front().key, _lru.begin());
+		_size += size;
+		return evicted;
+	}
+
+ private:
+	void _erase(std::list<Item>::iterator it)
+	{
+		_size -= it->size;
+		_index.erase(it->key);
+		_lru.erase(it);
+	}
+};
+
+#endif//_TLL_WS_RESPONSE_CACHE_H
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_WS_ROUTER_H
+#define _TLL_WS_ROUTER_H
+
+#include <cerrno>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * Radix tree router for HTTP endpoints
+ *
+ * Route pattern is a path with optional ``{name}`` segments that match any non-empty string
+ * without ``/``. Parameter must take whole path segment: ``/item/{id}.json`` is rejected since
+ * value of ``{id}`` would consume ``.json`` suffix as well. Matched values are returned as list of (name, value) pairs. Route is either exact
+ * (whole path must match) or wildcard (pattern is a prefix of the path). Exact match is preferred,
+ * otherwise wildcard with longest matching prefix is selected. Each route is bound to a set of
+ * methods given as bitmask, routes with same pattern can coexist if their method sets do not
+ * intersect.
+ */
+template <typename T>
+class Router
+{
+ public:
+	static constexpr unsigned method_any = ~0u;
+
+	using Params = std::vector<std::pair<std::string_view, std::string_view>>;
+
+	struct Route
+	{
+		std::string pattern;
+		bool wildcard = false;
+		unsigned methods = method_any;
+		T value;
+	};
+
+ private:
+	struct Node
+	{
+		std::string label; // Static part of the edge from parent node
+		std::vector<std::unique_ptr<Node>> children;
+
+		std::unique_ptr<Node> param; // Child for {name} segment
+		std::string param_name;
+
+		std::vector<const Route *> exact;
+		std::vector<const Route *> wildcard;
+	};
+
+	struct Match
+	{
+		const Route * route = nullptr;
+		size_t pos = 0;
+		Params params;
+	};
+
+	Node _root;
+	std::list<Route> _routes;
+
+ public:
+	const std::list<Route> & routes() const { return _routes; }
+
+	/// Add route, return EEXIST if route with same pattern and method overlaps, EINVAL for invalid pattern
+	int add(std::string_view pattern, bool wildcard, unsigned methods, const T &value)
+	{
+		if (!_valid(pattern))
+			return EINVAL;
+		auto node = _insert(&_root, pattern);
+		if (!node)
+			return EINVAL;
+		auto & list = wildcard ? node->wildcard : node->exact;
+		for (auto r : list) {
+			if (r->methods & methods)
+				return EEXIST;
+		}
+		_routes.push_back({ std::string(pattern), wildcard, methods, value });
+		list.push_back(&_routes.back());
+		return 0;
+	}
+
+	/// Remove route, return ENOENT if pattern is not found and EINVAL if it is bound to other value
+	int remove(std::string_view pattern, bool wildcard, const T &value)
+	{
+		std::vector<Node *> path;
+		auto node = _find(&_root, pattern, path);
+		if (!node)
+			return ENOENT;
+		path.push_back(node);
+		auto & list = wildcard ? node->wildcard : node->exact;
+		if (list.empty())
+			return ENOENT;
+		for (auto it = list.begin(); it != list.end(); it++) {
+			if ((*it)->value != value)
+				continue;
+			auto route = *it;
+			list.erase(it);
+			for (auto r = _routes.begin(); r != _routes.end(); r++) {
+				if (&*r == route) {
+					_routes.erase(r);
+					break;
+				}
+			}
+			_prune(path);
+			return 0;
+		}
+		return EINVAL;
+	}
+
+	/// Find route for path and method bit, fill params if not null
+	const T * lookup(std::string_view path, unsigned method, Params * params = nullptr) const
+	{
+		Params stack;
+		Match best;
+		_match(&_root, path, 0, method, stack, best);
+		if (!best.route)
+			return nullptr;
+		if (params)
+			*params = std::move(best.params);
+		return &best.route->value;
+	}
+
+ private:
+	static const Route * _route(const std::vector<const Route *> &list, unsigned method)
+	{
+		for (auto r : list) {
+			if (r->methods & method)
+				return r;
+		}
+		return nullptr;
+	}
+
+	/// Walk the tree, return true when exact match is found
+	bool _match(const Node * node, std::string_view path, size_t pos, unsigned method, Params &params, Match &best) const
+	{
+		if (pos == path.size()) {
+			if (auto r = _route(node->exact, method); r) {
+				best = { r, pos, params };
+				return true;
+			}
+		}
+
+		if (auto r = _route(node->wildcard, method); r && (!best.route || pos > best.pos))
+			best = { r, pos, params };
+
+		auto tail = path.substr(pos);
+		if (!tail.size())
+			return false;
+
+		for (auto & c : node->children) {
+			if (c->label[0] != tail[0])
+				continue;
+			if (tail.substr(0, c->label.size()) == c->label && _match(c.get(), path, pos + c->label.size(), method, params, best))
+				return true;
+			break;
+		}
+
+		if (node->param) {
+			auto value = tail.substr(0, tail.find('/'));
+			if (value.size()) {
+				params.emplace_back(node->param_name, value);
+				if (_match(node->param.get(), path, pos + value.size(), method, params, best))
+					return true;
+				params.pop_back();
+			}
+		}
+		return false;
+	}
+
+	/// Parse {name} at the start of pattern, return empty name if it is invalid
+	static std::string_view _param(std::string_view pattern)
+	{
+		auto end = pattern.find('}');
+		if (end == pattern.npos)
+			return {};
+		return pattern.substr(1, end - 1);
+	}
+
+	/// Check that each parameter is valid and takes whole path segment
+	static bool _valid(std::string_view pattern)
+	{
+		for (size_t pos = 0; (pos = pattern.find('{', pos)) != pattern.npos; ) {
+			if (pos > 0 && pattern[pos - 1] != '/')
+				return false;
+			auto name = _param(pattern.substr(pos));
+			if (!name.size() || name.find_first_of("/{") != name.npos)
+				return false;
+			pos += name.size() + 2;
+			if (pos < pattern.size() && pattern[pos] != '/')
+				return false;
+		}
+		return true;
+	}
+
+	Node * _insert(Node * node, std::string_view pattern)
+	{
+		while (pattern.size()) {
+			if (pattern[0] == '{') {
+				auto name = _param(pattern);
+				if (!name.size())
+					return nullptr;
+				if (!node->param) {
+					node->param.reset(new Node);
+					node->param_name = name;
+				} else if (node->param_name != name)
+					return nullptr;
+				node = node->param.get();
+				pattern = pattern.substr(name.size() + 2);
+				continue;
+			}
+
+			auto chunk = pattern.substr(0, pattern.find('{'));
+			node = _insert_static(node, chunk);
+			pattern = pattern.substr(chunk.size());
+		}
+		return node;
+	}
+
+	Node * _insert_static(Node * node, std::string_view s)
+	{
+		while (s.size()) {
+			std::unique_ptr<Node> * slot = nullptr;
+			for (auto & c : node->children) {
+				if (c->label[0] == s[0]) {
+					slot = &c;
+					break;
+				}
+			}
+
+			if (!slot) {
+				node->children.emplace_back(new Node);
+				node->children.back()->label = s;
+				return node->children.back().get();
+			}
+
+			auto & label = (*slot)->label;
+			size_t common = 0;
+			while (common < s.size() && common < label.size() && s[common] == label[common])
+				common++;
+
+			if (common < label.size()) {
+				// Split edge, existing child is moved under new node with common part of the label
+				std::unique_ptr<Node> split(new Node);
+				split->label = label.substr(0, common);
+				label = label.substr(common);
+				split->children.push_back(std::move(*slot));
+				*slot = std::move(split);
+			}
+
+			node = slot->get();
+			s = s.substr(common);
+		}
+		return node;
+	}
+
+	/// Find node for pattern, path is filled with nodes from root to the parent of result
+	Node * _find(Node * node, std::string_view pattern, std::vector<Node *> &path)
+	{
+		while (node && pattern.size()) {
+			path.push_back(node);
+			if (pattern[0] == '{') {
+				auto name = _param(pattern);
+				if (!name.size() || !node->param || node->param_name != name)
+					return nullptr;
+				node = node->param.get();
+				pattern = pattern.substr(name.size() + 2);
+				continue;
+			}
+
+			Node * next = nullptr;
+			for (auto & c : node->children) {
+				if (pattern.substr(0, c->label.size()) == c->label) {
+					next = c.get();
+					break;
+				}
+			}
+			if (next)
+				pattern = pattern.substr(next->label.size());
+			node = next;
+		}
+		return node;
+	}
+
+	/// Drop nodes left without routes after removal of route from the last node in path
+	void _prune(std::vector<Node *> &path)
+	{
+		for (auto i = path.size(); i > 1; i--) {
+			auto node = path[i - 1];
+			auto parent = path[i - 2];
+			if (node->exact.size() || node->wildcard.size() || node->param)
+				return;
+
+			if (parent->param.get() == node) {
+				if (node->children.size())
+					return;
+				parent->param.reset();
+				parent->param_name.clear();
+				continue;
+			}
+
+			if (node->children.size() > 1)
+				return;
+			auto it = parent->children.begin();
+			while (it->get() != node)
+				it++;
+			if (node->children.empty()) {
+				parent->children.erase(it);
+				continue;
+			}
+
+			// Merge edge with its only child, node is destroyed here
+			auto child = std::move(node->children.front());
+			child->label = node->label + child->label;
+			*it = std::move(child);
+			return;
+		}
+	}
+};
+
+#endif//_TLL_WS_ROUTER_H
@@ -0,0 +1,186 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_WS_SEND_QUEUE_H
+#define _TLL_WS_SEND_QUEUE_H
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/**
+ * Pool of buffers with power of two size classes from 64 bytes to 64kb
+ *
+ * Released buffers are kept in per-class free lists while total size of cached buffers is within
+ * the limit and are handed out again for requests of the same class. Buffers larger then biggest
+ * class are allocated and freed directly.
+ */
+class BufferPool
+{
+	static constexpr unsigned min_shift = 6;
+	static constexpr unsigned classes = 11;
+
+	std::array<std::vector<unsigned char *>, classes> _free;
+	size_t _cached = 0;
+	size_t _limit = 0;
+
+ public:
+	struct Buffer
+	{
+		unsigned char * data = nullptr;
+		size_t capacity = 0;
+	};
+
+	/// Number of requests served from free lists, new allocations and allocations above 64kb
+	struct Counters
+	{
+		size_t hit = 0;
+		size_t miss = 0;
+		size_t oversize = 0;
+	};
+
+	explicit BufferPool(size_t limit) : _limit(limit) {}
+	BufferPool(const BufferPool &) = delete;
+	~BufferPool() { trim(); }
+
+	size_t cached() const { return _cached; }
+	const Counters & counters() const { return _counters; }
+
+	Buffer get(size_t size)
+	{
+		auto cls = _class(size);
+		if (cls >= classes) {
+			_counters.oversize++;
+			return { new unsigned char[size], size };
+		}
+		const size_t capacity = 1ul << (cls + min_shift);
+		auto & list = _free[cls];
+		if (list.empty()) {
+			_counters.miss++;
+			return { new unsigned char[capacity], capacity };
+		}
+		_counters.hit++;
+		auto data = list.back();
+		list.pop_back();
+		_cached -= capacity;
+		return { data, capacity };
+	}
+
+	void put(Buffer buffer)
+	{
+		if (!buffer.data)
+			return;
+		auto cls = _class(buffer.capacity);
+		if (cls >= classes || _cached + buffer.capacity > _limit)
+			return delete [] buffer.data;
+		_free[cls].push_back(buffer.data);
+		_cached += buffer.capacity;
+	}
+
+	/// Free all cached buffers
+	void trim()
+	{
+		for (auto & list : _free) {
+			for (auto ptr : list)
+				delete [] ptr;
+			list.clear();
+		}
+		_cached = 0;
+	}
+
+ private:
+	Counters _counters;
+
+	static unsigned _class(size_t size)
+	{
+		if (size <= (1ul << min_shift))
+			return 0;
+		return 64 - __builtin_clzl(size - 1) - min_shift;
+	}
+};
+
+/**
+ * Queue of outgoing messages for one session
+ *
+ * Entries are buffers from the pool with ``headroom`` bytes reserved before payload, like
+ * ``LWS_PRE`` required by ``lws_write``. Entries are kept in ring that grows in powers of two and
+ * is never shrunk, so queue of stable depth does not allocate memory for new messages.
+ */
+class SendQueue
+{
+ public:
+	struct Entry
+	{
+		BufferPool::Buffer buffer;
+		size_t size = 0; // Payload size without headroom
+	};
+
+ private:
+	std::shared_ptr<BufferPool> _pool; // Shared by all sessions of the node, may outlive it
+	std::vector<Entry> _ring;
+	size_t _head = 0;
+	size_t _count = 0;
+	size_t _bytes = 0;
+	size_t _headroom = 0;
+
+ public:
+	SendQueue(size_t headroom, std::shared_ptr<BufferPool> pool) : _pool(std::move(pool)), _headroom(headroom) {}
+	SendQueue(const SendQueue &) = delete;
+	~SendQueue() { clear(); }
+
+	bool empty() const { return _count == 0; }
+	size_t size() const { return _count; }
+	size_t bytes() const { return _bytes; } // Total payload size of all entries
+	size_t headroom() const { return _headroom; }
+
+	/// Add new entry at the tail, return pointer to payload that should be filled by caller
+	unsigned char * push(size_t size)
+	{
+		if (_count == _ring.size())
+			_grow();
+		auto & e = _ring[(_head + _count) & (_ring.size() - 1)];
+		e.buffer = _pool->get(_headroom + size);
+		e.size = size;
+		_count++;
+		_bytes += size;
+		return e.buffer.data + _headroom;
+	}
+
+	/// Payload of the first entry
+	unsigned char * front() { return _ring[_head].buffer.data + _headroom; }
+	size_t front_size() const { return _ring[_head].size; }
+
+	void pop()
+	{
+		auto & e = _ring[_head];
+		_bytes -= e.size;
+		_pool->put(e.buffer);
+		e = {};
+		_head = (_head + 1) & (_ring.size() - 1);
+		_count--;
+	}
+
+	void clear()
+	{
+		while (_count)
+			pop();
+		_head = 0;
+	}
+
+ private:
+	void _grow()
+	{
+		std::vector<Entry> ring(_ring.size() ? _ring.size() * 2 : 8);
+		for (auto i = 0u; i < _count; i++)
+			ring[i] = std::move(_ring[(_head + i) & (_ring.size() - 1)]);
+		_ring = std::move(ring);
+		_head = 0;
+	}
+};
+
+#endif//_TLL_WS_SEND_QUEUE_H
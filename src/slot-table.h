@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_WS_SLOT_TABLE_H
+#define _TLL_WS_SLOT_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Session table with O(1) lookup by address
+ *
+ * Address is composed from slot index in low 32 bits and slot generation in next 24 bits, high 8
+ * bits are not used by the table and can hold user data (like shard index). Generation is
+ * incremented each time slot is freed so stale address of closed session does not match new
+ * session that reuses the same slot. Generation starts from 1 so valid address is never zero.
+ */
+template <typename T>
+class SlotTable
+{
+	struct Slot
+	{
+		T value = {};
+		uint32_t generation = 1;
+		bool used = false;
+	};
+
+	std::vector<Slot> _slots;
+	std::vector<uint32_t> _free;
+	size_t _size = 0;
+
+ public:
+	static constexpr unsigned generation_shift = 32;
+	static constexpr uint64_t generation_mask = (1ull << 24) - 1;
+
+	size_t size() const { return _size; }
+
+	/// Store value in free slot and return its address
+	uint64_t insert(T value)
+	{
+		uint32_t idx;
+		if (_free.size()) {
+			idx = _free.back();
+			_free.pop_back();
+		} else {
+			idx = _slots.size();
+			_slots.emplace_back();
+		}
+		auto & s = _slots[idx];
+		s.value = value;
+		s.used = true;
+		_size++;
+		return ((s.generation & generation_mask) << generation_shift) | idx;
+	}
+
+	/// Find value by address, return nullptr if slot is empty or generation does not match
+	T * lookup(uint64_t addr)
+	{
+		auto idx = (uint32_t) addr;
+		if (idx >= _slots.size())
+			return nullptr;
+		auto & s = _slots[idx];
+		if (!s.used || (s.generation & generation_mask) != ((addr >> generation_shift) & generation_mask))
+			return nullptr;
+		return &s.value;
+	}
+
+	/// Free slot, return false if address is not valid
+	bool erase(uint64_t addr)
+	{
+		if (!lookup(addr))
+			return false;
+		auto idx = (uint32_t) addr;
+		auto & s = _slots[idx];
+		s.value = {};
+		s.used = false;
+		if (++s.generation > generation_mask)
+			s.generation = 1;
+		_free.push_back(idx);
+		_size--;
+		return true;
+	}
+
+	/// Call f(addr, value) for each used slot, callback is allowed to free slots
+	template <typename F>
+	void for_each(F f)
+	{
+		for (auto i = 0u; i < _slots.size(); i++) {
+			auto & s = _slots[i];
+			if (s.used)
+				f(((s.generation & generation_mask) << generation_shift) | i, s.value);
+		}
+	}
+
+	void clear()
+	{
+		_slots.clear();
+		_free.clear();
+		_size = 0;
+	}
+};
+
+#endif//_TLL_WS_SLOT_TABLE_H
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_WS_STAT_LATENCY_H
+#define _TLL_WS_STAT_LATENCY_H
+
+#include "tll/stat.h"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+namespace latency_stat {
+
+/*
+ * Log-linear (HDR-style) bucket layout. Samples are measured in units of 1024ns, first SubCount
+ * buckets are linear with width of one unit, then each power of two is split into SubCount equal
+ * buckets, so relative error is below 1 / SubCount. Last bucket ends at 2^30ns (about 1.07s).
+ */
+constexpr unsigned UnitShift = 10;
+constexpr unsigned SubBits = 3;
+constexpr unsigned SubCount = 1u << SubBits;
+constexpr unsigned Octaves = 17;
+constexpr unsigned Count = SubCount * (Octaves + 1);
+
+/// Bucket index for sample in nanoseconds, Count for samples above last bucket
+constexpr unsigned index(long long ns)
+{
+	unsigned long long v = std::max(ns, 0ll) >> UnitShift;
+	if (v < SubCount)
+		return v;
+	unsigned e = 63 - __builtin_clzll(v);
+	unsigned long long i = (e - SubBits + 1) * SubCount + ((v >> (e - SubBits)) & (SubCount - 1));
+	return std::min<unsigned long long>(i, Count);
+}
+
+/// Lower bound of bucket in nanoseconds, upper bound is lower bound of next bucket
+constexpr long long lower(unsigned i)
+{
+	if (i < SubCount)
+		return (long long) i << UnitShift;
+	unsigned e = i / SubCount + SubBits - 1;
+	return (long long) ((SubCount + i % SubCount) << (e - SubBits)) << UnitShift;
+}
+
+static_assert(index(lower(Count - 1)) == Count - 1 && index(lower(Count - 1) - 1) == Count - 2);
+static_assert(lower(Count) == 1ll << 30 && index(1ll << 30) == Count);
+
+constexpr char digit(unsigned v) { return '0' + v % 10; }
+
+/// Bucket counter named ``lNNN`` with zero padded index
+template <unsigned I>
+using Bucket = tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'l', digit(I / 100), digit(I / 10), digit(I)>;
+
+/*
+ * Stat block is a plain sequence of fields, so buckets are laid out by inheritance chain: each
+ * level adds one field after fields of its base.
+ */
+template <unsigned I>
+struct Buckets : public Buckets<I - 1> { Bucket<I> bucket; };
+
+template <>
+struct Buckets<0> { Bucket<0> bucket; };
+
+using All = Buckets<Count - 1>;
+static_assert(sizeof(All) == Count * sizeof(Bucket<0>), "Bucket fields are not packed");
+
+template <size_t... I>
+constexpr auto update_table(std::index_sequence<I...>)
+{
+	return std::array<void (*)(All &), Count> { [](All &b) { static_cast<Buckets<I> &>(b).bucket.update(1); }... };
+}
+
+} // namespace latency_stat
+
+/**
+ * Latency histogram embedded into channel StatType
+ *
+ * Stat block holds only scalar fields, so histogram is exported as a set of counters ``l000`` to
+ * ``l143`` with log-linear buckets (see latency_stat::lower for bounds), each counter is number of
+ * samples in its bucket. Samples above 2^30ns are counted in ``lover``. Sum and maximum of all
+ * samples are reported in separate fields, average is sum divided by total count of all buckets.
+ */
+struct LatencyStat : public latency_stat::All
+{
+	tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'l', 'o', 'v', 'e', 'r'> lover;
+	tll::stat::Integer<tll::stat::Sum, tll::stat::Ns, 'l', 's', 'u', 'm'> lsum;
+	tll::stat::Integer<tll::stat::Max, tll::stat::Ns, 'l', 'm', 'a', 'x'> lmax;
+
+	/// Add sample in nanoseconds
+	void update(long long ns)
+	{
+		static constexpr auto table = latency_stat::update_table(std::make_index_sequence<latency_stat::Count>());
+		if (auto i = latency_stat::index(ns); i < latency_stat::Count)
+			table[i](*this);
+		else
+			lover.update(1);
+		lsum.update(ns);
+		lmax.update(ns);
+	}
+};
+
+#endif//_TLL_WS_STAT_LATENCY_H
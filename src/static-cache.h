@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_WS_STATIC_CACHE_H
+#define _TLL_WS_STATIC_CACHE_H
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/openat2.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * Open file from static cache, loaded into memory if it is small enough. Data is copied instead of
+ * mapped: mapping of a file that is truncated in place gives SIGBUS on access.
+ */
+struct StaticFile
+{
+	int fd = -1; // Kept open only for files that are not loaded
+	const char * data = nullptr;
+	size_t size = 0;
+	std::string body;
+	std::string etag;
+	std::string last_modified;
+	std::string_view content_type;
+
+	StaticFile() = default;
+	StaticFile(const StaticFile &) = delete;
+	~StaticFile()
+	{
+		if (fd != -1)
+			::close(fd);
+	}
+};
+
+/// Content type by file extension, application/octet-stream for unknown ones
+inline std::string_view static_content_type(std::string_view path)
+{
+	static const std::map<std::string_view, std::string_view> types = {
+		{"css", "text/css"},
+		{"csv", "text/csv"},
+		{"gif", "image/gif"},
+		{"htm", "text/html"},
+		{"html", "text/html"},
+		{"ico", "image/x-icon"},
+		{"jpeg", "image/jpeg"},
+		{"jpg", "image/jpeg"},
+		{"js", "text/javascript"},
+		{"json", "application/json"},
+		{"png", "image/png"},
+		{"svg", "image/svg+xml"},
+		{"txt", "text/plain"},
+		{"wasm", "application/wasm"},
+		{"xml", "application/xml"},
+		{"yaml", "application/yaml"},
+	};
+	auto dot = path.rfind('.');
+	if (dot == path.npos || path.find('/', dot) != path.npos)
+		return "application/octet-stream";
+	auto it = types.find(path.substr(dot + 1));
+	return it == types.end() ? "application/octet-stream" : it->second;
+}
+
+/// Parsed Range header, only single range is supported
+struct StaticRange
+{
+	enum Type { Full, Partial, Invalid };
+	Type type = Full;
+	size_t offset = 0;
+	size_t size = 0;
+};
+
+/**
+ * Parse ``bytes=A-B``, ``bytes=A-`` or ``bytes=-N`` range for file of given size. Malformed header
+ * or multiple ranges give Full type (header is ignored), range that does not intersect with file
+ * is Invalid.
+ */
+inline StaticRange static_range(std::string_view header, size_t size)
+{
+	StaticRange r = { StaticRange::Full, 0, size };
+	if (header.substr(0, 6) != "bytes=")
+		return r;
+	header = header.substr(6);
+	if (header.find(',') != header.npos)
+		return r;
+	auto sep = header.find('-');
+	if (sep == header.npos)
+		return r;
+
+	auto number = [](std::string_view s) -> std::optional<size_t> {
+		if (!s.size() || s.size() > 18)
+			return std::nullopt;
+		size_t v = 0;
+		for (auto c : s) {
+			if (c < '0' || c > '9')
+				return std::nullopt;
+			v = v * 10 + (c - '0');
+		}
+		return v;
+	};
+
+	auto first = number(header.substr(0, sep));
+	auto last = number(header.substr(sep + 1));
+	if (sep + 1 < header.size() && !last)
+		return r;
+	if (!first) {
+		if (sep || !last)
+			return r;
+		// Suffix range: last N bytes
+		if (*last == 0 || size == 0)
+			return { StaticRange::Invalid };
+		auto n = std::min(*last, size);
+		return { StaticRange::Partial, size - n, n };
+	}
+	if (last && *last < *first)
+		return r;
+	if (*first >= size)
+		return { StaticRange::Invalid };
+	auto end = last ? std::min(*last + 1, size) : size;
+	return { StaticRange::Partial, *first, end - *first };
+}
+
+/**
+ * Decode percent escapes in url path, malformed escape or encoded zero byte give nullopt. Result
+ * must be validated after decoding, escaped ``.`` or ``/`` characters are decoded too.
+ */
+inline std::optional<std::string> static_path_decode(std::string_view path)
+{
+	auto hex = [](char c) -> int {
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	};
+
+	std::string r;
+	r.reserve(path.size());
+	for (size_t i = 0; i < path.size(); i++) {
+		if (path[i] != '%') {
+			r.push_back(path[i]);
+			continue;
+		}
+		if (i + 2 >= path.size())
+			return std::nullopt;
+		auto hi = hex(path[i + 1]), lo = hex(path[i + 2]);
+		if (hi < 0 || lo < 0 || (hi == 0 && lo == 0))
+			return std::nullopt;
+		r.push_back((char) (hi * 16 + lo));
+		i += 2;
+	}
+	return r;
+}
+
+/// Check If-None-Match header against entity tag
+inline bool static_etag_match(std::string_view header, std::string_view etag)
+{
+	while (header.size()) {
+		auto sep = header.find(',');
+		auto tag = header.substr(0, sep);
+		header = sep == header.npos ? std::string_view() : header.substr(sep + 1);
+		while (tag.size() && tag.front() == ' ')
+			tag.remove_prefix(1);
+		while (tag.size() && tag.back() == ' ')
+			tag.remove_suffix(1);
+		if (tag.substr(0, 2) == "W/") // Weak comparison is used for If-None-Match
+			tag.remove_prefix(2);
+		if (tag == "*" || tag == etag)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Cache of files under root directory
+ *
+ * Files not larger then ``mmap_max`` are loaded into memory and kept in cache while total size of
+ * loaded files is within ``limit``, files that do not fit are served but not cached. Larger files
+ * are only opened and should be sent with sendfile. Paths are resolved beneath root directory,
+ * symlinks that lead out of it are rejected. Directories of cached files are watched with
+ * inotify and changed entries are dropped, so next request reloads the file. Entries are shared
+ * pointers and stay valid for pending transfers after they are dropped from the cache.
+ */
+class StaticCache
+{
+	std::string _root;
+	std::string _root_real; // Canonical root path for systems without openat2
+	int _root_fd = -1;
+	size_t _mmap_max = 0;
+	size_t _limit = 0;
+	size_t _mapped = 0;
+
+	int _inotify = -1;
+	std::map<std::string, std::shared_ptr<StaticFile>, std::less<>> _files;
+	std::map<int, std::string> _watch; // Watched directory for each descriptor, relative to root
+
+ public:
+	StaticCache() = default;
+	StaticCache(const StaticCache &) = delete;
+	~StaticCache() { reset(); }
+
+	int fd() const { return _inotify; }
+	size_t size() const { return _files.size(); }
+	size_t mapped() const { return _mapped; }
+
+	/// Init cache and inotify descriptor, return errno on failure
+	int init(std::string_view root, size_t mmap_max, size_t limit)
+	{
+		reset();
+		_root = root;
+		while (_root.size() > 1 && _root.back() == '/')
+			_root.pop_back();
+		_mmap_max = mmap_max;
+		_limit = limit;
+		_root_fd = ::open(_root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (_root_fd == -1)
+			return errno;
+		std::array<char, PATH_MAX> buf;
+		if (!realpath(_root.c_str(), buf.data()))
+			return errno;
+		_root_real = buf.data();
+		_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (_inotify == -1)
+			return errno;
+		return 0;
+	}
+
+	void reset()
+	{
+		_files.clear();
+		_watch.clear();
+		_mapped = 0;
+		if (_inotify != -1)
+			::close(_inotify);
+		_inotify = -1;
+		if (_root_fd != -1)
+			::close(_root_fd);
+		_root_fd = -1;
+	}
+
+	/**
+	 * Find file by path relative to root, path must not contain ``.`` or ``..`` segments. Return
+	 * nullptr on failure with errno in error: EINVAL for invalid path, ENOENT if file is not found
+	 * or is not a regular file, EACCES if it is not readable or is outside of root.
+	 */
+	std::shared_ptr<StaticFile> lookup(std::string_view path, int &error)
+	{
+		while (path.size() && path.front() == '/')
+			path.remove_prefix(1);
+		if (!_valid(path)) {
+			error = EINVAL;
+			return nullptr;
+		}
+
+		if (auto it = _files.find(path); it != _files.end())
+			return it->second;
+
+		auto fd = _open(std::string(path));
+		if (fd == -1) {
+			error = (errno == EACCES || errno == EXDEV) ? EACCES : ENOENT;
+			return nullptr;
+		}
+
+		auto file = std::make_shared<StaticFile>();
+		file->fd = fd;
+
+		struct stat st;
+		if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+			error = ENOENT;
+			return nullptr;
+		}
+
+		file->size = st.st_size;
+		file->content_type = static_content_type(path);
+		file->etag = _etag(st);
+		file->last_modified = _http_date(st.st_mtime);
+
+		if (file->size && file->size <= _mmap_max) {
+			file->body.resize(file->size);
+			auto r = pread(fd, file->body.data(), file->body.size(), 0);
+			if (r < 0) {
+				error = errno;
+				return nullptr;
+			}
+			file->body.resize(r); // Truncated while loading, entry is dropped by inotify event
+			file->size = file->body.size();
+			file->data = file->body.data();
+			::close(fd);
+			file->fd = -1;
+		}
+
+		if (file->size > _mmap_max || _mapped + file->size > _limit || !_watch_dir(path))
+			return file;
+		_mapped += file->size;
+		_files.emplace(path, file);
+		return file;
+	}
+
+	/// Read inotify events and drop changed files, return number of dropped entries
+	unsigned process()
+	{
+		alignas(inotify_event) std::array<char, 4096> buf;
+		unsigned dropped = 0;
+		while (true) {
+			auto r = ::read(_inotify, buf.data(), buf.size());
+			if (r <= 0)
+				break;
+			for (auto ptr = buf.data(); ptr < buf.data() + r; ) {
+				auto ev = (const inotify_event *) ptr;
+				ptr += sizeof(inotify_event) + ev->len;
+
+				auto it = _watch.find(ev->wd);
+				if (it == _watch.end())
+					continue;
+				if (ev->len) {
+					dropped += _drop(it->second + ev->name);
+				} else if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+					// Directory is gone, drop everything that is cached from it
+					dropped += _drop_dir(it->second);
+					if (ev->mask & IN_IGNORED)
+						_watch.erase(it);
+				}
+			}
+		}
+		return dropped;
+	}
+
+ private:
+	/// Open file relative to root without leaving it, EXDEV is reported for paths that escape root
+	int _open(const std::string &path)
+	{
+		open_how how = {};
+		how.flags = O_RDONLY | O_CLOEXEC;
+		how.resolve = RESOLVE_BENEATH;
+		auto fd = (int) syscall(SYS_openat2, _root_fd, path.c_str(), &how, sizeof(how));
+		if (fd != -1 || errno != ENOSYS)
+			return fd;
+
+		// Kernel before 5.6, check where opened descriptor points to
+		fd = openat(_root_fd, path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+			return fd;
+		std::array<char, PATH_MAX> buf;
+		auto link = "/proc/self/fd/" + std::to_string(fd);
+		auto len = readlink(link.c_str(), buf.data(), buf.size());
+		auto real = std::string_view(buf.data(), std::max<ssize_t>(len, 0));
+		if (len <= 0 || real.size() <= _root_real.size() || real.substr(0, _root_real.size()) != _root_real || (real[_root_real.size()] != '/' && _root_real != "/")) {
+			::close(fd);
+			errno = EXDEV;
+			return -1;
+		}
+		return fd;
+	}
+
+	static bool _valid(std::string_view path)
+	{
+		if (!path.size() || path.back() == '/')
+			return false;
+		while (path.size()) {
+			auto sep = path.find('/');
+			auto seg = path.substr(0, sep);
+			if (seg == "" || seg == "." || seg == "..")
+				return false;
+			path = sep == path.npos ? std::string_view() : path.substr(sep + 1);
+		}
+		return true;
+	}
+
+	static std::string _etag(const struct stat &st)
+	{
+		std::array<char, 64> buf;
+		auto mtime = (unsigned long long) st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+		// Inode distinguishes files replaced within one tick of filesystem clock
+		auto len = snprintf(buf.data(), buf.size(), "\"%llx-%llx-%llx\"", (unsigned long long) st.st_ino, mtime, (unsigned long long) st.st_size);
+		return std::string(buf.data(), len);
+	}
+
+	static std::string _http_date(time_t t)
+	{
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		std::array<char, 64> buf;
+		auto len = strftime(buf.data(), buf.size(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+		return std::string(buf.data(), len);
+	}
+
+	/// Add watch for directory of the file, return false if it failed and file can not be cached
+	bool _watch_dir(std::string_view path)
+	{
+		auto sep = path.rfind('/');
+		auto dir = sep == path.npos ? std::string() : std::string(path.substr(0, sep + 1));
+		auto full = _root + "/" + dir;
+		auto wd = inotify_add_watch(_inotify, full.c_str(), IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+		if (wd == -1)
+			return false;
+		_watch[wd] = dir;
+		return true;
+	}
+
+	unsigned _drop(std::string_view path)
+	{
+		auto it = _files.find(path);
+		if (it == _files.end())
+			return 0;
+		_mapped -= it->second->size;
+		_files.erase(it);
+		return 1;
+	}
+
+	unsigned _drop_dir(std::string_view dir)
+	{
+		unsigned dropped = 0;
+		for (auto it = _files.lower_bound(dir); it != _files.end() && it->first.compare(0, dir.size(), dir) == 0; ) {
+			// Only files directly in this directory, subdirectories have their own watches
+			if (it->first.find('/', dir.size()) != it->first.npos) {
+				it++;
+				continue;
+			}
+			_mapped -= it->second->size;
+			it = _files.erase(it);
+			dropped++;
+		}
+		return dropped;
+	}
+};
+
+#endif//_TLL_WS_STATIC_CACHE_H
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_WS_URING_H
+#define _TLL_WS_URING_H
+
+#include <linux/io_uring.h>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Minimal io_uring wrapper used to submit batches of socket sends with one syscall
+ *
+ * Sends are queued with MSG_DONTWAIT flag, so kernel does not arm poll for sockets that can not
+ * accept data and returns -EAGAIN or partial result instead. Such requests are issued inline by
+ * io_uring_enter and their completions are usually available in the completion queue right after
+ * submit(). Submission never waits for completions, they are collected with reap() that only
+ * reads shared completion ring. Ring descriptor becomes readable when completion queue is not
+ * empty, so requests that are completed later can be reaped from event loop.
+ *
+ * Ring is created only if kernel consumes msghdr and iovec arrays at submission time
+ * (IORING_FEAT_SUBMIT_STABLE), so they can be reused right after submit(). Data buffers must stay
+ * valid until request is completed.
+ */
+class URing
+{
+	int _fd = -1;
+
+	void * _sq_ptr = nullptr;
+	size_t _sq_size = 0;
+	void * _cq_ptr = nullptr;
+	size_t _cq_size = 0;
+	io_uring_sqe * _sqes = nullptr;
+	size_t _sqes_size = 0;
+
+	unsigned * _sq_head = nullptr;
+	unsigned * _sq_tail = nullptr;
+	unsigned _sq_mask = 0;
+	unsigned * _sq_array = nullptr;
+	unsigned _sq_entries = 0;
+
+	unsigned * _cq_head = nullptr;
+	unsigned * _cq_tail = nullptr;
+	unsigned _cq_mask = 0;
+	io_uring_cqe * _cqes = nullptr;
+
+	unsigned _pending = 0; // Queued but not submitted
+	unsigned _inflight = 0; // Submitted but not reaped
+
+ public:
+	URing() = default;
+	URing(const URing &) = delete;
+	~URing() { reset(); }
+
+	int fd() const { return _fd; }
+	unsigned entries() const { return _sq_entries; }
+	unsigned pending() const { return _pending; }
+	unsigned inflight() const { return _inflight; }
+
+	/// Create ring with given number of entries, return errno on failure
+	int init(unsigned entries)
+	{
+		reset();
+
+		io_uring_params params = {};
+		_fd = syscall(__NR_io_uring_setup, entries, &params);
+		if (_fd < 0) {
+			_fd = -1;
+			return errno;
+		}
+		if (!(params.features & IORING_FEAT_SUBMIT_STABLE)) {
+			reset();
+			return ENOTSUP;
+		}
+
+		_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+			_sq_size = _cq_size = std::max(_sq_size, _cq_size);
+
+		_sq_ptr = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+		if (_sq_ptr == MAP_FAILED)
+			return _fail();
+		if (params.features & IORING_FEAT_SINGLE_MMAP) {
+			_cq_ptr = _sq_ptr;
+		} else {
+			_cq_ptr = mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+			if (_cq_ptr == MAP_FAILED)
+				return _fail();
+		}
+
+		_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		_sqes = (io_uring_sqe *) mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+		if (_sqes == MAP_FAILED) {
+			_sqes = nullptr;
+			return _fail();
+		}
+
+		auto sq = (char *) _sq_ptr;
+		_sq_head = (unsigned *) (sq + params.sq_off.head);
+		_sq_tail = (unsigned *) (sq + params.sq_off.tail);
+		_sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+		_sq_array = (unsigned *) (sq + params.sq_off.array);
+		_sq_entries = params.sq_entries;
+
+		auto cq = (char *) _cq_ptr;
+		_cq_head = (unsigned *) (cq + params.cq_off.head);
+		_cq_tail = (unsigned *) (cq + params.cq_off.tail);
+		_cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+		_cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+		return 0;
+	}
+
+	void reset()
+	{
+		if (_sqes)
+			munmap(_sqes, _sqes_size);
+		if (_cq_ptr && _cq_ptr != MAP_FAILED && _cq_ptr != _sq_ptr)
+			munmap(_cq_ptr, _cq_size);
+		if (_sq_ptr && _sq_ptr != MAP_FAILED)
+			munmap(_sq_ptr, _sq_size);
+		if (_fd != -1)
+			::close(_fd);
+		_fd = -1;
+		_sqes = nullptr;
+		_sq_ptr = _cq_ptr = nullptr;
+		_pending = 0;
+		_inflight = 0;
+		_sq_entries = 0;
+	}
+
+	/// Queue send request for single buffer, return false if submission queue is full
+	bool send(int fd, const void * data, size_t size, uint64_t user_data)
+	{
+		auto sqe = _sqe(fd, user_data);
+		if (!sqe)
+			return false;
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = (uintptr_t) data;
+		sqe->len = size;
+		return _push();
+	}
+
+	/// Queue sendmsg request, return false if submission queue is full
+	bool sendmsg(int fd, const msghdr * msg, uint64_t user_data)
+	{
+		auto sqe = _sqe(fd, user_data);
+		if (!sqe)
+			return false;
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->addr = (uintptr_t) msg;
+		sqe->len = 1;
+		return _push();
+	}
+
+	/// Submit queued requests without waiting for completions, return errno on failure
+	int submit()
+	{
+		while (_pending) {
+			auto r = syscall(__NR_io_uring_enter, _fd, _pending, 0, 0, nullptr, 0);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				return errno;
+			}
+			if (r == 0)
+				return EBUSY;
+			_pending -= std::min<unsigned>(r, _pending);
+			_inflight += r;
+		}
+		return 0;
+	}
+
+	/// Call f(user_data, result) for each available completion, return number of completions
+	template <typename F>
+	unsigned reap(F f)
+	{
+		auto head = *_cq_head;
+		auto tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+		unsigned count = 0;
+		for (; head != tail; head++, count++) {
+			auto cqe = &_cqes[head & _cq_mask];
+			f(cqe->user_data, cqe->res);
+		}
+		__atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+		_inflight -= std::min(count, _inflight);
+		return count;
+	}
+
+	/// Block until all submitted requests are completed, reap them with f. Intended for shutdown.
+	template <typename F>
+	int drain(F f)
+	{
+		while (_inflight) {
+			reap(f);
+			if (!_inflight)
+				break;
+			auto r = syscall(__NR_io_uring_enter, _fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (r < 0 && errno != EINTR)
+				return errno;
+		}
+		return 0;
+	}
+
+ private:
+	/// Get zeroed submission entry, nullptr if queue is full or completion queue may overflow
+	io_uring_sqe * _sqe(int fd, uint64_t user_data)
+	{
+		if (_pending + _inflight >= _sq_entries)
+			return nullptr;
+		auto sqe = &_sqes[*_sq_tail & _sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->fd = fd;
+		sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+		sqe->user_data = user_data;
+		return sqe;
+	}
+
+	bool _push()
+	{
+		auto tail = *_sq_tail;
+		auto idx = tail & _sq_mask;
+		_sq_array[idx] = idx;
+		__atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+		_pending++;
+		return true;
+	}
+
+	int _fail()
+	{
+		auto r = errno;
+		reset();
+		return r;
+	}
+};
+
+#endif//_TLL_WS_URING_H
@@ -1,5 +1,13 @@
 #include "uws-epoll.h"
 
+#include <errno.h>
+#include <linux/tls.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <time.h>
+
 #ifdef LIBUS_USE_EPOLL
 #define GET_READY_POLL(loop, index) (struct us_poll_t *) loop->ready_polls[index].data.ptr
 #define SET_READY_POLL(loop, index, poll) loop->ready_polls[index].data.ptr = poll
@@ -8,20 +16,43 @@
 #define SET_READY_POLL(loop, index, poll) loop->ready_polls[index].udata = poll
 #endif
 
+static long long monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
 int us_loop_step(struct us_loop_t * loop, int timeout_ms)
+{
+	return us_loop_step_bounded(loop, timeout_ms, 0, 0);
+}
+
+int us_loop_step_bounded(struct us_loop_t * loop, int timeout_ms, int max_events, long long max_ns)
 {
 	/* Emit pre callback */
 	us_internal_loop_pre(loop);
 
-	/* Fetch ready polls */
+	/* Fetch ready polls only when previous batch is fully dispatched */
+	if (loop->current_ready_poll >= loop->num_ready_polls) {
 #ifdef LIBUS_USE_EPOLL
-	loop->num_ready_polls = epoll_wait(loop->fd, loop->ready_polls, 1024, timeout_ms);
+		loop->num_ready_polls = epoll_wait(loop->fd, loop->ready_polls, 1024, timeout_ms);
 #else
-	loop->num_ready_polls = kevent(loop->fd, NULL, 0, loop->ready_polls, 1024, NULL);
+		loop->num_ready_polls = kevent(loop->fd, NULL, 0, loop->ready_polls, 1024, NULL);
 #endif
+		loop->current_ready_poll = 0;
+	}
+
+	long long deadline = max_ns > 0 ? monotonic_ns() + max_ns : 0;
+	int count = 0;
+
+	/* Iterate ready polls, dispatching them by type. Polls that are closed in the meantime are
+	 * marked with nullptr by uSockets, so it is safe to continue from current_ready_poll later */
+	for (; loop->current_ready_poll < loop->num_ready_polls; loop->current_ready_poll++) {
+		if (count && ((max_events > 0 && count >= max_events) || (deadline && monotonic_ns() >= deadline)))
+			break;
+		count++;
 
-	/* Iterate ready polls, dispatching them by type */
-	for (loop->current_ready_poll = 0; loop->current_ready_poll < loop->num_ready_polls; loop->current_ready_poll++) {
 		struct us_poll_t *poll = GET_READY_POLL(loop, loop->current_ready_poll);
 		/* Any ready poll marked with nullptr will be ignored */
 		if (poll) {
@@ -45,6 +76,179 @@ int us_loop_step(struct us_loop_t * loop, int timeout_ms)
 	}
 	/* Emit post callback */
 	us_internal_loop_post(loop);
+	return loop->current_ready_poll < loop->num_ready_polls ? loop->num_ready_polls - loop->current_ready_poll : 0;
+}
+
+
+struct us_fd_poll_t
+{
+	struct us_internal_callback_t cb;
+	void (*fd_cb)(void * user);
+	void * user;
+	int events;
+};
+
+static void us_fd_poll_dispatch(struct us_internal_callback_t * cb)
+{
+	struct us_fd_poll_t * p = (struct us_fd_poll_t *) cb;
+	p->fd_cb(p->user);
+}
+
+struct us_fd_poll_t * us_fd_poll_create(struct us_loop_t * loop, int fd, void (*cb)(void * user), void * user)
+{
+	struct us_poll_t * p = us_create_poll(loop, 0, sizeof(struct us_fd_poll_t) - sizeof(struct us_poll_t));
+	us_poll_init(p, fd, POLL_TYPE_CALLBACK);
+
+	struct us_fd_poll_t * fp = (struct us_fd_poll_t *) p;
+	fp->cb.loop = loop;
+	fp->cb.cb_expects_the_loop = 0;
+	fp->cb.leave_poll_ready = 1; /* Do not read from descriptor before callback like for timers */
+	fp->cb.cb = us_fd_poll_dispatch;
+	fp->fd_cb = cb;
+	fp->user = user;
+	fp->events = 0;
+	return fp;
+}
+
+void us_fd_poll_update(struct us_fd_poll_t * p, int events)
+{
+	if (p->events == events)
+		return;
+	if (!p->events)
+		us_poll_start(&p->cb.p, p->cb.loop, events);
+	else if (!events)
+		us_poll_stop(&p->cb.p, p->cb.loop);
+	else
+		us_poll_change(&p->cb.p, p->cb.loop, events);
+	p->events = events;
+}
+
+void us_fd_poll_free(struct us_fd_poll_t * p)
+{
+	us_fd_poll_update(p, 0);
+	us_poll_free(&p->cb.p, p->cb.loop);
+}
+
+int us_socket_fd(struct us_socket_t * s)
+{
+	return us_poll_fd(&s->p);
+}
+
+void us_socket_want_writable(struct us_socket_t * s)
+{
+	struct us_loop_t * loop = s->context->loop;
+	/* Dispatcher stops polling for writable after on_writable unless last write failed */
+	loop->data.last_write_failed = 1;
+	us_poll_change(&s->p, loop, LIBUS_SOCKET_READABLE | LIBUS_SOCKET_WRITABLE);
+}
+
+long long us_socket_sendfile(struct us_socket_t * s, int fd, off_t * offset, size_t size)
+{
+	ssize_t r = sendfile(us_poll_fd(&s->p), fd, offset, size);
+	if (r > 0)
+		return r;
+	if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		us_socket_want_writable(s);
+		return 0;
+	}
+	if (r == 0)
+		errno = ENODATA;
+	return -1;
+}
+
+/* Record types from TLS specification, kernel reports them as is */
+enum { TLS_RECORD_ALERT = 21, TLS_RECORD_HANDSHAKE = 22, TLS_RECORD_DATA = 23 };
+
+/* Read next record that is not application data from kTLS socket */
+static int ktls_recv_control(int fd, char * buf, int length, int flags)
+{
+	char control[CMSG_SPACE(sizeof(unsigned char))];
+	struct iovec iov = { buf, length };
+	struct msghdr msg = { 0 };
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	int r = recvmsg(fd, &msg, flags);
+	if (r < 0)
+		return r;
+
+	unsigned char type = TLS_RECORD_DATA;
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE)
+		type = *(unsigned char *) CMSG_DATA(cmsg);
+
+	switch (type) {
+	case TLS_RECORD_DATA:
+		return r;
+	case TLS_RECORD_ALERT:
+		/* Level and description, close_notify is reported as EOF */
+		if (r == 2 && buf[1] == 0)
+			return 0;
+		break;
+	case TLS_RECORD_HANDSHAKE:
+		/* Post handshake messages are ignored except KeyUpdate that kernel can not handle */
+		if (r > 0 && buf[0] != 24) {
+			errno = EAGAIN;
+			return -1;
+		}
+		break;
+	default:
+		break;
+	}
+	errno = ECONNRESET;
+	return -1;
+}
+
+/* Descriptors adopted with kTLS, uSockets loop and its sockets live in one thread */
+static _Thread_local unsigned char * ktls_fds = NULL;
+static _Thread_local int ktls_fds_size = 0;
+
+int us_fd_ktls_set(int fd, int enable)
+{
+	if (fd < 0)
+		return -1;
+	if (fd >= ktls_fds_size) {
+		if (!enable)
+			return 0;
+		int size = ktls_fds_size ? ktls_fds_size : 64;
+		while (size <= fd)
+			size *= 2;
+		unsigned char * ptr = realloc(ktls_fds, size);
+		if (!ptr)
+			return -1;
+		memset(ptr + ktls_fds_size, 0, size - ktls_fds_size);
+		ktls_fds = ptr;
+		ktls_fds_size = size;
+	}
+	ktls_fds[fd] = enable != 0;
 	return 0;
 }
 
+static int ktls_fd(int fd)
+{
+	return fd >= 0 && fd < ktls_fds_size && ktls_fds[fd];
+}
+
+int __real_bsd_recv(LIBUS_SOCKET_DESCRIPTOR fd, void * buf, int length, int flags);
+
+int __wrap_bsd_recv(LIBUS_SOCKET_DESCRIPTOR fd, void * buf, int length, int flags)
+{
+	int r = __real_bsd_recv(fd, buf, length, flags);
+	if (r >= 0 || errno != EIO || !ktls_fd(fd))
+		return r;
+	/* kTLS socket fails plain recv with EIO when next record is not application data */
+	r = ktls_recv_control(fd, buf, length, flags);
+	if (r < 0 && errno == EAGAIN)
+		return __real_bsd_recv(fd, buf, length, flags);
+	return r;
+}
+
+void __real_bsd_close_socket(LIBUS_SOCKET_DESCRIPTOR fd);
+
+void __wrap_bsd_close_socket(LIBUS_SOCKET_DESCRIPTOR fd)
+{
+	us_fd_ktls_set(fd, 0);
+	__real_bsd_close_socket(fd);
+}
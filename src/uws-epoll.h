@@ -4,6 +4,8 @@
 #define LIBUS_USE_EPOLL
 #include "libusockets.h"
 
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif//__cplusplus
@@ -13,6 +15,61 @@ extern "C" {
 
 int us_loop_step(struct us_loop_t * loop, int timeout_ms);
 
+/**
+ * Dispatch at most max_events ready polls or stop when max_ns nanoseconds are elapsed, zero means
+ * no limit. At least one poll is dispatched. Unprocessed polls are kept in the loop and dispatched
+ * by next call before waiting for new events. Return number of unprocessed polls.
+ */
+int us_loop_step_bounded(struct us_loop_t * loop, int timeout_ms, int max_events, long long max_ns);
+
+/**
+ * Poll for external descriptor dispatched by uSockets loop. Callback is called when any of
+ * requested events is ready (or on error), it does not get event mask and should try all
+ * operations it is interested in. Events are LIBUS_SOCKET_READABLE and LIBUS_SOCKET_WRITABLE,
+ * zero mask stops polling. Descriptor is not closed by us_fd_poll_free.
+ */
+struct us_fd_poll_t;
+struct us_fd_poll_t * us_fd_poll_create(struct us_loop_t * loop, int fd, void (*cb)(void * user), void * user);
+void us_fd_poll_update(struct us_fd_poll_t * poll, int events);
+void us_fd_poll_free(struct us_fd_poll_t * poll);
+
+/// Descriptor of the socket for writes that bypass uSockets buffer, like sendfile
+int us_socket_fd(struct us_socket_t * s);
+
+/**
+ * Poll socket for writable after write done outside of uSockets would block, context on_writable
+ * callback is called when socket can accept more data. Should be called again from on_writable
+ * if socket is still not drained.
+ *
+ * Relies on loop internals of uSockets v0.8.x (bundled with uWebSockets v20.x): dispatcher stops
+ * polling for writable unless last_write_failed flag is set. Recheck on uSockets update.
+ */
+void us_socket_want_writable(struct us_socket_t * s);
+
+/**
+ * Send file range directly into the socket bypassing uSockets buffer, offset is advanced. Return
+ * number of bytes sent, 0 if socket would block (writable poll is requested with
+ * us_socket_want_writable) or -1 on error, file that is shorter then range gives ENODATA.
+ */
+long long us_socket_sendfile(struct us_socket_t * s, int fd, off_t * offset, size_t size);
+
+/**
+ * Mark descriptor as kTLS socket before it is adopted by uSockets loop, flag is per thread and is
+ * cleared when socket is closed. Return -1 if flag table can not be allocated.
+ */
+int us_fd_ktls_set(int fd, int enable);
+
+/**
+ * Replacement for uSockets bsd_recv, linked with -Wl,--wrap=bsd_recv. Sockets marked with
+ * us_fd_ktls_set fail plain recv with EIO when next record is not application data: record is
+ * read with recvmsg and TLS_GET_RECORD_TYPE, close_notify alert gives EOF, other post handshake
+ * messages are skipped, anything else resets the connection. EIO on other sockets is returned as is.
+ */
+int __wrap_bsd_recv(LIBUS_SOCKET_DESCRIPTOR fd, void * buf, int length, int flags);
+
+/// Replacement for uSockets bsd_close_socket, linked with -Wl,--wrap=bsd_close_socket, drops kTLS flag
+void __wrap_bsd_close_socket(LIBUS_SOCKET_DESCRIPTOR fd);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif//__cplusplus
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2021 Pavel Shramov <shramov@mexmat.net>
+ *
+ * tll is free software; you can redistribute it and/or modify
+ * it under the terms of the MIT license. See LICENSE for details.
+ */
+
+#ifndef _TLL_UWS_TLS_H
+#define _TLL_UWS_TLS_H
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <string>
+
+/// Last OpenSSL error as string, error queue is cleared
+inline std::string tls_error()
+{
+	auto e = ERR_get_error();
+	ERR_clear_error();
+	if (!e)
+		return "unknown error";
+	std::array<char, 256> buf;
+	ERR_error_string_n(e, buf.data(), buf.size());
+	return buf.data();
+}
+
+/// Common options of server SSL_CTX: protocol versions, buffer modes and session tickets
+inline void tls_ctx_setup(SSL_CTX * ctx, bool tickets)
+{
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+	if (tickets) {
+		// Stateless tickets with keys generated by OpenSSL, resumed handshake skips certificate
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_set_num_tickets(ctx, 1);
+	} else {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		SSL_CTX_set_num_tickets(ctx, 0);
+	}
+}
+
+/**
+ * Check that kTLS can be enabled: OpenSSL is built with kTLS support and kernel has tls module.
+ * Attaching ULP to unconnected socket fails with ENOTCONN if module is available and with ENOENT
+ * if it is not.
+ */
+inline bool ktls_available()
+{
+#ifdef SSL_OP_ENABLE_KTLS
+	auto fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+		return false;
+	auto r = setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls"));
+	auto error = errno;
+	::close(fd);
+	return r == 0 || error == ENOTCONN;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Server side SSL_CTX with certificate, session tickets and kTLS for connections that are passed
+ * to plain socket layer
+ */
+class TLSContext
+{
+	SSL_CTX * _ctx = nullptr;
+
+ public:
+	TLSContext() = default;
+	TLSContext(const TLSContext &) = delete;
+	~TLSContext() { reset(); }
+
+	SSL_CTX * get() { return _ctx; }
+
+	void reset()
+	{
+		if (_ctx)
+			SSL_CTX_free(_ctx);
+		_ctx = nullptr;
+	}
+
+	/// Create context, return error description on failure
+	std::optional<std::string> init(const std::string &cert, const std::string &key, bool tickets)
+	{
+		reset();
+		_ctx = SSL_CTX_new(TLS_server_method());
+		if (!_ctx)
+			return "Failed to create SSL context: " + tls_error();
+		if (SSL_CTX_use_certificate_chain_file(_ctx, cert.c_str()) != 1)
+			return "Failed to load certificate '" + cert + "': " + tls_error();
+		if (SSL_CTX_use_PrivateKey_file(_ctx, key.c_str(), SSL_FILETYPE_PEM) != 1)
+			return "Failed to load private key '" + key + "': " + tls_error();
+		if (SSL_CTX_check_private_key(_ctx) != 1)
+			return "Private key does not match certificate: " + tls_error();
+
+		tls_ctx_setup(_ctx, tickets);
+#ifdef SSL_OP_ENABLE_KTLS
+		SSL_CTX_set_options(_ctx, SSL_OP_ENABLE_KTLS);
+#endif
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+		// Receive offload for TLS 1.3 is supported by OpenSSL starting from 3.2
+		SSL_CTX_set_max_proto_version(_ctx, TLS1_2_VERSION);
+#endif
+		// Only ciphers that kernel can offload
+		if (SSL_CTX_set_cipher_list(_ctx, "ECDHE+AESGCM:ECDHE+CHACHA20") != 1)
+			return "Failed to set cipher list: " + tls_error();
+		SSL_CTX_set_ciphersuites(_ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256");
+		return std::nullopt;
+	}
+};
+
+/**
+ * Server side TLS handshake on non-blocking socket
+ *
+ * After handshake socket with kTLS enabled in both directions is passed to the plain socket layer
+ * as is. Methods report readiness that is needed to make progress in ``want`` field.
+ */
+class TLSConnection
+{
+	SSL * _ssl = nullptr;
+	int _fd = -1;
+
+ public:
+	enum Event { Read = 1, Write = 2 };
+	enum class Result { Again, Done, Error };
+
+	unsigned want = 0;
+	std::string error;
+
+	TLSConnection() = default;
+	TLSConnection(const TLSConnection &) = delete;
+	~TLSConnection() { close(); }
+
+	int fd() const { return _fd; }
+	SSL * ssl() { return _ssl; }
+
+	/// Take ownership of accepted socket
+	int init(SSL_CTX * ctx, int fd)
+	{
+		_fd = fd;
+		_ssl = SSL_new(ctx);
+		if (!_ssl)
+			return ENOMEM;
+		SSL_set_fd(_ssl, fd);
+		SSL_set_accept_state(_ssl);
+		want = Read;
+		return 0;
+	}
+
+	void close()
+	{
+		if (_ssl)
+			SSL_free(_ssl);
+		_ssl = nullptr;
+		if (_fd != -1)
+			::close(_fd);
+		_fd = -1;
+	}
+
+	Result handshake()
+	{
+		ERR_clear_error();
+		auto r = SSL_do_handshake(_ssl);
+		if (r == 1) {
+			want = 0;
+			return Result::Done;
+		}
+		return _want(SSL_get_error(_ssl, r), want) ? Result::Again : Result::Error;
+	}
+
+	bool resumed() const { return SSL_session_reused(_ssl); }
+	const char * cipher() const { return SSL_get_cipher_name(_ssl); }
+	bool ktls_send() const { return BIO_get_ktls_send(SSL_get_wbio(_ssl)); }
+	bool ktls_recv() const { return BIO_get_ktls_recv(SSL_get_rbio(_ssl)); }
+
+	/**
+	 * Release socket with kTLS enabled for both directions, caller owns returned descriptor.
+	 * Connection is closed without sending close_notify.
+	 */
+	int detach()
+	{
+		auto fd = _fd;
+		SSL_free(_ssl);
+		_ssl = nullptr;
+		_fd = -1;
+		return fd;
+	}
+
+ private:
+	bool _want(int e, unsigned &w)
+	{
+		switch (e) {
+		case SSL_ERROR_WANT_READ:
+			w |= Read;
+			return true;
+		case SSL_ERROR_WANT_WRITE:
+			w |= Write;
+			return true;
+		case SSL_ERROR_SYSCALL:
+			error = errno ? strerror(errno) : "unexpected EOF";
+			ERR_clear_error();
+			return false;
+		default:
+			error = tls_error();
+			return false;
+		}
+	}
+};
+
+#endif//_TLL_UWS_TLS_H
@@ -7,151 +7,772 @@
 
 #include "App.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
 #include <variant>
 
+#include <endian.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
 #include "tll/channel/base.h"
 #include "tll/channel/module.h"
+#include "tll/stat.h"
 #include "tll/util/cppring.h"
+#include "tll/util/ownedmsg.h"
 #include "tll/util/size.h"
+#include "tll/util/time.h"
 
 #include "http-scheme-binder.h"
 #include "http-status.h"
+#include "pub-index.h"
+#include "response-cache.h"
+#include "router.h"
+#include "slot-table.h"
+#include "stat-latency.h"
+#include "static-cache.h"
+#include "uring.h"
 #include "uws-epoll.h"
+#include "uws-tls.h"
+
+/*
+ * Server and nodes are templates over SSL flag of uWS types: plain variant serves uws:// and
+ * uwss:// with kTLS, SSL variant runs over uSockets SSL layer. Node channels are created as plain
+ * ones and are replaced with SSL variant when their master is SSL server.
+ */
 
 using namespace tll;
 using Method = http_scheme::Method;
 
-class WSHTTP;
-class WSWS;
-class WSPub;
+/// Server that owns thread local uWS loop, shared by plain and SSL variants
+thread_local const void * uws_loop_owner = nullptr;
+thread_local std::string uws_loop_owner_name;
+
+namespace {
+/**
+ * Expose raw write of uWS socket that is used to send prebuilt websocket frames
+ *
+ * AsyncSocket::write and isCorked are protected members of uWS (checked with v20.x), there is no
+ * public API to write bytes that bypass websocket framing. Asserts below break the build if their
+ * signatures or socket layout change on uWS update instead of silently corrupting the stream.
+ */
+template <bool SSL>
+struct RawSocket : public uWS::AsyncSocket<SSL>
+{
+	using uWS::AsyncSocket<SSL>::write;
+	using uWS::AsyncSocket<SSL>::isCorked;
+
+	template <typename T>
+	static RawSocket * cast(T * socket)
+	{
+		static_assert(std::is_base_of_v<uWS::AsyncSocket<SSL>, T>, "uWS socket is not derived from AsyncSocket");
+		return static_cast<RawSocket *>(static_cast<uWS::AsyncSocket<SSL> *>(socket));
+	}
+};
+
+template <bool SSL>
+constexpr bool raw_socket_check()
+{
+	static_assert(sizeof(RawSocket<SSL>) == sizeof(uWS::AsyncSocket<SSL>), "RawSocket must not add data members");
+	static_assert(std::is_same_v<decltype(std::declval<RawSocket<SSL> &>().write((const char *) nullptr, 0)), std::pair<int, bool>>,
+		"AsyncSocket::write signature changed, check that it still appends to socket buffer");
+	static_assert(std::is_same_v<decltype(std::declval<RawSocket<SSL> &>().isCorked()), bool>, "AsyncSocket::isCorked signature changed");
+	return true;
+}
+
+static_assert(raw_socket_check<false>() && raw_socket_check<true>());
+
+/**
+ * HTTP response with body sent bypassing uWS buffer, like sendfile
+ *
+ * uWS counts only body bytes passed through tryEnd in write offset and completes response when
+ * offset reaches total size given to tryEnd (checked with v20.x). Headers are written by tryEnd
+ * with empty data and full Content-Length, then body is sent directly into the socket and last
+ * block is passed through tryEnd with total size of that block only. uWS sees complete response of
+ * that size and resumes keep-alive processing. Asserts below break the build if signatures change,
+ * semantics must be rechecked on uWS update.
+ */
+template <bool SSL>
+struct RawResponse
+{
+	using Response = uWS::HttpResponse<SSL>;
+
+	/// Write status and headers with Content-Length of the whole body, no body bytes are written
+	static void begin(Response * resp, size_t size) { resp->tryEnd({}, size); }
+
+	/// Write last block of the body that is not sent directly, return tryEnd (ok, done) pair
+	static std::pair<bool, bool> end(Response * resp, std::string_view tail)
+	{
+		return resp->tryEnd(tail.substr(resp->getWriteOffset()), tail.size());
+	}
+};
+
+template <bool SSL>
+constexpr bool raw_response_check()
+{
+	using Response = uWS::HttpResponse<SSL>;
+	static_assert(std::is_same_v<decltype(std::declval<Response &>().tryEnd(std::string_view(), uintmax_t())), std::pair<bool, bool>>,
+		"HttpResponse::tryEnd signature changed, check write offset accounting");
+	static_assert(std::is_same_v<decltype(std::declval<Response &>().getWriteOffset()), uintmax_t>, "HttpResponse::getWriteOffset signature changed");
+	return true;
+}
+
+static_assert(raw_response_check<false>() && raw_response_check<true>());
+
+/// Find parameter value in url query string, no unescaping is done
+std::optional<std::string_view> query_param(std::string_view query, std::string_view key)
+{
+	while (query.size()) {
+		auto sep = query.find('&');
+		auto kv = query.substr(0, sep);
+		query = sep == query.npos ? std::string_view() : query.substr(sep + 1);
+		auto eq = kv.find('=');
+		if (kv.substr(0, eq) == key)
+			return eq == kv.npos ? std::string_view() : kv.substr(eq + 1);
+	}
+	return std::nullopt;
+}
+
+/**
+ * Select permessage-deflate offer from Sec-WebSocket-Extensions header that can be served by
+ * Deflate stream with 15 bit window. Offers that limit server window with server_max_window_bits
+ * are refused: stream produced with larger window can not be decoded by such client. Empty result
+ * means that compression is not negotiated for the session.
+ */
+std::string_view deflate_offer(std::string_view extensions)
+{
+	constexpr std::string_view name = "permessage-deflate";
+	constexpr std::string_view window = "server_max_window_bits";
+	while (extensions.size()) {
+		auto sep = extensions.find(',');
+		auto offer = extensions.substr(0, sep);
+		extensions = sep == extensions.npos ? std::string_view() : extensions.substr(sep + 1);
+		while (offer.size() && offer.front() == ' ')
+			offer.remove_prefix(1);
+		if (offer.substr(0, name.size()) != name)
+			continue;
+		auto pos = offer.find(window);
+		if (pos == offer.npos)
+			return offer;
+		auto value = offer.substr(pos + window.size());
+		while (value.size() && (value.front() == ' ' || value.front() == '=' || value.front() == '"'))
+			value.remove_prefix(1);
+		if (value.substr(0, 2) == "15")
+			return offer;
+	}
+	return {};
+}
+
+constexpr unsigned method_bit(Method m) { return 1u << (unsigned) m; }
+
+/// Parse comma separated list of methods into bitmask
+std::optional<unsigned> method_mask(std::string_view list)
+{
+	static const std::map<std::string_view, Method> names = {
+		{"GET", Method::GET}, {"HEAD", Method::HEAD}, {"POST", Method::POST}, {"PUT", Method::PUT},
+		{"DELETE", Method::DELETE}, {"CONNECT", Method::CONNECT}, {"OPTIONS", Method::OPTIONS},
+		{"TRACE", Method::TRACE}, {"PATCH", Method::PATCH},
+	};
+
+	unsigned r = 0;
+	while (list.size()) {
+		auto sep = list.find(',');
+		auto m = list.substr(0, sep);
+		list = sep == list.npos ? std::string_view() : list.substr(sep + 1);
+		auto it = names.find(m);
+		if (it == names.end())
+			return std::nullopt;
+		r |= method_bit(it->second);
+	}
+	return r;
+}
+
+/// Aggregate request body into one buffer for recv=whole nodes
+struct BodyCollector
+{
+	enum Result { More, Done, Overflow };
+
+	std::string body;
+	size_t limit = 0;
+	bool rejected = false;
+
+	BodyCollector(size_t limit, size_t reserve) : limit(limit) { body.reserve(reserve); }
+
+	Result append(std::string_view data, bool last)
+	{
+		if (rejected)
+			return More;
+		if (body.size() + data.size() > limit) {
+			rejected = true;
+			return Overflow;
+		}
+		body.append(data);
+		return last ? Done : More;
+	}
+};
+
+/// Parse Content-Length header, missing or invalid header gives 0
+size_t content_length(uWS::HttpRequest * req)
+{
+	auto h = req->getHeader("content-length");
+	if (!h.size())
+		return 0;
+	auto r = conv::to_any<size_t>(h);
+	return r ? *r : 0;
+}
+
+constexpr size_t ws_frame_header_max = 10;
+
+/// Fill unmasked server websocket frame header, return header size
+size_t ws_frame_header(char * buf, uWS::OpCode op, size_t size, bool compressed)
+{
+	buf[0] = (char) (0x80 | (compressed ? 0x40 : 0) | op);
+	if (size < 126) {
+		buf[1] = (char) size;
+		return 2;
+	} else if (size <= 0xffff) {
+		buf[1] = 126;
+		buf[2] = (char) (size >> 8);
+		buf[3] = (char) size;
+		return 4;
+	}
+	buf[1] = 127;
+	for (auto i = 0u; i < 8; i++)
+		buf[2 + i] = (char) (size >> (56 - 8 * i));
+	return 10;
+}
+
+/// Permessage-deflate policy of websocket node
+enum class Compression { Off, Shared, Dedicated };
 
+/**
+ * Raw deflate stream producing permessage-deflate payload without context takeover: stream is reset
+ * before each message so result does not depend on previous messages and is valid for any client.
+ * Window is always 15 bits, offers that limit it are not accepted (see deflate_offer).
+ */
+class Deflate
+{
+	z_stream _z = {};
+	bool _init = false;
+	std::vector<char> _buf;
+
+ public:
+	Deflate() = default;
+	Deflate(const Deflate &) = delete;
+	~Deflate()
+	{
+		if (_init)
+			deflateEnd(&_z);
+	}
+
+	/// Compress message, return nullopt on error
+	std::optional<std::string_view> compress(std::string_view data)
+	{
+		if (!_init) {
+			if (deflateInit2(&_z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+				return std::nullopt;
+			_init = true;
+		} else if (deflateReset(&_z) != Z_OK)
+			return std::nullopt;
+
+		_buf.resize(deflateBound(&_z, data.size()) + 16);
+		_z.next_in = (Bytef *) data.data();
+		_z.avail_in = data.size();
+		size_t size = 0;
+		do {
+			_z.next_out = (Bytef *) _buf.data() + size;
+			_z.avail_out = _buf.size() - size;
+			auto r = deflate(&_z, Z_SYNC_FLUSH);
+			if (r != Z_OK && r != Z_BUF_ERROR)
+				return std::nullopt;
+			size = _buf.size() - _z.avail_out;
+			if (_z.avail_out) // Flush is complete only if there is space left in output buffer
+				break;
+			_buf.resize(2 * _buf.size());
+		} while (true);
+
+		if (_z.avail_in || size < 4)
+			return std::nullopt;
+		return std::string_view(_buf.data(), size - 4); // Strip 00 00 ff ff trailer of sync flush
+	}
+};
+}
+
+template <bool SSL> class WSServer;
+template <bool SSL> class WSHTTP;
+template <bool SSL> class WSWS;
+template <bool SSL> class WSPub;
+template <bool SSL> class WSStatic;
+template <bool SSL> class WSShard;
+
+template <bool SSL>
 struct User {
-	std::variant<WSWS *, WSPub *> channel;
+	std::variant<WSWS<SSL> *, WSPub<SSL> *> channel;
 	tll::util::DataRing<void>::iterator position; // For pub nodes
 	tll_addr_t addr;
+
+	bool deflate = false; // Client negotiated permessage-deflate extension
+	std::optional<uint64_t> resume; // Pub nodes: sequence number requested with ?seq=N
+
+	// Pub nodes: topic filter, filtered session receives only messages with listed topics
+	bool filtered = false;
+	std::set<std::string, std::less<>> topics;
+
+	// Pub nodes: slow consumer counters
+	bool lagging = false;
+	uint64_t dropped = 0;
+	uint64_t lag_events = 0;
+
+	// Pub nodes: websocket owning this data and PubIndex links
+	uWS::WebSocket<SSL, true, User> * ws = nullptr;
+	User * pub_prev = nullptr;
+	User * pub_next = nullptr;
+	uint64_t seq = 0;
+	bool pub_linked = false;
+	bool batch_inflight = false; // Batched io_uring send is collected or not completed yet
+	std::string batch_notice; // Service frames delayed until batched send is completed
+
+	bool write_full = false; // WS nodes: buffered amount is above high-water mark
 };
 
-using WebSocket = uWS::WebSocket<false, true, User>;
+template <bool SSL> using WebSocket = uWS::WebSocket<SSL, true, User<SSL>>;
+template <bool SSL> using node_ptr_t = std::variant<WSHTTP<SSL> *, WSWS<SSL> *, WSPub<SSL> *, WSStatic<SSL> *>;
+template <bool SSL> using NodeRouter = Router<node_ptr_t<SSL>>;
+using RouteParams = Router<std::monostate>::Params; // Same for all value types
+
+/// Event generated by shard thread and dispatched to nodes in channel thread
+template <bool SSL>
+struct ShardEvent
+{
+	node_ptr_t<SSL> node;
+	tll_msg_type_t type = TLL_MESSAGE_DATA;
+	int msgid = 0;
+	tll_addr_t addr = {};
+	Method method = Method::UNDEFINED;
+	std::string data; // Url for Connect, payload for data messages
+	std::vector<std::pair<std::string, std::string>> params; // Path parameters for Connect
+};
 
-class WSServer : public tll::channel::Base<WSServer>
+template <bool SSL>
+class WSServer : public tll::channel::Base<WSServer<SSL>>
 {
-	using node_ptr_t = std::variant<WSHTTP *, WSWS *, WSPub *>;
-	using NodeMap = std::map<std::string_view, node_ptr_t, std::less<>>;
-	NodeMap _nodes;
-	NodeMap _nodes_wildcard;
+	using App = uWS::TemplatedApp<SSL>;
 
-	static thread_local WSServer * _instance;
+	NodeRouter<SSL> _router;
+	std::unordered_set<node_ptr_t<SSL>> _nodes; // Registered nodes, checked for each shard event
 
-	std::unique_ptr<uWS::App> _app;
+	std::unique_ptr<App> _app;
 	us_listen_socket_t * _app_socket = nullptr;
 	uWS::Loop * _app_loop = nullptr;
+	bool _ws_dedicated = false; // Websocket route with dedicated compressor is registered
 
 	std::string _host;
 	unsigned short _port;
 	size_t _max_payload_size = 16 * 1024;
+	size_t _max_backpressure = 1024 * 1024;
+
+	unsigned _shards_count = 0;
+	std::vector<std::unique_ptr<WSShard<SSL>>> _shards;
+
+	/*
+	 * Socket readiness is always handled by uSockets epoll loop. With send-batch=io_uring publish
+	 * nodes submit broadcast sends to all subscribers with one io_uring_enter call. Completions are
+	 * reaped right after submit, late ones are reaped when ring descriptor is readable.
+	 */
+	enum class SendBatch { None, IOUring };
+	SendBatch _send_batch = SendBatch::None;
+	unsigned _uring_entries = 256;
+	URing _uring;
+	us_fd_poll_t * _uring_poll = nullptr;
+	bool _uring_polling = false;
+
+	int _event_fd = -1;
+	std::mutex _events_lock;
+	std::vector<ShardEvent<SSL>> _events;
+	std::vector<ShardEvent<SSL>> _events_process;
+	size_t _events_offset = 0; // First not dispatched event in _events_process
+
+	// Limits of work done in one _process call, zero means no limit
+	unsigned _budget_events = 0;
+	tll::duration _budget_time = {};
+
+	/*
+	 * In busy poll mode channel keeps Pending flag for busy-poll window after last event so
+	 * processor calls _process in a loop instead of waiting on the epoll descriptor.
+	 */
+	tll::duration _busy_poll = {};
+	unsigned _busy_poll_usec = 50;
+	std::chrono::steady_clock::time_point _spin_until = {};
+	std::chrono::steady_clock::time_point _process_last = {};
+	bool _spinning = false;
+
+	/*
+	 * TLS termination for uwss:// server. With kTLS plain server accepts connections on its own
+	 * listening socket and does handshake, then socket is adopted by uWS as is, kernel encrypts
+	 * and decrypts data. Otherwise SSL variant of server is used and uSockets SSL layer does all work.
+	 */
+	struct TLSSession
+	{
+		WSServer<SSL> * server = nullptr;
+		TLSConnection conn;
+		us_fd_poll_t * poll = nullptr;
+	};
+
+	bool _tls = false;
+	std::string _tls_cert;
+	std::string _tls_key;
+	bool _tls_tickets = true;
+	TLSContext _tls_ctx;
+	int _tls_fd = -1;
+	us_fd_poll_t * _tls_poll = nullptr;
+	std::set<TLSSession *> _tls_sessions;
 
  public:
 	uWS::OpCode default_op_code = uWS::OpCode::BINARY;
 
-	static constexpr std::string_view channel_protocol() { return "uws"; }
+	struct StatType : public tll::channel::Base<WSServer>::StatType
+	{
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Ns, 's', 'p', 'i', 'n'> spin;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Ns, 's', 'l', 'e', 'e', 'p'> sleep;
+	};
+
+	tll::stat::BlockT<StatType> * stat() { return static_cast<tll::stat::BlockT<StatType> *>(this->internal.stat); }
+
+	static constexpr std::string_view channel_protocol() { return SSL ? "uwss" : "uws"; }
+
+	size_t max_backpressure() const { return _max_backpressure; }
+
+	/// Ring for batched sends, nullptr if send-batch=io_uring is not enabled
+	URing * uring() { return _uring.fd() == -1 ? nullptr : &_uring; }
+
+	/// Submit queued io_uring requests and dispatch completions that are already available
+	void uring_submit();
 
+	/// Wait for all submitted io_uring requests
+	void uring_drain();
+
+	/// Event loop of the server, nullptr if server is not open or is sharded
+	us_loop_t * loop() { return (us_loop_t *) _app_loop; }
+
+	std::optional<const tll_channel_impl_t *> _init_replace(const tll::Channel::Url &url, tll::Channel *master);
 	int _init(const tll::Channel::Url &, tll::Channel *master);
 	int _open(const tll::ConstConfig &);
 	int _close();
 	void _free()
 	{
-		if (_instance == this)
-			_instance = nullptr;
+		if (uws_loop_owner == this)
+			uws_loop_owner = nullptr;
 	}
 
 	int _process(long timeout, int flags);
 
+	unsigned short port() const { return _port; }
+	/// Host to listen on, empty for any address
+	std::string_view host() const { return _host == "*" ? std::string_view() : _host; }
+
+	/// Server is running worker loops in separate threads
+	bool sharded() const { return _shards_count > 0; }
+
+	/// Queue event from shard thread, can be called from any thread
+	void shard_event(ShardEvent<SSL> &&ev);
+	/// Route message to the shard that owns the session, fail with ENOENT if session is closed or belongs to other node
+	int shard_post(const tll_msg_t *msg, const node_ptr_t<SSL> &node);
+
+	template <typename H>
+	void app_setup(App &app, H * handler);
+	/// Register websocket route with compressor for given node compression
+	template <typename H>
+	void app_ws(App &app, H * handler, Compression route);
+
+	/// Node sessions are served by websocket route with dedicated compressor
+	static bool ws_dedicated(const node_ptr_t<SSL> &node)
+	{
+		return std::visit([](auto n) {
+			if constexpr (std::is_same_v<decltype(n), WSWS<SSL> *> || std::is_same_v<decltype(n), WSPub<SSL> *>)
+				return n->compression() == Compression::Dedicated;
+			return false;
+		}, node);
+	}
+
 	template <typename T>
 	int node_add(std::string_view prefix, T * ptr)
 	{
-		if (ptr->wildcard)
-			return node_add(_nodes_wildcard, prefix, ptr);
-		return node_add(_nodes, prefix, ptr);
+		if (auto r = _router.add(prefix, ptr->wildcard, ptr->methods, ptr); r)
+			return r;
+		_nodes.insert(ptr);
+		this->_log.info("Add new {} node {} at {}{}", T::channel_protocol(), ptr->name, prefix, ptr->wildcard ? "*" : "");
+		if (_app && !_ws_dedicated && ws_dedicated(ptr)) {
+			_ws_dedicated = true;
+			app_ws(*_app, this, Compression::Dedicated);
+		}
+		_shards_node_update(prefix, ptr, true);
+		return 0;
 	}
 
 	template <typename T>
 	int node_remove(std::string_view prefix, T * ptr)
 	{
-		if (ptr->wildcard)
-			return node_remove(_nodes_wildcard, prefix, ptr);
-		return node_remove(_nodes, prefix, ptr);
+		if (auto r = _router.remove(prefix, ptr->wildcard, ptr); r)
+			return r;
+		_nodes.erase(ptr);
+		_shards_node_update(prefix, ptr, false);
+		return 0;
 	}
 
-	node_ptr_t * node_lookup(std::string_view uri)
+	const node_ptr_t<SSL> * node_lookup(std::string_view uri, Method method, RouteParams * params = nullptr) const
 	{
-		auto it = _nodes.find(uri);
-		if (it != _nodes.end())
-			return &it->second;
-		it = _nodes_wildcard.upper_bound(uri);
-		if (it == _nodes_wildcard.begin())
-			return nullptr;
-		--it;
-		if (uri.substr(0, it->first.size()) == it->first)
-			return &it->second;
-		return nullptr;
+		return _router.lookup(uri, method_bit(method), params);
 	}
 
-	template <typename T>
-	int node_add(NodeMap &nodes, std::string_view prefix, T * ptr)
+	bool node_valid(const node_ptr_t<SSL> &node) const { return _nodes.find(node) != _nodes.end(); }
+
+	const std::list<typename NodeRouter<SSL>::Route> & routes() const { return _router.routes(); }
+
+	template <Method M>
+	void _http(uWS::HttpResponse<SSL> * resp, uWS::HttpRequest *req);
+	void _ws_upgrade(uWS::HttpResponse<SSL> * resp, uWS::HttpRequest *req, us_socket_context_t *context, Compression route);
+	void _ws_open(WebSocket<SSL> *);
+	void _ws_message(WebSocket<SSL> *, std::string_view, uWS::OpCode);
+	void _ws_drain(WebSocket<SSL> *);
+	void _ws_close(WebSocket<SSL> *, int code, std::string_view message);
+
+ private:
+	void _shards_node_update(std::string_view prefix, node_ptr_t<SSL> node, bool add);
+	bool _budget_exhausted(unsigned count, std::chrono::steady_clock::time_point start) const
 	{
-		auto it = nodes.find(prefix);
-		if (it != nodes.end())
-			return EEXIST;
-		_log.info("Add new {} node {} at {}", T::channel_protocol(), ptr->name, prefix);
-		nodes.emplace(prefix, ptr);
-		return 0;
+		if (_budget_events && count >= _budget_events)
+			return true;
+		return _budget_time.count() && std::chrono::steady_clock::now() - start >= _budget_time;
 	}
 
-	template <typename T>
-	int node_remove(NodeMap &nodes, std::string_view prefix, T * ptr)
+	void _busy_poll_setup();
+	int _process_busy();
+
+	void _uring_reap();
+
+	// Own TLS listener is used only for kTLS handshakes
+	bool _tls_own() const { return _tls && !SSL; }
+
+	int _tls_open();
+	void _tls_close();
+	void _tls_accept();
+	void _tls_event(TLSSession *);
+	void _tls_update(TLSSession *);
+	void _tls_free(TLSSession *);
+
+	void _update_pending(bool pending)
 	{
-		auto it = nodes.find(prefix);
-		if (it == nodes.end())
-			return ENOENT;
-		if (!std::holds_alternative<T *>(it->second))
-			return EINVAL;
-		if (std::get<T *>(it->second) != ptr)
-			return EINVAL;
-		nodes.erase(it);
-		return 0;
+		if (pending != (bool) (this->internal.dcaps & dcaps::Pending))
+			this->_update_dcaps(pending ? dcaps::Pending : 0, dcaps::Pending);
 	}
+	void _shards_stop();
+	void _shard_dispatch(ShardEvent<SSL> &ev);
+};
 
- private:
+/**
+ * Worker loop of sharded server
+ *
+ * Each shard runs its own uWS loop in separate thread and listens on the same port (uSockets sets
+ * SO_REUSEPORT on listening sockets so kernel balances incoming connections). Shard keeps mirrored
+ * copy of node registrations and its own session table, all TLL messages are passed to channel
+ * thread through WSServer event queue and back through Loop::defer.
+ *
+ * Session address is composed of shard index (high 8 bits) and SlotTable address.
+ */
+template <bool SSL>
+class WSShard
+{
+	using App = uWS::TemplatedApp<SSL>;
+	using HttpResponse = uWS::HttpResponse<SSL>;
+
+	WSServer<SSL> * _server = nullptr;
+	unsigned _index = 0;
+	tll::Logger _log;
+
+	std::thread _thread;
+	uWS::Loop * _loop = nullptr;
+	std::unique_ptr<App> _app;
+	us_listen_socket_t * _app_socket = nullptr;
+	bool _ws_dedicated = false; // Websocket route with dedicated compressor is registered
+	bool _stop = false;
+
+	NodeRouter<SSL> _router;
+
+	struct Session
+	{
+		std::variant<std::monostate, HttpResponse *, WebSocket<SSL> *> resp;
+		node_ptr_t<SSL> node;
+	};
+
+	SlotTable<Session> _slots;
+
+	/*
+	 * Open sessions as seen by channel thread, updated from Connect and Disconnect events and from
+	 * posts that finish the session. Indexed by slot, holds generation of the session (zero for
+	 * free slot) and its node, so stale address is rejected without waiting for the shard.
+	 */
+	struct Mirror
+	{
+		uint32_t generation = 0;
+		node_ptr_t<SSL> node;
+	};
+	std::vector<Mirror> _mirror;
+
+ public:
+	static constexpr unsigned shard_shift = 56;
+
+	WSShard(WSServer<SSL> * server, unsigned index)
+		: _server(server)
+		, _index(index)
+		, _log(fmt::format("tll.channel.{}.shard{}", server->name, index))
+	{
+		for (auto & r : server->routes())
+			_router.add(r.pattern, r.wildcard, r.methods, r.value);
+	}
+
+	~WSShard() { stop(); }
+
+	static unsigned shard_index(tll_addr_t addr) { return addr.u64 >> shard_shift; }
+
+	int start();
+	void stop();
+
+	/// Apply node registration change, called from channel thread
+	void node_update(std::string_view prefix, node_ptr_t<SSL> node, bool wildcard, unsigned methods, bool add);
+
+	/// Pass message to session, called from channel thread
+	void post(const tll_msg_t *msg);
+
+	/// Session mirror functions, called from channel thread
+	void session_open(tll_addr_t addr, const node_ptr_t<SSL> &node)
+	{
+		auto idx = (uint32_t) addr.u64;
+		if (idx >= _mirror.size())
+			_mirror.resize(idx + 1);
+		_mirror[idx] = { _generation(addr), node };
+	}
+
+	void session_close(tll_addr_t addr)
+	{
+		auto idx = (uint32_t) addr.u64;
+		if (idx < _mirror.size() && _mirror[idx].generation == _generation(addr))
+			_mirror[idx] = {};
+	}
+
+	bool session_valid(tll_addr_t addr, const node_ptr_t<SSL> &node) const
+	{
+		auto idx = (uint32_t) addr.u64;
+		return idx < _mirror.size() && _mirror[idx].generation == _generation(addr) && _mirror[idx].node == node;
+	}
 
 	template <Method M>
-	void _http(uWS::HttpResponse<false> * resp, uWS::HttpRequest *req);
-	void _ws_upgrade(uWS::HttpResponse<false> * resp, uWS::HttpRequest *req, us_socket_context_t *context);
-	void _ws_open(WebSocket *);
-	void _ws_message(WebSocket *, std::string_view, uWS::OpCode);
-	void _ws_drain(WebSocket *);
-	void _ws_close(WebSocket *, int code, std::string_view message);
-};
+	void _http(HttpResponse * resp, uWS::HttpRequest *req);
+	void _ws_upgrade(HttpResponse * resp, uWS::HttpRequest *req, us_socket_context_t *context, Compression route);
+	void _ws_open(WebSocket<SSL> *);
+	void _ws_message(WebSocket<SSL> *, std::string_view, uWS::OpCode);
+	void _ws_drain(WebSocket<SSL> *);
+	void _ws_close(WebSocket<SSL> *, int code, std::string_view message);
+
+ private:
+	void _run(std::promise<int> &ready);
+	void _post(const tll::util::OwnedMessage &msg);
+
+	template <typename R>
+	tll_addr_t _slot_alloc(R * resp, node_ptr_t<SSL> node)
+	{
+		return { ((uint64_t) _index << shard_shift) | _slots.insert({ resp, node }) };
+	}
 
-thread_local WSServer * WSServer::_instance = nullptr;
+	static uint32_t _generation(tll_addr_t addr)
+	{
+		return (addr.u64 >> SlotTable<Session>::generation_shift) & SlotTable<Session>::generation_mask;
+	}
+
+	Session * _slot_lookup(tll_addr_t addr) { return _slots.lookup(addr.u64); }
+	bool _slot_free(tll_addr_t addr) { return _slots.erase(addr.u64); }
+
+	void _emit(const node_ptr_t<SSL> &node, tll_msg_type_t type, int msgid, tll_addr_t addr, std::string_view data = "", Method method = Method::UNDEFINED, const RouteParams &params = {})
+	{
+		ShardEvent<SSL> ev = { node, type, msgid, addr, method, std::string(data) };
+		for (auto & [k, v] : params)
+			ev.params.emplace_back(k, v);
+		_server->shard_event(std::move(ev));
+	}
+};
 
-template <typename T, typename R = uWS::HttpResponse<false>>
-class WSNode : public tll::channel::Base<T>
+template <template <bool> class Node, bool SSL, typename R = uWS::HttpResponse<SSL>>
+class WSNode : public tll::channel::Base<Node<SSL>>
 {
  protected:
-	WSServer * _master = nullptr;
+	using T = Node<SSL>;
 	using Base = tll::channel::Base<T>;
+	WSServer<SSL> * _master = nullptr;
 
 	std::string _prefix;
 	uWS::OpCode _op_code;
 
-	std::map<uint64_t, R *> _sessions;
-	tll_addr_t _addr;
+	/// Session slot, connect time is filled only by nodes that measure response latency
+	struct Session
+	{
+		R * resp = nullptr;
+		std::chrono::steady_clock::time_point connected = {};
+	};
+
+	SlotTable<Session> _sessions;
+
+	Compression _compression = Compression::Off;
+	size_t _compress_min = 0;
+	Deflate _deflate; // Stream without context takeover shared by all sessions
 
  public:
 	static constexpr std::string_view param_prefix() { return "uws"; }
 	static constexpr auto process_policy() { return Base::ProcessPolicy::Never; }
 
+	struct StatType : public Base::StatType
+	{
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'c', 'o', 'n', 'n'> connect;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'd', 'i', 's', 'c'> disconnect;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'b', 'p'> backpressure;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Bytes, 'z', 'i', 'n'> zin;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Bytes, 'z', 'o', 'u', 't'> zout;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Ns, 'z', 't', 'i', 'm', 'e'> ztime;
+	};
+
+	tll::stat::BlockT<StatType> * stat() { return static_cast<tll::stat::BlockT<StatType> *>(this->internal.stat); }
+
 	bool wildcard = false;
+	unsigned methods = NodeRouter<SSL>::method_any;
+
+	Compression compression() const { return _compression; }
+	size_t compress_min() const { return _compress_min; }
+
+	std::optional<const tll_channel_impl_t *> _init_replace(const tll::Channel::Url &, tll::Channel *master)
+	{
+		// Nodes of userspace TLS server use SSL variant of uWS types
+		if (!SSL && master && channel_cast<WSServer<true>>(master))
+			return &Node<true>::impl;
+		return nullptr;
+	}
 
 	int _init(const tll::Channel::Url &, tll::Channel *master);
 	int _open(const tll::ConstConfig &);
@@ -176,317 +797,2472 @@ class WSNode : public tll::channel::Base<T>
 
 	int _post(const tll_msg_t *msg, int flags)
 	{
-		auto it = _sessions.find(msg->addr.u64);
-		if (it == _sessions.end())
+		if (_master->sharded())
+			return _post_shard(msg);
+
+		auto session = _sessions.lookup(msg->addr.u64);
+		if (!session)
 			return this->_log.fail(ENOENT, "Failed to post: session 0x{:x} not found", msg->addr.u64);
+		return static_cast<T *>(this)->_post_session(*session, msg, flags);
+	}
 
+	/// Post message to found session, slot may be freed when it returns
+	int _post_session(Session &session, const tll_msg_t *msg, int flags)
+	{
 		if (msg->type == TLL_MESSAGE_DATA)
-			return static_cast<T *>(this)->_post_data(it->second, msg, flags);
+			return static_cast<T *>(this)->_post_data(session.resp, msg, flags);
 		else if (msg->type == TLL_MESSAGE_CONTROL)
-			return static_cast<T *>(this)->_post_control(it->second, msg, flags);
+			return static_cast<T *>(this)->_post_control(session.resp, msg, flags);
 		return 0;
 	}
 
-	int _connected(R * resp, std::string_view url, tll_addr_t * addr, Method method = Method::UNDEFINED);
+	/// Add new session, extra arguments are passed to _session_init hook of derived node
+	template <typename... Args>
+	int _connected(R * resp, std::string_view url, tll_addr_t * addr, Method method = Method::UNDEFINED, const RouteParams * params = nullptr, Args && ... args);
 	int _disconnected(R * resp, tll_addr_t addr);
 
+	/// Emit Connect message for session with already assigned address
+	int _callback_connect(tll_addr_t addr, std::string_view url, Method method, const RouteParams * params = nullptr);
+
+	/// Emit control message without body
+	void _callback_control(int msgid, tll_addr_t addr)
+	{
+		if (msgid == http_scheme::WriteFull::meta_id())
+			_stat_session(0, 0, 1);
+
+		tll_msg_t msg = {};
+		msg.type = TLL_MESSAGE_CONTROL;
+		msg.msgid = msgid;
+		msg.addr = addr;
+		this->_callback(&msg);
+	}
+
+	/// Hooks for per-session state of derived nodes, called when session is added or removed
+	template <typename... Args>
+	void _session_init(tll_addr_t addr, Args && ...) {}
+	void _session_free(tll_addr_t addr) {}
+
+	/// Hook called before Connect message is emitted for new session, both local and sharded
+	void _stat_connect(tll_addr_t addr) {}
+
  protected:
-	tll_addr_t _next_addr()
+	/// Count session events: new sessions, closed sessions and backpressure on write
+	void _stat_session(unsigned connect, unsigned disconnect, unsigned backpressure)
+	{
+		auto s = stat();
+		if (!s)
+			return;
+		auto page = s->acquire();
+		if (!page)
+			return;
+		page->connect.update(connect);
+		page->disconnect.update(disconnect);
+		page->backpressure.update(backpressure);
+		s->release(page);
+	}
+
+	/// Parse compress and compress-min parameters
+	template <typename Reader>
+	void _compression_init(Reader &reader, Compression def)
+	{
+		_compression = reader.getT("compress", def, {
+			{"off", Compression::Off}, {"no", Compression::Off}, {"false", Compression::Off},
+			{"shared", Compression::Shared}, {"yes", Compression::Shared}, {"true", Compression::Shared},
+			{"dedicated", Compression::Dedicated}});
+		_compress_min = reader.template getT<tll::util::Size>("compress-min", 256);
+	}
+
+	/// Compress message, sizes and CPU time are reported to stat block if it is enabled
+	std::optional<std::string_view> _compress(Deflate &deflate, std::string_view data)
+	{
+		auto s = stat();
+		if (!s)
+			return deflate.compress(data);
+
+		timespec start, end;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+		auto r = deflate.compress(data);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+		auto page = s->acquire();
+		if (page) {
+			page->zin.update(data.size());
+			page->zout.update(r ? r->size() : data.size());
+			page->ztime.update((end.tv_sec - start.tv_sec) * 1000000000ll + end.tv_nsec - start.tv_nsec);
+			s->release(page);
+		}
+		return r;
+	}
+
+	/**
+	 * Send websocket message, compress it when session negotiated permessage-deflate and message is
+	 * not smaller then compress-min. Dedicated streams with context takeover are owned by uWS
+	 * sockets of dedicated websocket route. Shared compressed frame is written directly into the
+	 * socket so uWS DROPPED status is emulated by checking max-backpressure before compression.
+	 */
+	typename WebSocket<SSL>::SendStatus _ws_send(WebSocket<SSL> * ws, User<SSL> * user, std::string_view data)
+	{
+		if (!user->deflate || _compression == Compression::Off || data.size() < _compress_min)
+			return ws->send(data, _op_code);
+		if (_compression == Compression::Dedicated) // Not accounted in stat
+			return ws->send(data, _op_code, true);
+		if (ws->getBufferedAmount() > _master->max_backpressure())
+			return WebSocket<SSL>::SendStatus::DROPPED;
+
+		auto z = _compress(_deflate, data);
+		if (!z) {
+			this->_log.warning("Failed to deflate message of size {}, send it uncompressed", data.size());
+			return ws->send(data, _op_code);
+		}
+		if (z->size() >= data.size())
+			return ws->send(data, _op_code);
+
+		std::array<char, ws_frame_header_max> header;
+		auto hsize = ws_frame_header(header.data(), _op_code, z->size(), true);
+		bool full = false;
+		ws->cork([ws, &header, hsize, &z, &full]() {
+			auto socket = RawSocket<SSL>::cast(ws);
+			socket->write(header.data(), hsize);
+			full = socket->write(z->data(), z->size()).second;
+		});
+		return full ? WebSocket<SSL>::SendStatus::BACKPRESSURE : WebSocket<SSL>::SendStatus::SUCCESS;
+	}
+
+	int _post_shard(const tll_msg_t *msg)
 	{
-		return { ++_addr.u64 }; // TODO: Check for duplicates
+		if (auto r = _master->shard_post(msg, static_cast<T *>(this)); r)
+			return r;
+		if (msg->type == TLL_MESSAGE_CONTROL && msg->msgid == http_scheme::Disconnect::meta_id())
+			_disconnected(nullptr, msg->addr);
+		return 0;
 	}
 };
 
-class WSHTTP : public WSNode<WSHTTP>
+template <bool SSL>
+class WSHTTP : public WSNode<WSHTTP, SSL>
 {
+	/*
+	 * In stream mode Connect posted by user opens chunked response, each data message is written
+	 * as separate chunk and empty data message or Disconnect finishes it.
+	 */
+	bool _stream = false;
+
+	struct Stream
+	{
+		bool full = false; // Write is blocked until socket is drained
+	};
+	std::map<uint64_t, Stream> _streams;
+
+	bool _recv_whole = false; // Emit request body as one message
+	size_t _body_limit = 1024 * 1024;
+
+	/*
+	 * Cache of GET responses, key is full url and values of selected request headers. Hit is
+	 * answered in the server without emitting any messages. On miss key is attached to the new
+	 * session and complete response posted by application is stored in the cache.
+	 */
+	struct CachePending
+	{
+		std::string key;
+		std::string status = std::string(uWS::HTTP_200_OK);
+		std::vector<std::pair<std::string, std::string>> headers;
+		bool cacheable = true;
+	};
+
+	ResponseCache _cache;
+	tll::duration _cache_ttl = {};
+	size_t _cache_size = 16 * 1024 * 1024;
+	std::vector<std::string> _cache_headers;
+	std::map<uint64_t, CachePending> _cache_pending;
+
  public:
+	using Response = uWS::HttpResponse<SSL>;
+	using Parent = WSNode<WSHTTP, SSL>;
+
 	static constexpr std::string_view channel_protocol() { return "uws+http"; }
 
-	int _post_control(uWS::HttpResponse<false> * resp, const tll_msg_t *msg, int flags)
+	struct StatType : public Parent::StatType
 	{
-		switch (msg->msgid) {
-		case http_scheme::Connect::meta_id():
-			return _post_connect(resp, msg);
-		case http_scheme::Disconnect::meta_id():
-			resp->end();
-			_disconnected(nullptr, msg->addr);
-			break;
-		default:
-			_log.warning("Unsupported control message {}", msg->msgid);
-			break;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'h', 'i', 't'> hit;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'm', 'i', 's', 's'> miss;
+		tll::stat::Integer<tll::stat::Sum, tll::stat::Unknown, 'e', 'v', 'i', 'c', 't'> evict;
+		LatencyStat latency; // From Connect message to complete response
+	};
+
+	tll::stat::BlockT<StatType> * stat() { return static_cast<tll::stat::BlockT<StatType> *>(this->internal.stat); }
+
+	bool recv_whole() const { return _recv_whole; }
+	size_t body_limit() const { return _body_limit; }
+
+	int _init(const tll::Channel::Url &url, tll::Channel *master)
+	{
+		if (auto r = Parent::_init(url, master); r)
+			return r;
+
+		auto reader = this->channel_props_reader(url);
+		_stream = reader.getT("stream", false);
+		_recv_whole = reader.getT("recv", false, {{"chunk", false}, {"whole", true}});
+		_body_limit = reader.template getT<tll::util::Size>("body-limit", _body_limit);
+		_cache_ttl = reader.getT("cache-ttl", _cache_ttl);
+		_cache_size = reader.template getT<tll::util::Size>("cache-size", _cache_size);
+		auto headers = reader.template getT<std::string>("cache-headers", "");
+		if (!reader)
+			return this->_log.fail(EINVAL, "Invalid url: {}", reader.error());
+
+		// Header names are lowercase in uWS
+		_cache_headers.clear();
+		for (std::string_view list = headers; list.size(); ) {
+			auto sep = list.find(',');
+			std::string name(list.substr(0, sep));
+			list = sep == list.npos ? std::string_view() : list.substr(sep + 1);
+			for (auto & c : name)
+				c = tolower(c);
+			if (name.size())
+				_cache_headers.push_back(name);
 		}
 		return 0;
 	}
 
-	int _post_connect(uWS::HttpResponse<false> * resp, const tll_msg_t *msg)
+	int _open(const tll::ConstConfig &url)
 	{
-		auto data = http_scheme::Connect::bind(*msg);
-		if (msg->size < data.meta_size())
-			return _log.fail(EMSGSIZE, "Connect size too small: {} < minimum {}", msg->size, data.meta_size());
-		if (auto status = http_status_string(data.get_code() != 0 ? data.get_code() : 200); status != "")
-			resp->writeStatus(status);
-		else
-			return _log.fail(EINVAL, "Undefined HTTP status code: {}", data.get_code());
+		if (_stream && this->_master->sharded())
+			return this->_log.fail(EINVAL, "Streaming responses are not supported by sharded server");
+		if (_cache_ttl.count() && this->_master->sharded())
+			return this->_log.fail(EINVAL, "Response cache is not supported by sharded server");
+		_streams.clear();
+		_cache.init(_cache_size, _cache_ttl);
+		_cache_pending.clear();
+		return Parent::_open(url);
+	}
+
+	int _close()
+	{
+		auto r = Parent::_close();
+		_streams.clear();
+		_cache.clear();
+		_cache_pending.clear();
+		return r;
+	}
+
+	int _post_session(typename Parent::Session &session, const tll_msg_t *msg, int flags)
+	{
+		auto start = session.connected; // Slot is freed when response is complete
+		if (start == decltype(start)() || !_response_complete(msg))
+			return Parent::_post_session(session, msg, flags);
+
+		if (auto r = Parent::_post_session(session, msg, flags); r)
+			return r;
+
+		auto s = stat();
+		if (!s)
+			return 0;
+		auto page = s->acquire();
+		if (page) {
+			page->latency.update(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			s->release(page);
+		}
+		return 0;
+	}
+
+	/// Check if message finishes response: data outside of stream, end of stream or Disconnect
+	bool _response_complete(const tll_msg_t *msg) const
+	{
+		if (msg->type == TLL_MESSAGE_DATA)
+			return msg->size == 0 || !_stream || _streams.find(msg->addr.u64) == _streams.end();
+		return msg->type == TLL_MESSAGE_CONTROL && msg->msgid == http_scheme::Disconnect::meta_id();
+	}
+
+	void _stat_connect(tll_addr_t addr)
+	{
+		if (!stat())
+			return;
+		if (auto session = this->_sessions.lookup(addr.u64); session) // Not found for sharded sessions
+			session->connected = std::chrono::steady_clock::now();
+	}
+
+	/// Answer GET request from cache, on miss key is filled and should be passed to _connected
+	bool cache_serve(Response * resp, uWS::HttpRequest * req, std::string &key)
+	{
+		if (!_cache_ttl.count())
+			return false;
+
+		key = req->getFullUrl();
+		for (auto & h : _cache_headers) {
+			key += '\n';
+			key += req->getHeader(h);
+		}
+
+		auto entry = _cache.lookup(key, ResponseCache::clock::now());
+		_cache_stat(entry != nullptr, entry == nullptr, 0);
+		if (!entry)
+			return false;
+
+		resp->writeStatus(entry->status);
+		for (auto & [k, v] : entry->headers)
+			resp->writeHeader(k, v);
+		resp->end(entry->body);
+		return true;
+	}
+
+	void _session_init(tll_addr_t addr, std::string cache_key = {})
+	{
+		if (cache_key.size())
+			_cache_pending[addr.u64].key = std::move(cache_key);
+	}
+
+	int _post_data(Response * resp, const tll_msg_t *msg, int flags)
+	{
+		auto it = _streams.find(msg->addr.u64);
+		if (it == _streams.end()) {
+			_cache_store(msg);
+			return Parent::_post_data(resp, msg, flags);
+		}
+
+		if (msg->size == 0) {
+			this->_log.debug("Finish stream {}", msg->addr.u64);
+			_streams.erase(it);
+			this->_sessions.erase(msg->addr.u64);
+			resp->end();
+			return 0;
+		}
+
+		if (it->second.full)
+			return EAGAIN;
+
+		if (!resp->write(std::string_view((const char *) msg->data, msg->size))) {
+			this->_log.debug("Stream {} is full, wait for drain", msg->addr.u64);
+			it->second.full = true;
+			this->_callback_control(http_scheme::WriteFull::meta_id(), msg->addr);
+		}
+		return 0;
+	}
+
+	void _session_free(tll_addr_t addr)
+	{
+		_streams.erase(addr.u64);
+		_cache_pending.erase(addr.u64);
+	}
+
+	int _post_control(uWS::HttpResponse<SSL> * resp, const tll_msg_t *msg, int flags)
+	{
+		switch (msg->msgid) {
+		case http_scheme::Connect::meta_id():
+			return _post_connect(resp, msg);
+		case http_scheme::Disconnect::meta_id():
+			resp->end();
+			this->_disconnected(nullptr, msg->addr);
+			break;
+		default:
+			this->_log.warning("Unsupported control message {}", msg->msgid);
+			break;
+		}
+		return 0;
+	}
+
+	int _post_connect(uWS::HttpResponse<SSL> * resp, const tll_msg_t *msg)
+	{
+		if (auto r = post_connect(this->_log, resp, msg); r)
+			return r;
+		if (auto it = _cache_pending.find(msg->addr.u64); it != _cache_pending.end())
+			_cache_connect(it->second, msg);
+		if (!_stream || !resp)
+			return 0;
+
+		auto addr = msg->addr;
+		this->_log.debug("Open stream {}", addr.u64);
+		_streams.emplace(addr.u64, Stream {});
+		resp->onWritable([this, addr](uintmax_t) { return _writable(addr); });
+		return 0;
+	}
+
+	/// Remember status and headers of cacheable response, only 200 responses are cached
+	void _cache_connect(CachePending &pending, const tll_msg_t *msg)
+	{
+		auto data = http_scheme::Connect::bind(*msg);
+		auto code = data.get_code() != 0 ? data.get_code() : 200;
+		if (code != 200 || _stream) {
+			pending.cacheable = false;
+			return;
+		}
+		for (auto & h : data.get_headers())
+			pending.headers.emplace_back(h.get_header(), h.get_value());
+	}
+
+	/// Store complete response in cache if it was requested with cacheable GET
+	void _cache_store(const tll_msg_t *msg)
+	{
+		auto it = _cache_pending.find(msg->addr.u64);
+		if (it == _cache_pending.end())
+			return;
+		if (it->second.cacheable) {
+			ResponseCache::Entry entry = { std::move(it->second.status), std::move(it->second.headers) };
+			entry.body.assign((const char *) msg->data, msg->size);
+			_cache_stat(0, 0, _cache.insert(it->second.key, std::move(entry), ResponseCache::clock::now()));
+		}
+		_cache_pending.erase(it);
+	}
+
+	void _cache_stat(unsigned hit, unsigned miss, unsigned evict)
+	{
+		auto s = stat();
+		if (!s)
+			return;
+		auto page = s->acquire();
+		if (!page)
+			return;
+		page->hit.update(hit);
+		page->miss.update(miss);
+		page->evict.update(evict);
+		s->release(page);
+	}
+
+	/// Socket of streaming response is drained, notify user that it can post more data
+	bool _writable(tll_addr_t addr)
+	{
+		auto it = _streams.find(addr.u64);
+		if (it == _streams.end() || !it->second.full)
+			return true;
+		this->_log.debug("Stream {} is drained", addr.u64);
+		it->second.full = false;
+		this->_callback_control(http_scheme::WriteReady::meta_id(), addr);
+		return true;
+	}
+
+	/// Write status and headers from Connect message, resp may be nullptr to only validate message
+	static int post_connect(tll::Logger &log, uWS::HttpResponse<SSL> * resp, const tll_msg_t *msg)
+	{
+		auto data = http_scheme::Connect::bind(*msg);
+		if (msg->size < data.meta_size())
+			return log.fail(EMSGSIZE, "Connect size too small: {} < minimum {}", msg->size, data.meta_size());
+		auto status = http_status_string(data.get_code() != 0 ? data.get_code() : 200);
+		if (status == "")
+			return log.fail(EINVAL, "Undefined HTTP status code: {}", data.get_code());
+		if (!resp)
+			return 0;
+		resp->writeStatus(status);
 		for (auto & h : data.get_headers())
 			resp->writeHeader(h.get_header(), h.get_value());
 		return 0;
 	}
-};
+};
+
+template <bool SSL>
+class WSWS : public WSNode<WSWS, SSL, WebSocket<SSL>>
+{
+	size_t _high_water = 256 * 1024;
+	size_t _low_water = 64 * 1024;
+
+ public:
+	using Response = WebSocket<SSL>;
+	using Parent = WSNode<WSWS, SSL, Response>;
+
+	static constexpr std::string_view channel_protocol() { return "uws+ws"; }
+
+	size_t high_water() const { return _high_water; }
+	size_t low_water() const { return _low_water; }
+
+	int _init(const tll::Channel::Url &url, tll::Channel *master)
+	{
+		if (auto r = Parent::_init(url, master); r)
+			return r;
+
+		auto reader = this->channel_props_reader(url);
+		_high_water = reader.template getT<tll::util::Size>("high-water", _high_water);
+		_low_water = reader.template getT<tll::util::Size>("low-water", _low_water);
+		this->_compression_init(reader, Compression::Shared);
+		if (!reader)
+			return this->_log.fail(EINVAL, "Invalid url: {}", reader.error());
+
+		if (_low_water > _high_water)
+			return this->_log.fail(EINVAL, "Low-water mark {} is larger then high-water mark {}", _low_water, _high_water);
+		return 0;
+	}
+
+	int _open(const tll::ConstConfig &url)
+	{
+		if (_high_water >= this->_master->max_backpressure())
+			return this->_log.fail(EINVAL, "High-water mark {} must be less then master max-backpressure {}", _high_water, this->_master->max_backpressure());
+		return Parent::_open(url);
+	}
+
+	int _post_data(Response * resp, const tll_msg_t *msg, int flags)
+	{
+		auto user = resp->getUserData();
+		if (user->write_full)
+			return EAGAIN;
+		if (this->_ws_send(resp, user, std::string_view((const char *) msg->data, msg->size)) == Response::SendStatus::DROPPED) {
+			this->_stat_session(0, 0, 1);
+			return this->_log.fail(EAGAIN, "Message dropped, session 0x{:x} is over max-backpressure", msg->addr.u64);
+		}
+		if (resp->getBufferedAmount() >= _high_water) {
+			this->_log.debug("Session 0x{:x} buffer is above high-water mark", msg->addr.u64);
+			user->write_full = true;
+			this->_callback_control(http_scheme::WriteFull::meta_id(), msg->addr);
+		}
+		return 0;
+	}
+
+	/// Socket is drained, report WriteReady if buffer is below low-water mark
+	void writeable(Response * ws, User<SSL> * user)
+	{
+		if (!user->write_full || ws->getBufferedAmount() > _low_water)
+			return;
+		this->_log.debug("Session 0x{:x} buffer is below low-water mark", user->addr.u64);
+		user->write_full = false;
+		this->_callback_control(http_scheme::WriteReady::meta_id(), user->addr);
+	}
+
+	int _post_control(Response * resp, const tll_msg_t *msg, int flags)
+	{
+		if (msg->msgid != http_scheme::Disconnect::meta_id())
+			return 0;
+		resp->end();
+		this->_disconnected(nullptr, msg->addr);
+		return 0;
+	}
+};
+
+template <bool SSL>
+class WSPub : public WSNode<WSPub, SSL, WebSocket<SSL>>
+{
+	tll::util::DataRing<void> _ring;
+	PubIndex<User<SSL>> _index; // Subscribers by ring position, head is sequence number of _ring.begin()
+	std::deque<tll::util::DataRing<void>::iterator> _positions; // Ring position of each message in [head, tail)
+	size_t _send_budget = 64 * 1024;
+
+	/*
+	 * In broadcast mode ring entries hold prebuilt websocket frames: 4 byte size of plain frame,
+	 * plain frame and optional compressed frame. Frames are encoded once on post and written as is
+	 * into each subscriber socket.
+	 */
+	using Policy = http_scheme::SlowConsumer::Policy;
+	Policy _slow_policy = Policy::Close;
+
+	/// SlowConsumer report that is emitted after ring and subscriber index are updated
+	struct SlowEvent
+	{
+		tll_addr_t addr;
+		uint64_t dropped;
+		uint64_t dropped_total;
+		uint64_t events;
+		bool close; // Close session after report
+	};
+	std::vector<SlowEvent> _slow_events;
+
+	bool _seq_header = false; // Prepend 8 byte sequence number to each message
+	std::vector<char> _payload;
+
+	/*
+	 * With topics enabled ring entry is prefixed with 2 byte topic length and topic string.
+	 * Filtered sessions that have nothing to send are not kept in _index but in per-topic sets
+	 * and are woken only when message with matching topic is posted.
+	 */
+	enum class Topic { None, MsgId, Field };
+	Topic _topic_mode = Topic::None;
+	std::string _topic_field_name;
+	std::map<int, const tll::scheme::Field *> _topic_fields; // Topic field for each message id
+	std::map<std::string, std::set<User<SSL> *>, std::less<>> _topics;
+	std::string _topic_buf;
+	std::vector<char> _topic_entry;
+	std::vector<User<SSL> *> _topic_wakeup;
+
+	/*
+	 * With send-batch=io_uring sends to subscribers that have empty socket buffer are collected
+	 * while new message is posted and submitted as one batch of requests with buffers pointing
+	 * into the ring. Data not accepted by the kernel is passed to uSockets buffer when completion
+	 * is reaped. Session with request in flight is not sent anything else: service messages are
+	 * queued and written after remaining data, disconnect waits for completion. Ring entries of the
+	 * request are not evicted until it is completed.
+	 */
+	struct Batch
+	{
+		WSPub<SSL> * node = nullptr;
+		User<SSL> * user = nullptr; // Reset if session is closed while request is in flight
+		uint64_t seq = 0; // Sequence number of first message
+		std::vector<iovec> iov;
+		size_t size = 0;
+		msghdr msg = {};
+		bool inflight = false;
+	};
+	bool _batching = false;
+	std::deque<Batch> _batch_pool; // Stable addresses, pointer to entry is io_uring user_data
+	std::vector<Batch *> _batch_free;
+	std::vector<Batch *> _batch;
+	unsigned _batch_inflight = 0;
+
+	bool _broadcast = false;
+	std::vector<char> _frame;
+
+	// Gap notice is built while posted message still lives in _payload and _frame
+	std::vector<char> _notice_payload;
+	std::vector<char> _notice_frame;
+ public:
+	using Response = WebSocket<SSL>;
+	using Parent = WSNode<WSPub, SSL, Response>;
+
+	static constexpr std::string_view channel_protocol() { return "uws+pub"; }
+
+	int _init(const tll::Channel::Url &url, tll::Channel *master)
+	{
+		if (auto r = Parent::_init(url, master); r)
+			return r;
+
+		auto reader = this->channel_props_reader(url);
+
+		auto size = reader.template getT<size_t>("ring-size", 1024);
+		auto data = reader.template getT<tll::util::Size>("data-size", 1024 * 1024);
+		_send_budget = reader.template getT<tll::util::Size>("send-budget", _send_budget);
+		_broadcast = reader.getT("broadcast", false);
+		this->_compression_init(reader, Compression::Off);
+		_slow_policy = reader.getT("slow-consumer", Policy::Close, {{"close", Policy::Close}, {"skip", Policy::Skip}, {"pause", Policy::Pause}});
+		_seq_header = reader.getT("seq-header", false);
+		_topic_mode = reader.getT("topic", Topic::None, {{"none", Topic::None}, {"msgid", Topic::MsgId}, {"field", Topic::Field}});
+		_topic_field_name = reader.template getT<std::string>("topic-field", "");
+
+		if (!reader)
+			return this->_log.fail(EINVAL, "Invalid url: {}", reader.error());
+
+		if (_topic_mode == Topic::Field && _topic_field_name.empty())
+			return this->_log.fail(EINVAL, "Topic mode 'field' needs topic-field parameter");
+		if (this->_compression == Compression::Dedicated && _broadcast)
+			return this->_log.fail(EINVAL, "Dedicated compression is not supported in broadcast mode");
+
+		_ring.resize(size);
+		_ring.data_resize(data);
+		return 0;
+	}
+
+	int _open(const tll::ConstConfig &url)
+	{
+		if (this->_master->sharded())
+			return this->_log.fail(EINVAL, "Publish nodes are not supported by sharded server");
+		_ring.clear();
+		_index.reset();
+		_positions.clear();
+		_topics.clear();
+
+		if (_topic_mode == Topic::Field) {
+			if (!this->_scheme)
+				return this->_log.fail(EINVAL, "Topic mode 'field' needs data scheme");
+			_topic_fields.clear();
+			for (auto m = this->_scheme->messages; m; m = m->next) {
+				for (auto f = m->fields; f; f = f->next) {
+					if (f->name != _topic_field_name)
+						continue;
+					if (!_topic_field_supported(f))
+						return this->_log.fail(EINVAL, "Topic field {}.{} has unsupported type", m->name, f->name);
+					_topic_fields.emplace(m->msgid, f);
+				}
+			}
+			if (_topic_fields.empty())
+				return this->_log.fail(EINVAL, "No messages with topic field '{}' in scheme", _topic_field_name);
+		}
+		return Parent::_open(url);
+	}
+
+	int _close()
+	{
+		auto r = Parent::_close();
+		if (_batch_inflight)
+			this->_master->uring_drain();
+		_index.reset();
+		_positions.clear();
+		_topics.clear();
+		return r;
+	}
+
+	int _post_data(Response * resp, const tll_msg_t *msg, int flags)
+	{
+		// Callbacks may post or close the channel, they are not called while broadcast is in progress
+		auto r = _post_ring(msg);
+		_slow_flush();
+		return r;
+	}
+
+	int _post_ring(const tll_msg_t *msg)
+	{
+		auto topic = _topic(msg);
+		if (topic.size() > 0xffff)
+			return this->_log.fail(EINVAL, "Topic size {} is too large", topic.size());
+
+		auto data = std::string_view((const char *) msg->data, msg->size);
+		if (_seq_header)
+			data = _seq_wrap(_payload, _index.tail(), data);
+		if (_broadcast)
+			data = _encode(_frame, data);
+		if (_topic_mode != Topic::None)
+			data = _topic_wrap(topic, data);
+
+		if (data.size() > _ring.data_capacity() / 2)
+			return this->_log.fail(EINVAL, "Message size {} is larger then half of buffer: {}", data.size(), _ring.data_capacity());
+		auto position = _ring.end(); // Not changed by pop_front, points to new entry after push
+		do {
+			auto r = _ring.push_back(data.data(), data.size());
+			if (r != nullptr)
+				break;
+
+			if (_slow_policy == Policy::Pause && !_index.head_empty()) {
+				_index.head_for_each([this](User<SSL> * user) {
+					if (user->lagging)
+						return;
+					this->_log.info("Session {} is behind data, pause posting", user->addr.u64);
+					user->lagging = true;
+					_slow_consumer(user, 0);
+				});
+				return EAGAIN;
+			}
+
+			if (_batch_inflight && _batch_pinned()) {
+				this->_log.debug("Ring head is referenced by io_uring send in flight");
+				return EAGAIN;
+			}
+
+			_ring.pop_front();
+			_positions.pop_front();
+			_index.pop([this](User<SSL> * user) { _evict(user); });
+		} while (true);
+
+		auto seq = _index.tail();
+		_positions.push_back(position);
+		_batching = _broadcast && this->_master->uring();
+		_index.push([this](User<SSL> * user) { writeable(user->ws, user); });
+		if (_topic_mode != Topic::None)
+			_topic_wake(topic, position, seq);
+		_batching = false;
+		if (_batch.size())
+			_batch_flush();
+		return 0;
+	}
+
+	int _post_control(Response * resp, const tll_msg_t *msg, int flags)
+	{
+		if (msg->msgid != http_scheme::Disconnect::meta_id())
+			return 0;
+		if (resp->getUserData()->batch_inflight) // Close frame must follow batched data
+			this->_master->uring_drain();
+		resp->end();
+		this->_disconnected(nullptr, msg->addr);
+		return 0;
+	}
+
+	int _post(const tll_msg_t *msg, int flags)
+	{
+		if (msg->type == TLL_MESSAGE_DATA)
+			return _post_data(nullptr, msg, flags);
+		return Parent::_post(msg, flags);
+	}
+
+	/// Check that requested resume position is still in the ring
+	std::optional<std::string> resume_check(uint64_t seq) const
+	{
+		if (seq < _index.head())
+			return fmt::format("Sequence {} is evicted, first available is {}", seq, _index.head());
+		if (seq > _index.tail())
+			return fmt::format("Sequence {} is not published yet, next is {}", seq, _index.tail());
+		return std::nullopt;
+	}
+
+	int _connected(Response * ws, std::string_view url, tll_addr_t * addr)
+	{
+		auto user = ws->getUserData();
+		user->ws = ws;
+		if (user->resume && *user->resume < _index.tail()) {
+			// Checked on upgrade, ring is not changed since then
+			auto seq = *user->resume;
+			user->position = _positions[seq - _index.head()];
+			this->_log.info("Resume session from seq {}, {} messages behind", seq, _index.tail() - seq);
+			_index.insert(user, seq);
+		} else
+			_park(user);
+
+		auto r = Parent::_connected(ws, url, addr);
+		if (user->position != _ring.end())
+			writeable(ws, user);
+		return r;
+	}
+
+	/// Unlink closed session from subscriber index
+	void detach(User<SSL> * user)
+	{
+		_index.remove(user);
+		if (user->filtered)
+			_unpark(user);
+		if (user->batch_inflight) {
+			for (auto & b : _batch_pool) {
+				if (b.user == user)
+					b.user = nullptr;
+			}
+		}
+	}
+
+	/// Handle completion of batched send, user_data is pointer to Batch entry
+	static void batch_complete(uint64_t data, int result)
+	{
+		auto b = (Batch *) (uintptr_t) data;
+		b->node->_batch_done(b, result);
+	}
+
+	bool topics_enabled() const { return _topic_mode != Topic::None; }
+
+	/// Call f for each non-empty topic in comma separated list
+	template <typename F>
+	static void topics_split(std::string_view list, F f)
+	{
+		while (list.size()) {
+			auto sep = list.find(',');
+			auto t = list.substr(0, sep);
+			list = sep == list.npos ? std::string_view() : list.substr(sep + 1);
+			if (t.size())
+				f(t);
+		}
+	}
+
+	/// Handle in-band commands from subscriber: "subscribe A,B" and "unsubscribe A,B"
+	void message(User<SSL> * user, std::string_view message)
+	{
+		auto sep = message.find(' ');
+		auto cmd = message.substr(0, sep);
+		auto arg = sep == message.npos ? std::string_view() : message.substr(sep + 1);
+		if (cmd != "subscribe" && cmd != "unsubscribe") {
+			this->_log.debug("Unknown command from session {}: '{}'", user->addr.u64, cmd);
+			return;
+		}
+		if (!topics_enabled()) {
+			this->_log.info("Session {} requested {}, but topics are disabled", user->addr.u64, cmd);
+			return;
+		}
+		if (cmd == "subscribe")
+			subscribe(user, arg);
+		else
+			unsubscribe(user, arg);
+	}
+
+	void subscribe(User<SSL> * user, std::string_view list)
+	{
+		auto parked = user->filtered && !user->pub_linked;
+		if (!user->filtered) {
+			// Session that was waiting for any message now waits only for its topics
+			user->filtered = true;
+			if (user->position == _ring.end()) {
+				_index.remove(user);
+				parked = true;
+			}
+		}
+		topics_split(list, [this, user, parked](std::string_view t) {
+			this->_log.debug("Session {} subscribed to '{}'", user->addr.u64, t);
+			if (user->topics.emplace(t).second && parked)
+				_topics[std::string(t)].insert(user);
+		});
+	}
+
+	void unsubscribe(User<SSL> * user, std::string_view list)
+	{
+		auto parked = user->filtered && !user->pub_linked;
+		topics_split(list, [this, user, parked](std::string_view t) {
+			auto it = user->topics.find(t);
+			if (it == user->topics.end())
+				return;
+			this->_log.debug("Session {} unsubscribed from '{}'", user->addr.u64, t);
+			user->topics.erase(it);
+			if (parked)
+				_topic_remove(t, user);
+		});
+	}
+
+	/**
+	 * Send queued messages while they fit into send budget, at least one message is sent if there
+	 * is no pending data in socket buffer. All messages are sent in one cork block so they are
+	 * flushed with one syscall or, when batching, added to the io_uring batch.
+	 */
+	void writeable(Response * ws, User<SSL> * user)
+	{
+		if (user->batch_inflight)
+			return; // Resumed when request is completed
+		auto buffered = ws->getBufferedAmount();
+		if (buffered > 0 && buffered >= _send_budget)
+			return;
+		if (user->position == _ring.end())
+			return;
+
+		size_t size = buffered;
+		unsigned count = 0, sent = 0;
+		if (_batching && !buffered && !RawSocket<SSL>::cast(ws)->isCorked()) {
+			auto b = _batch_get(user);
+			_collect(user, size, count, sent, [b](std::string_view data) {
+				b->iov.push_back({ (void *) data.data(), data.size() });
+				return b->iov.size() < UIO_MAXIOV;
+			});
+			b->size = size;
+			if (sent) {
+				user->batch_inflight = true;
+				_batch.push_back(b);
+			} else
+				_batch_put(b);
+		} else {
+			ws->cork([this, ws, user, &size, &count, &sent]() {
+				_collect(user, size, count, sent, [this, ws, user](std::string_view data) { return _send(ws, user, data); });
+			});
+		}
+
+		this->_log.debug("Post {} messages to {}", sent, user->addr.u64);
+		if (user->filtered && user->position == _ring.end())
+			_park(user);
+		else
+			_index.move(user, user->seq + count);
+		user->lagging = false;
+	}
+
+ private:
+	/**
+	 * Pass entries starting from user position to send function while they fit into send budget,
+	 * stop when it returns false
+	 */
+	template <typename F>
+	void _collect(User<SSL> * user, size_t &size, unsigned &count, unsigned &sent, F send)
+	{
+		do {
+			if (user->filtered && !_topic_match(user, user->position)) {
+				user->position++;
+				count++;
+				continue;
+			}
+			auto data = _entry(user, user->position);
+			if (sent && size + data.size() > _send_budget)
+				break;
+			user->position++;
+			size += data.size();
+			count++;
+			sent++;
+			if (!send(data))
+				break;
+		} while (user->position != _ring.end());
+	}
+
+	Batch * _batch_get(User<SSL> * user)
+	{
+		Batch * b = nullptr;
+		if (_batch_free.size()) {
+			b = _batch_free.back();
+			_batch_free.pop_back();
+		} else
+			b = &_batch_pool.emplace_back();
+		b->node = this;
+		b->user = user;
+		b->seq = user->seq;
+		b->iov.clear();
+		b->size = 0;
+		return b;
+	}
+
+	void _batch_put(Batch * b)
+	{
+		b->user = nullptr;
+		_batch_free.push_back(b);
+	}
+
+	/// Queue request for batch entry, single buffer is sent with plain send
+	static bool _batch_queue(URing * uring, Batch * b)
+	{
+		auto fd = us_poll_fd((us_poll_t *) b->user->ws);
+		auto data = (uint64_t) (uintptr_t) b;
+		if (b->iov.size() == 1)
+			return uring->send(fd, b->iov[0].iov_base, b->iov[0].iov_len, data);
+		b->msg = {};
+		b->msg.msg_iov = b->iov.data();
+		b->msg.msg_iovlen = b->iov.size();
+		return uring->sendmsg(fd, &b->msg, data);
+	}
+
+	/// Submit collected sends without waiting, completions are handled by _batch_done
+	void _batch_flush()
+	{
+		auto uring = this->_master->uring();
+		for (auto b : _batch) {
+			if (!b->user) { // Closed while batch was collected
+				_batch_put(b);
+				continue;
+			}
+			b->inflight = true;
+			_batch_inflight++;
+			if (_batch_queue(uring, b))
+				continue;
+			this->_master->uring_submit(); // Queue is full
+			if (!_batch_queue(uring, b))
+				_batch_done(b, -EAGAIN);
+		}
+		_batch.clear();
+		this->_master->uring_submit();
+	}
+
+	/// Pass data that was not written by kernel to uSockets buffer and continue sending
+	void _batch_done(Batch * b, int result)
+	{
+		b->inflight = false;
+		_batch_inflight--;
+		auto user = b->user;
+		if (!user)
+			return _batch_put(b);
+		user->batch_inflight = false;
+
+		auto socket = RawSocket<SSL>::cast(user->ws);
+		if (result < 0 || (size_t) result != b->size) {
+			size_t skip = std::max(result, 0);
+			if (result < 0 && result != -EAGAIN)
+				this->_log.debug("Batched send to {} failed: {}", user->addr.u64, strerror(-result));
+			for (auto & iov : b->iov) {
+				if (skip >= iov.iov_len) {
+					skip -= iov.iov_len;
+					continue;
+				}
+				socket->write((const char *) iov.iov_base + skip, iov.iov_len - skip);
+				skip = 0;
+			}
+		}
+		if (user->batch_notice.size()) {
+			socket->write(user->batch_notice.data(), user->batch_notice.size());
+			user->batch_notice.clear();
+		}
+		_batch_put(b);
+		if (user->position != _ring.end())
+			writeable(user->ws, user);
+	}
+
+	/// Check if ring head is referenced by request in flight
+	bool _batch_pinned()
+	{
+		this->_master->uring_submit();
+		if (!_batch_inflight)
+			return false;
+		for (auto & b : _batch_pool) {
+			if (b.inflight && b.seq == _index.head())
+				return true;
+		}
+		return false;
+	}
+
+	/// Handle subscriber that points to message removed from the ring
+	void _evict(User<SSL> * user)
+	{
+		if (_slow_policy != Policy::Skip) {
+			this->_log.info("Session {} is behind data, closing", user->addr.u64);
+			_slow_consumer(user, 0, true);
+			return;
+		}
+
+		auto first = user->seq;
+		auto dropped = _index.tail() - first;
+		this->_log.info("Session {} is behind data, skip {} messages", user->addr.u64, dropped);
+		_park(user);
+		_slow_consumer(user, dropped);
+		_notice(user, first, fmt::format("{{\"gap\":{}}}", dropped));
+	}
+
+	/**
+	 * Send service message to one session framed in the same way as ring entries: with sequence
+	 * header, node opcode and compression
+	 */
+	void _notice(User<SSL> * user, uint64_t seq, std::string_view data)
+	{
+		if (_seq_header)
+			data = _seq_wrap(_notice_payload, seq, data);
+		if (!_broadcast) {
+			this->_ws_send(user->ws, user, data);
+			return;
+		}
+		data = _frame_select(user, _encode(_notice_frame, data));
+		if (user->batch_inflight) // Keep order with data that is not yet accepted by the kernel
+			user->batch_notice.append(data);
+		else
+			RawSocket<SSL>::cast(user->ws)->write(data.data(), data.size());
+	}
+
+	/// Prepend 8 byte little endian sequence number to data
+	static std::string_view _seq_wrap(std::vector<char> &buf, uint64_t seq, std::string_view data)
+	{
+		seq = htole64(seq);
+		buf.resize(sizeof(seq) + data.size());
+		memcpy(buf.data(), &seq, sizeof(seq));
+		memcpy(buf.data() + sizeof(seq), data.data(), data.size());
+		return { buf.data(), buf.size() };
+	}
+
+	/// Update session counters and report them with SlowConsumer control message
+	void _slow_consumer(User<SSL> * user, uint64_t dropped, bool close = false)
+	{
+		this->_stat_session(0, 0, 1);
+		user->lag_events++;
+		user->dropped += dropped;
+		_slow_events.push_back({ user->addr, dropped, user->dropped, user->lag_events, close });
+	}
+
+	/// Emit queued SlowConsumer messages and close sessions that are evicted with close policy
+	void _slow_flush()
+	{
+		if (_slow_events.empty())
+			return;
+		std::vector<SlowEvent> events;
+		std::swap(events, _slow_events); // Nested posts from callbacks queue and flush their own events
+		for (auto & e : events) {
+			std::array<char, http_scheme::SlowConsumer::meta_size()> buf = {};
+			auto data = http_scheme::SlowConsumer::bind(buf);
+			data.set_policy(_slow_policy);
+			data.set_dropped(e.dropped);
+			data.set_dropped_total(e.dropped_total);
+			data.set_events(e.events);
+
+			tll_msg_t msg = {};
+			msg.type = TLL_MESSAGE_CONTROL;
+			msg.msgid = data.meta_id();
+			msg.addr = e.addr;
+			msg.data = data.view().data();
+			msg.size = data.view().size();
+			this->_callback(&msg);
+
+			if (!e.close)
+				continue;
+			if (auto session = this->_sessions.lookup(e.addr.u64); session) // Not closed by callback
+				session->resp->close();
+		}
+		if (_slow_events.empty()) { // Keep allocated buffer
+			events.clear();
+			std::swap(events, _slow_events);
+		}
+	}
+
+	/// Build plain and optionally compressed frames for message in buf
+	std::string_view _encode(std::vector<char> &buf, std::string_view data)
+	{
+		uint32_t plain = 0;
+		buf.resize(sizeof(plain) + ws_frame_header_max + data.size());
+		plain = ws_frame_header(buf.data() + sizeof(plain), this->_op_code, data.size(), false);
+		memcpy(buf.data() + sizeof(plain) + plain, data.data(), data.size());
+		plain += data.size();
+		memcpy(buf.data(), &plain, sizeof(plain));
+		buf.resize(sizeof(plain) + plain);
+
+		if (this->_compression == Compression::Off || data.size() < this->_compress_min)
+			return { buf.data(), buf.size() };
+
+		// Shared stream without context takeover, same bytes are valid for every client
+		auto z = this->_compress(this->_deflate, data);
+		if (!z)
+			this->_log.warning("Failed to deflate message of size {}", data.size());
+		else if (z->size() < data.size()) {
+			auto off = buf.size();
+			buf.resize(off + ws_frame_header_max + z->size());
+			auto hsize = ws_frame_header(buf.data() + off, this->_op_code, z->size(), true);
+			memcpy(buf.data() + off + hsize, z->data(), z->size());
+			buf.resize(off + hsize + z->size());
+		}
+		return { buf.data(), buf.size() };
+	}
+
+	/// Pick compressed or plain frame from encoded data depending on session extensions
+	static std::string_view _frame_select(const User<SSL> * user, std::string_view data)
+	{
+		uint32_t plain;
+		memcpy(&plain, data.data(), sizeof(plain));
+		data = data.substr(sizeof(plain));
+		if (user->deflate && data.size() > plain)
+			return data.substr(plain);
+		return data.substr(0, plain);
+	}
+
+	/// Put session with nothing to send into waiting state
+	void _park(User<SSL> * user)
+	{
+		user->position = _ring.end();
+		if (!user->filtered)
+			return _index.insert(user, _index.tail());
+		_index.remove(user);
+		for (auto & t : user->topics)
+			_topics[t].insert(user);
+	}
+
+	/// Remove filtered session from per-topic waiting sets
+	void _unpark(User<SSL> * user)
+	{
+		for (auto & t : user->topics)
+			_topic_remove(t, user);
+	}
+
+	void _topic_remove(std::string_view topic, User<SSL> * user)
+	{
+		auto it = _topics.find(topic);
+		if (it == _topics.end())
+			return;
+		it->second.erase(user);
+		if (it->second.empty())
+			_topics.erase(it);
+	}
+
+	/// Wake filtered sessions waiting for topic, position and seq point to new entry
+	void _topic_wake(std::string_view topic, const tll::util::DataRing<void>::iterator &position, uint64_t seq)
+	{
+		auto it = _topics.find(topic);
+		if (it == _topics.end())
+			return;
+		_topic_wakeup.assign(it->second.begin(), it->second.end());
+		for (auto user : _topic_wakeup) {
+			_unpark(user);
+			user->position = position;
+			_index.insert(user, seq);
+			writeable(user->ws, user);
+		}
+		_topic_wakeup.clear();
+	}
+
+	static bool _topic_field_supported(const tll::scheme::Field * f)
+	{
+		switch (f->type) {
+		case tll::scheme::Field::Int8:
+		case tll::scheme::Field::Int16:
+		case tll::scheme::Field::Int32:
+		case tll::scheme::Field::Int64:
+		case tll::scheme::Field::UInt8:
+		case tll::scheme::Field::UInt16:
+		case tll::scheme::Field::UInt32:
+		case tll::scheme::Field::UInt64:
+		case tll::scheme::Field::Bytes:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	template <typename I>
+	std::string_view _topic_int(const char * ptr)
+	{
+		I v;
+		memcpy(&v, ptr, sizeof(v));
+		_topic_buf = fmt::format("{}", (std::conditional_t<std::is_signed_v<I>, int64_t, uint64_t>) v);
+		return _topic_buf;
+	}
+
+	/// Topic of posted message, empty if message has no topic field
+	std::string_view _topic(const tll_msg_t * msg)
+	{
+		switch (_topic_mode) {
+		case Topic::None:
+			return {};
+		case Topic::MsgId:
+			_topic_buf = fmt::format("{}", msg->msgid);
+			return _topic_buf;
+		case Topic::Field:
+			break;
+		}
+
+		auto it = _topic_fields.find(msg->msgid);
+		if (it == _topic_fields.end())
+			return {};
+		auto f = it->second;
+		if (msg->size < f->offset + f->size)
+			return {};
+		auto ptr = (const char *) msg->data + f->offset;
+		switch (f->type) {
+		case tll::scheme::Field::Int8: return _topic_int<int8_t>(ptr);
+		case tll::scheme::Field::Int16: return _topic_int<int16_t>(ptr);
+		case tll::scheme::Field::Int32: return _topic_int<int32_t>(ptr);
+		case tll::scheme::Field::Int64: return _topic_int<int64_t>(ptr);
+		case tll::scheme::Field::UInt8: return _topic_int<uint8_t>(ptr);
+		case tll::scheme::Field::UInt16: return _topic_int<uint16_t>(ptr);
+		case tll::scheme::Field::UInt32: return _topic_int<uint32_t>(ptr);
+		case tll::scheme::Field::UInt64: return _topic_int<uint64_t>(ptr);
+		case tll::scheme::Field::Bytes: {
+			auto r = std::string_view(ptr, f->size);
+			return r.substr(0, r.find('\0'));
+		}
+		default:
+			return {};
+		}
+	}
+
+	std::string_view _topic_wrap(std::string_view topic, std::string_view data)
+	{
+		uint16_t size = topic.size();
+		_topic_entry.resize(sizeof(size) + topic.size() + data.size());
+		memcpy(_topic_entry.data(), &size, sizeof(size));
+		memcpy(_topic_entry.data() + sizeof(size), topic.data(), topic.size());
+		memcpy(_topic_entry.data() + sizeof(size) + topic.size(), data.data(), data.size());
+		return { _topic_entry.data(), _topic_entry.size() };
+	}
+
+	static std::string_view _entry_topic(const tll::util::DataRing<void>::iterator &it)
+	{
+		uint16_t size;
+		memcpy(&size, it->data(), sizeof(size));
+		return { (const char *) it->data() + sizeof(size), size };
+	}
+
+	bool _topic_match(const User<SSL> * user, const tll::util::DataRing<void>::iterator &it) const
+	{
+		return user->topics.find(_entry_topic(it)) != user->topics.end();
+	}
+
+	/// Data that is sent to subscriber for ring entry
+	std::string_view _entry(const User<SSL> * user, const tll::util::DataRing<void>::iterator &it) const
+	{
+		auto data = std::string_view((const char *) it->data(), it->size);
+		if (_topic_mode != Topic::None)
+			data = data.substr(sizeof(uint16_t) + _entry_topic(it).size());
+		if (!_broadcast)
+			return data;
+		return _frame_select(user, data);
+	}
+
+	/// Send entry data, return false if socket is under backpressure
+	bool _send(Response * ws, User<SSL> * user, std::string_view data)
+	{
+		if (!_broadcast)
+			return this->_ws_send(ws, user, data) == Response::SendStatus::SUCCESS;
+		auto r = RawSocket<SSL>::cast(ws)->write(data.data(), data.size());
+		return !r.second;
+	}
+};
+
+template <bool SSL>
+class WSStatic : public WSNode<WSStatic, SSL>
+{
+	/*
+	 * Files are served inside the server without emitting any messages. Small files are sent from
+	 * memory, larger ones with sendfile directly into the socket and last block of the range is
+	 * written through uWS to complete the response, see RawResponse. Socket level part is
+	 * us_socket_sendfile.
+	 *
+	 * With userspace TLS data must pass through SSL layer so file is streamed by chunks with tryEnd.
+	 */
+	struct Transfer
+	{
+		WSStatic<SSL> * node;
+		uWS::HttpResponse<SSL> * resp;
+		std::shared_ptr<StaticFile> file;
+		tll_addr_t addr = {};
+		off_t offset = 0; // Next byte for sendfile, start of the range when streaming
+		size_t size = 0; // Bytes left for sendfile, size of the range when streaming
+		std::string tail;
+		size_t chunk = 0; // Offset of data in tail from the start of the range when streaming
+	};
+
+	std::string _root;
+	std::string _index = "index.html";
+	size_t _mmap_max = 1024 * 1024;
+	size_t _cache_size = 64 * 1024 * 1024;
+
+	StaticCache _cache;
+	us_fd_poll_t * _inotify_poll = nullptr;
+
+ public:
+	using Response = uWS::HttpResponse<SSL>;
+	using Parent = WSNode<WSStatic, SSL, Response>;
+
+	static constexpr std::string_view channel_protocol() { return "uws+static"; }
+	static constexpr size_t sendfile_tail = 4096;
+	static constexpr size_t stream_chunk = 64 * 1024;
+
+	int _init(const tll::Channel::Url &url, tll::Channel *master)
+	{
+		if (auto r = Parent::_init(url, master); r)
+			return r;
+		if (this->methods == NodeRouter<SSL>::method_any)
+			this->methods = method_bit(Method::GET) | method_bit(Method::HEAD);
+
+		auto reader = this->channel_props_reader(url);
+		_root = reader.template getT<std::string>("root");
+		_index = reader.getT("index", _index);
+		_mmap_max = reader.template getT<tll::util::Size>("mmap-max", _mmap_max);
+		_cache_size = reader.template getT<tll::util::Size>("cache-size", _cache_size);
+		if (!reader)
+			return this->_log.fail(EINVAL, "Invalid url: {}", reader.error());
+		if (this->methods & ~(method_bit(Method::GET) | method_bit(Method::HEAD)))
+			return this->_log.fail(EINVAL, "Static node serves only GET and HEAD methods");
+		return 0;
+	}
+
+	int _open(const tll::ConstConfig &url)
+	{
+		if (this->_master->sharded())
+			return this->_log.fail(EINVAL, "Static nodes are not supported by sharded server");
+		if (!this->_master->loop())
+			return this->_log.fail(EINVAL, "Master server is not active");
+
+		struct stat st;
+		if (::stat(_root.c_str(), &st) || !S_ISDIR(st.st_mode))
+			return this->_log.fail(EINVAL, "Root '{}' is not a directory", _root);
+
+		if (auto r = _cache.init(_root, _mmap_max, _cache_size); r)
+			return this->_log.fail(EINVAL, "Failed to init file cache: {}", strerror(r));
+		_inotify_poll = us_fd_poll_create(this->_master->loop(), _cache.fd(), [](void * user) { static_cast<WSStatic<SSL> *>(user)->_inotify(); }, this);
+		us_fd_poll_update(_inotify_poll, LIBUS_SOCKET_READABLE);
+		return Parent::_open(url);
+	}
+
+	int _close()
+	{
+		auto r = Parent::_close(); // Pending transfers are aborted
+		if (_inotify_poll)
+			us_fd_poll_free(_inotify_poll);
+		_inotify_poll = nullptr;
+		_cache.reset();
+		return r;
+	}
+
+	/// Serve file for request path relative to node prefix, empty path or directory gives index file
+	void serve(Response * resp, uWS::HttpRequest * req, Method method)
+	{
+		auto url = req->getUrl();
+		auto decoded = static_path_decode(url.substr(std::min(this->_prefix.size(), url.size())));
+		if (!decoded) {
+			this->_log.debug("Invalid escape in static file url '{}'", url);
+			resp->writeStatus("400 Bad Request");
+			return resp->end("Invalid url");
+		}
+		auto & path = *decoded; // Validated by cache lookup after decoding
+		if (!path.size() || path.back() == '/')
+			path += _index;
+
+		int error = 0;
+		auto file = _cache.lookup(path, error);
+		if (!file) {
+			this->_log.debug("Static file '{}' is not available: {}", path, strerror(error));
+			resp->writeStatus(error == EACCES ? "403 Forbidden" : "404 Not Found");
+			return resp->end(error == EACCES ? "Access denied" : "File not found");
+		}
+
+		if (static_etag_match(req->getHeader("if-none-match"), file->etag)) {
+			resp->writeStatus("304 Not Modified");
+			resp->writeHeader("ETag", file->etag);
+			return resp->endWithoutBody();
+		}
+
+		auto range = static_range(req->getHeader("range"), file->size);
+		if (range.type == StaticRange::Invalid) {
+			resp->writeStatus("416 Range Not Satisfiable");
+			resp->writeHeader("Content-Range", fmt::format("bytes */{}", file->size));
+			return resp->end();
+		}
+
+		resp->writeStatus(range.type == StaticRange::Partial ? "206 Partial Content" : uWS::HTTP_200_OK);
+		resp->writeHeader("Content-Type", file->content_type);
+		resp->writeHeader("ETag", file->etag);
+		resp->writeHeader("Last-Modified", file->last_modified);
+		resp->writeHeader("Accept-Ranges", "bytes");
+		if (range.type == StaticRange::Partial)
+			resp->writeHeader("Content-Range", fmt::format("bytes {}-{}/{}", range.offset, range.offset + range.size - 1, file->size));
+
+		if (method == Method::HEAD)
+			return resp->endWithoutBody(range.size);
+		if (file->data)
+			return resp->end(std::string_view(file->data + range.offset, range.size));
+
+		if (SSL || range.size <= sendfile_tail) {
+			if (SSL && range.size > stream_chunk) {
+				auto t = new Transfer { this, resp, file };
+				t->offset = range.offset;
+				t->size = range.size;
+				t->addr.u64 = this->_sessions.insert({ resp });
+				resp->onAborted([t]() { t->node->_transfer_free(t); });
+				resp->onWritable([t](uintmax_t) { return t->node->_stream(t); });
+				_stream(t);
+				return;
+			}
+
+			std::string data(range.size, '\0');
+			if (pread(file->fd, data.data(), data.size(), range.offset) != (ssize_t) data.size()) {
+				this->_log.warning("Failed to read static file '{}': {}", path, strerror(errno));
+				return resp->close();
+			}
+			return resp->end(data);
+		}
+
+		auto t = new Transfer { this, resp, file };
+		t->offset = range.offset;
+		t->size = range.size - sendfile_tail;
+		t->addr.u64 = this->_sessions.insert({ resp });
+		resp->onAborted([t]() { t->node->_transfer_free(t); });
+		resp->onWritable([t](uintmax_t) { return t->node->_transfer(t); });
+		RawResponse<SSL>::begin(resp, range.size); // Headers are flushed after handler returns
+		us_socket_want_writable((us_socket_t *) resp);
+	}
+
+ private:
+	void _inotify()
+	{
+		if (auto n = _cache.process(); n)
+			this->_log.debug("Dropped {} changed files from cache", n);
+	}
+
+	void _transfer_free(Transfer * t)
+	{
+		this->_sessions.erase(t->addr.u64);
+		delete t;
+	}
+
+	/// Continue transfer when socket is writable, called by uWS
+	bool _transfer(Transfer * t)
+	{
+		auto socket = RawSocket<SSL>::cast(t->resp);
+		if (socket->getBufferedAmount() && socket->write(nullptr, 0).second)
+			return false; // Headers are not flushed yet
+
+		while (t->size) {
+			auto r = us_socket_sendfile((us_socket_t *) t->resp, t->file->fd, &t->offset, t->size);
+			if (r > 0) {
+				t->size -= r;
+				continue;
+			}
+			if (r == 0)
+				return true; // Called again when socket is writable
+			this->_log.warning("Failed to send static file to session 0x{:x}: {}", t->addr.u64, errno == ENODATA ? "file is truncated" : strerror(errno));
+			t->resp->close(); // Transfer is freed in onAborted
+			return false;
+		}
+
+		if (!t->tail.size()) {
+			t->tail.resize(sendfile_tail);
+			if (pread(t->file->fd, t->tail.data(), t->tail.size(), t->offset) != (ssize_t) t->tail.size()) {
+				this->_log.warning("Failed to read static file for session 0x{:x}: {}", t->addr.u64, strerror(errno));
+				t->resp->close();
+				return false;
+			}
+		}
+
+		auto [ok, done] = RawResponse<SSL>::end(t->resp, t->tail);
+		if (done)
+			_transfer_free(t);
+		return ok;
+	}
+
+	/// Write file range by chunks through uWS, continued from onWritable
+	bool _stream(Transfer * t)
+	{
+		auto resp = t->resp;
+		while (true) {
+			size_t offset = resp->getWriteOffset();
+			if (offset >= t->chunk + t->tail.size()) {
+				t->chunk = offset;
+				t->tail.resize(std::min(stream_chunk, t->size - offset));
+				if (pread(t->file->fd, t->tail.data(), t->tail.size(), t->offset + offset) != (ssize_t) t->tail.size()) {
+					this->_log.warning("Failed to read static file for session 0x{:x}: {}", t->addr.u64, strerror(errno));
+					resp->close(); // Transfer is freed in onAborted
+					return false;
+				}
+			}
+
+			auto [ok, done] = resp->tryEnd(std::string_view(t->tail).substr(offset - t->chunk), t->size);
+			if (done) {
+				_transfer_free(t);
+				return true;
+			}
+			if (!ok)
+				return false; // Continue when socket is drained
+		}
+	}
+};
+
+template <bool SSL>
+std::optional<const tll_channel_impl_t *> WSServer<SSL>::_init_replace(const Channel::Url &url, Channel * master)
+{
+	if (SSL || url.proto() != "uwss")
+		return nullptr;
+
+	// Plain server handles TLS only when connections can be passed to uWS with kTLS enabled
+	auto reader = this->channel_props_reader(url);
+	if (reader.getT("ktls", false)) {
+		if (ktls_available())
+			return nullptr;
+		this->_log.info("kTLS is not available, use userspace TLS");
+	}
+	return &WSServer<true>::impl;
+}
+
+template <bool SSL>
+int WSServer<SSL>::_init(const Channel::Url &url, Channel * master)
+{
+	//if (!url.host().size())
+	//	return _log.fail(EINVAL, "No path to database");
+
+	this->_scheme_control.reset(this->context().scheme_load(http_scheme::scheme_string));
+	if (!this->_scheme_control.get())
+		return this->_log.fail(EINVAL, "Failed to load control scheme");
+
+	auto host = url.host();
+	auto sep = host.find_last_of(':');
+	if (sep == host.npos)
+		return this->_log.fail(EINVAL, "Invalid host:port pair: {}", host);
+	auto p = conv::to_any<unsigned short>(host.substr(sep + 1));
+	if (!p)
+		return this->_log.fail(EINVAL, "Invalid port '{}': {}", host.substr(sep + 1), p.error());
+
+	_port = *p;
+	_host = host.substr(0, sep);
+
+	auto reader = this->channel_props_reader(url);
+	default_op_code = reader.getT("binary", true) ? uWS::OpCode::BINARY : uWS::OpCode::TEXT;
+	_max_payload_size = reader.template getT<tll::util::Size>("max-payload-size", _max_payload_size);
+	_max_backpressure = reader.template getT<tll::util::Size>("max-backpressure", _max_backpressure);
+	_shards_count = reader.getT("shards", 0u);
+	_send_batch = reader.getT("send-batch", SendBatch::None, {{"none", SendBatch::None}, {"io_uring", SendBatch::IOUring}});
+	_uring_entries = reader.getT("uring-entries", _uring_entries);
+	_budget_events = reader.getT("budget-events", 0u);
+	_budget_time = reader.getT("budget-time", tll::duration {});
+	_busy_poll = reader.getT("busy-poll", tll::duration {});
+	_busy_poll_usec = reader.getT("busy-poll-usec", _busy_poll_usec);
+	_tls = SSL || url.proto() == "uwss";
+	if (_tls) {
+		_tls_cert = reader.template getT<std::string>("cert", "");
+		_tls_key = reader.template getT<std::string>("key", "");
+		_tls_tickets = reader.getT("tickets", true);
+	}
+	/*
+	_table = reader.template getT<std::string>("table");
+	if ((internal.caps & (caps::Input | caps::Output)) == caps::Input)
+		_autoclose = reader.getT("autoclose", false);
+		*/
+	if (!reader)
+		return this->_log.fail(EINVAL, "Invalid url: {}", reader.error());
+
+	if (_shards_count > 255)
+		return this->_log.fail(EINVAL, "Too many shards: {}, maximum is 255", _shards_count);
+
+	if (_send_batch == SendBatch::IOUring && sharded())
+		return this->_log.fail(EINVAL, "io_uring send batching is not supported by sharded server");
+
+	if (_busy_poll.count() && sharded())
+		return this->_log.fail(EINVAL, "Busy poll mode is not supported by sharded server");
+
+	if (_tls && sharded())
+		return this->_log.fail(EINVAL, "TLS is not supported by sharded server");
+	if (SSL && _send_batch != SendBatch::None)
+		return this->_log.fail(EINVAL, "Send batching writes into sockets directly and is not supported with userspace TLS");
+	if (_tls && (_tls_cert.empty() || _tls_key.empty()))
+		return this->_log.fail(EINVAL, "TLS server needs cert and key parameters");
+
+	if (sharded())
+		return 0;
+
+	// Inline server uses thread local uWS loop
+	if (uws_loop_owner)
+		return this->_log.fail(EINVAL, "Only one UWS server per thread, blocked by existing: '{}'", uws_loop_owner_name);
+
+	uws_loop_owner = this;
+	uws_loop_owner_name = this->name;
+	return 0;
+}
+
+template <bool SSL>
+template <typename H>
+void WSServer<SSL>::app_setup(App &app, H * handler)
+{
+	app.get("/*", [handler](auto *res, auto *req) { handler->template _http<Method::GET>(res, req); })
+		.post("/*", [handler](auto *res, auto *req) { handler->template _http<Method::POST>(res, req); })
+		.put("/*", [handler](auto *res, auto *req) { handler->template _http<Method::PUT>(res, req); })
+		.head("/*", [handler](auto *res, auto *req) { handler->template _http<Method::HEAD>(res, req); })
+		.options("/*", [handler](auto *res, auto *req) { handler->template _http<Method::OPTIONS>(res, req); });
+	app_ws(app, handler, Compression::Shared);
+}
+
+template <bool SSL>
+template <typename H>
+void WSServer<SSL>::app_ws(App &app, H * handler, Compression route)
+{
+	/*
+	 * Compressor mode of the context defines negotiated permessage-deflate parameters. Route with
+	 * shared compressor serves all nodes, messages are compressed by node stream without server
+	 * context takeover and uWS does not allocate anything per socket. Route with dedicated
+	 * compressor is registered only when first node with dedicated compression is added, upgrade
+	 * requests of such nodes are passed to it and messages are compressed by uWS socket stream.
+	 */
+	typename App::template WebSocketBehavior<User<SSL>> wsopt = {};
+
+	wsopt.compression = route == Compression::Dedicated ? uWS::DEDICATED_COMPRESSOR : uWS::SHARED_COMPRESSOR;
+	wsopt.maxPayloadLength = _max_payload_size;
+	wsopt.idleTimeout = 10;
+	wsopt.maxBackpressure = _max_backpressure;
+
+	/* Handlers */
+	wsopt.upgrade = [handler, route](auto *res, auto *req, auto *context) { return handler->_ws_upgrade(res, req, context, route); };
+	wsopt.open = [handler](auto *ws) { handler->_ws_open(ws); };
+	wsopt.message = [handler](auto *ws, std::string_view message, uWS::OpCode opCode) { handler->_ws_message(ws, message, opCode); };
+	wsopt.drain = [handler](auto *ws) { handler->_ws_drain(ws); };
+	wsopt.close = [handler](auto *ws, int code, std::string_view message) { handler->_ws_close(ws, code, message); };
+
+	app.template ws<User<SSL>>("/*", std::move(wsopt));
+}
+
+template <bool SSL>
+int WSServer<SSL>::_open(const ConstConfig &s)
+{
+	if (sharded()) {
+		_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (_event_fd == -1)
+			return this->_log.fail(EINVAL, "Failed to create event fd: {}", strerror(errno));
+		this->_update_fd(_event_fd);
+		this->_update_dcaps(dcaps::CPOLLIN);
+
+		this->_log.info("Start {} shards", _shards_count);
+		for (auto i = 0u; i < _shards_count; i++) {
+			_shards.emplace_back(new WSShard(this, i));
+			if (_shards.back()->start())
+				return this->_log.fail(EINVAL, "Failed to start shard {}", i);
+		}
+		return 0;
+	}
+
+	_app_loop = uWS::Loop::get();
+	_app_loop->integrate();
+
+	auto us_loop = (us_loop_t *) _app_loop;
+	auto fd = us_loop->fd;
+
+	if (fd != -1) {
+		this->_update_fd(fd);
+		this->_update_dcaps(dcaps::CPOLLIN);
+	}
+
+	if (_send_batch == SendBatch::IOUring) {
+		if (auto r = _uring.init(_uring_entries); r)
+			return this->_log.fail(EINVAL, "Failed to init io_uring with {} entries: {}", _uring_entries, strerror(r));
+		this->_log.info("Use io_uring with {} entries for batched sends", _uring.entries());
+		_uring_poll = us_fd_poll_create(us_loop, _uring.fd(), [](void * user) { static_cast<WSServer<SSL> *>(user)->_uring_reap(); }, this);
+		_uring_polling = false;
+	}
+
+	uWS::SocketContextOptions options = {};
+	if (SSL) {
+		options.cert_file_name = _tls_cert.c_str();
+		options.key_file_name = _tls_key.c_str();
+	}
+	_app.reset(new App(options));
+	if (_app->constructorFailed())
+		return this->_log.fail(EINVAL, "Failed to create TLS context with certificate '{}' and key '{}'", _tls_cert, _tls_key);
+	if (SSL)
+		tls_ctx_setup((SSL_CTX *) _app->getNativeHandle(), _tls_tickets);
+	app_setup(*_app, this);
+	_ws_dedicated = std::any_of(_nodes.begin(), _nodes.end(), ws_dedicated);
+	if (_ws_dedicated)
+		app_ws(*_app, this, Compression::Dedicated);
+
+	if (_tls_own()) {
+		if (_tls_open())
+			return this->_log.fail(EINVAL, "Failed to start TLS server");
+	} else {
+		auto cb = [this](auto *token) {
+			this->_app_socket = token;
+			if (token) {
+				this->_log.info("Serving{}", SSL ? " TLS" : "");
+			}
+		};
+		if (host().empty())
+			_app->listen(_port, cb);
+		else
+			_app->listen(std::string(host()), _port, cb);
+	}
+
+	if (_busy_poll.count()) {
+		_busy_poll_setup();
+		_spinning = false;
+		_spin_until = {};
+		_process_last = std::chrono::steady_clock::now();
+	}
+
+	return 0;
+}
+
+template <bool SSL>
+void WSServer<SSL>::_busy_poll_setup()
+{
+	this->_log.info("Busy poll for {}us after activity, socket busy poll {}us", std::chrono::duration_cast<std::chrono::microseconds>(_busy_poll).count(), _busy_poll_usec);
+
+	// Accepted sockets inherit busy poll options from listening socket
+	auto fd = _tls_own() ? _tls_fd : (_app_socket ? us_poll_fd((us_poll_t *) _app_socket) : -1);
+	if (fd != -1) {
+		int usec = _busy_poll_usec;
+		if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)))
+			this->_log.warning("Failed to set SO_BUSY_POLL to {}us: {}", usec, strerror(errno));
+#ifdef SO_PREFER_BUSY_POLL
+		int prefer = 1;
+		if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)))
+			this->_log.warning("Failed to set SO_PREFER_BUSY_POLL: {}", strerror(errno));
+#endif
+	}
+
+#ifdef EPIOCSPARAMS
+	// Let epoll_wait on the inner loop busy poll device queues too
+	epoll_params params = {};
+	params.busy_poll_usecs = _busy_poll_usec;
+	params.busy_poll_budget = 8;
+	params.prefer_busy_poll = 1;
+	if (ioctl(((us_loop_t *) _app_loop)->fd, EPIOCSPARAMS, &params))
+		_log.warning("Failed to set epoll busy poll parameters: {}", strerror(errno));
+#endif
+}
+
+template <bool SSL>
+int WSServer<SSL>::_tls_open()
+{
+	if (auto r = _tls_ctx.init(_tls_cert, _tls_key, _tls_tickets); r)
+		return this->_log.fail(EINVAL, "{}", *r);
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo * ai = nullptr;
+	auto port = std::to_string(_port);
+	auto host = this->host().empty() ? nullptr : _host.c_str();
+	if (!host)
+		hints.ai_family = AF_INET6; // Dual stack socket for any address
+	if (auto r = getaddrinfo(host, port.c_str(), &hints, &ai); r)
+		return this->_log.fail(EINVAL, "Failed to resolve '{}': {}", _host, gai_strerror(r));
+	std::unique_ptr<addrinfo, decltype(&freeaddrinfo)> ai_ptr(ai, freeaddrinfo);
+
+	_tls_fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (_tls_fd == -1)
+		return this->_log.fail(EINVAL, "Failed to create socket: {}", strerror(errno));
+
+	int one = 1, zero = 0;
+	setsockopt(_tls_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (ai->ai_family == AF_INET6 && !host)
+		setsockopt(_tls_fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+
+	if (bind(_tls_fd, ai->ai_addr, ai->ai_addrlen))
+		return this->_log.fail(EINVAL, "Failed to bind to {}:{}: {}", _host, _port, strerror(errno));
+	if (listen(_tls_fd, 512))
+		return this->_log.fail(EINVAL, "Failed to listen on {}:{}: {}", _host, _port, strerror(errno));
+
+	_tls_poll = us_fd_poll_create((us_loop_t *) _app_loop, _tls_fd, [](void * user) { static_cast<WSServer<SSL> *>(user)->_tls_accept(); }, this);
+	us_fd_poll_update(_tls_poll, LIBUS_SOCKET_READABLE);
+	this->_log.info("Serving kTLS, session tickets {}", _tls_tickets ? "enabled" : "disabled");
+	return 0;
+}
+
+template <bool SSL>
+void WSServer<SSL>::_tls_close()
+{
+	for (auto s : _tls_sessions) {
+		if (s->poll)
+			us_fd_poll_free(s->poll);
+		delete s;
+	}
+	_tls_sessions.clear();
+
+	if (_tls_poll)
+		us_fd_poll_free(_tls_poll);
+	_tls_poll = nullptr;
+	if (_tls_fd != -1)
+		::close(_tls_fd);
+	_tls_fd = -1;
+	_tls_ctx.reset();
+}
+
+template <bool SSL>
+void WSServer<SSL>::_tls_accept()
+{
+	auto loop = (us_loop_t *) _app_loop;
+	while (true) {
+		auto fd = accept4(_tls_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				this->_log.warning("Failed to accept connection: {}", strerror(errno));
+			return;
+		}
+
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		auto s = new TLSSession;
+		s->server = this;
+		if (s->conn.init(_tls_ctx.get(), fd)) {
+			this->_log.warning("Failed to create TLS session: {}", tls_error());
+			delete s;
+			continue;
+		}
+		s->poll = us_fd_poll_create(loop, fd, [](void * user) {
+				auto s = static_cast<TLSSession *>(user);
+				s->server->_tls_event(s);
+			}, s);
+		_tls_sessions.insert(s);
+		_tls_update(s);
+	}
+}
+
+template <bool SSL>
+void WSServer<SSL>::_tls_event(TLSSession * s)
+{
+	auto r = s->conn.handshake();
+	if (r == TLSConnection::Result::Again)
+		return _tls_update(s);
+	if (r == TLSConnection::Result::Error) {
+		this->_log.debug("TLS handshake failed: {}", s->conn.error);
+		return _tls_free(s);
+	}
+
+	this->_log.debug("TLS handshake done, resumed: {}, kTLS send: {}, recv: {}", s->conn.resumed(), s->conn.ktls_send(), s->conn.ktls_recv());
+	if (!s->conn.ktls_send() || !s->conn.ktls_recv()) {
+		// Cipher list is limited to offloadable ones so this is not expected, no userspace fallback here
+		this->_log.warning("kTLS is not enabled for negotiated cipher {}, send: {}, recv: {}, drop connection",
+				s->conn.cipher(), s->conn.ktls_send(), s->conn.ktls_recv());
+		return _tls_free(s);
+	}
+
+	// Kernel encrypts and decrypts data, uWS works with plain socket
+	auto fd = s->conn.detach();
+	_tls_free(s);
+	if (us_fd_ktls_set(fd, 1)) {
+		this->_log.error("Failed to mark socket {} as kTLS, drop connection", fd);
+		::close(fd);
+		return;
+	}
+	_app->adoptSocket(fd);
+}
+
+template <bool SSL>
+void WSServer<SSL>::_tls_update(TLSSession * s)
+{
+	us_fd_poll_update(s->poll, ((s->conn.want & TLSConnection::Read) ? LIBUS_SOCKET_READABLE : 0) | ((s->conn.want & TLSConnection::Write) ? LIBUS_SOCKET_WRITABLE : 0));
+}
+
+template <bool SSL>
+void WSServer<SSL>::_tls_free(TLSSession * s)
+{
+	us_fd_poll_free(s->poll);
+	_tls_sessions.erase(s);
+	delete s;
+}
+
+template <bool SSL>
+int WSServer<SSL>::_close()
+{
+	this->_update_fd(-1);
+
+	// Closing node removes it from the router
+	std::vector<node_ptr_t<SSL>> nodes;
+	for (auto & r : _router.routes())
+		nodes.push_back(r.value);
+	for (auto & node : nodes) {
+		std::visit([this](auto && c) {
+			this->_log.debug("Close child node {}", c->name);
+			c->close();
+		}, node);
+	}
+
+	if (sharded()) {
+		_shards_stop();
+		if (_event_fd != -1)
+			::close(_event_fd);
+		_event_fd = -1;
+		_events.clear();
+		_events_process.clear();
+		_events_offset = 0;
+		return 0;
+	}
+
+	this->_log.debug("Close US loop");
+
+	_tls_close();
+
+	if (_uring_poll) {
+		us_fd_poll_free(_uring_poll);
+		_uring_poll = nullptr;
+	}
+
+	if (_app_socket) {
+		us_listen_socket_close(0, _app_socket);
+		_app_socket = nullptr;
+	}
+
+	if (_app_loop) {
+		for (auto i = 0u; i < 100; i++)
+			us_loop_step((us_loop_t *) _app_loop, 0);
+
+		_app.reset();
+		for (auto i = 0u; i < 100; i++)
+			us_loop_step((us_loop_t *) _app_loop, 0);
+
+		_app_loop->free();
+		_app_loop = nullptr;
+	}
+
+	_uring.reset();
+
+	return 0;
+}
+
+template <bool SSL>
+void WSServer<SSL>::uring_submit()
+{
+	if (auto r = _uring.submit(); r)
+		this->_log.warning("Failed to submit {} io_uring requests: {}", _uring.pending(), strerror(r));
+	_uring_reap();
+}
+
+template <bool SSL>
+void WSServer<SSL>::_uring_reap()
+{
+	_uring.reap(WSPub<SSL>::batch_complete);
+	// Late completions are reaped from event loop, ring descriptor is polled only while they exist
+	if (_uring_polling != (_uring.inflight() > 0)) {
+		_uring_polling = !_uring_polling;
+		us_fd_poll_update(_uring_poll, _uring_polling ? LIBUS_SOCKET_READABLE : 0);
+	}
+}
 
-class WSWS : public WSNode<WSWS, WebSocket>
+template <bool SSL>
+void WSServer<SSL>::uring_drain()
 {
- public:
-	using Response = WebSocket;
+	if (auto r = _uring.drain(WSPub<SSL>::batch_complete); r)
+		this->_log.warning("Failed to wait for io_uring requests: {}", strerror(r));
+	_uring_reap();
+}
 
-	static constexpr std::string_view channel_protocol() { return "uws+ws"; }
+template <bool SSL>
+int WSServer<SSL>::_process(long timeout, int flags)
+{
+	if (sharded()) {
+		if (_events_offset == _events_process.size()) {
+			uint64_t buf;
+			if (read(_event_fd, &buf, sizeof(buf)) != (ssize_t) sizeof(buf))
+				return EAGAIN;
+
+			_events_process.clear();
+			_events_offset = 0;
+			std::unique_lock<std::mutex> lock(_events_lock);
+			std::swap(_events, _events_process);
+		}
 
-	int _post_data(Response * resp, const tll_msg_t *msg, int flags)
-	{
-		resp->send(std::string_view((const char *) msg->data, msg->size), _op_code);
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned count = 0; _events_offset < _events_process.size(); count++) {
+			if (count && _budget_exhausted(count, start))
+				break;
+			_shard_dispatch(_events_process[_events_offset++]);
+		}
+		_update_pending(_events_offset < _events_process.size());
 		return 0;
 	}
 
-	int _post_control(Response * resp, const tll_msg_t *msg, int flags)
-	{
-		if (msg->msgid != http_scheme::Disconnect::meta_id())
-			return 0;
-		resp->end();
-		_disconnected(nullptr, msg->addr);
-		return 0;
-	}
-};
+	if (_busy_poll.count())
+		return _process_busy();
+
+	auto r = us_loop_step_bounded((us_loop_t *) _app_loop, 0, _budget_events, _budget_time.count());
+	if (r < 0)
+		return this->_log.fail(EINVAL, "UV run failed: {}", r);
+	_update_pending(r > 0);
+	return 0;
+}
 
-class WSPub : public WSNode<WSPub, WebSocket>
+template <bool SSL>
+int WSServer<SSL>::_process_busy()
 {
-	tll::util::DataRing<void> _ring;
- public:
-	using Response = WebSocket;
-	using Parent = WSNode<WSPub, Response>;
+	auto start = std::chrono::steady_clock::now();
+	if (auto s = stat(); s) {
+		// Time since previous call was spent either in spin loop or sleeping in poll
+		auto page = s->acquire();
+		if (page) {
+			auto dt = std::chrono::duration_cast<std::chrono::nanoseconds>(start - _process_last).count();
+			if (_spinning)
+				page->spin.update(dt);
+			else
+				page->sleep.update(dt);
+			s->release(page);
+		}
+	}
 
-	static constexpr std::string_view channel_protocol() { return "uws+pub"; }
+	auto loop = (us_loop_t *) _app_loop;
+	auto r = us_loop_step_bounded(loop, 0, _budget_events, _budget_time.count());
+	if (r < 0)
+		return this->_log.fail(EINVAL, "UV run failed: {}", r);
+
+	_process_last = std::chrono::steady_clock::now();
+	if (loop->num_ready_polls > 0)
+		_spin_until = _process_last + _busy_poll;
+	_spinning = r > 0 || _process_last < _spin_until;
+	_update_pending(_spinning);
+	return loop->num_ready_polls > 0 ? 0 : EAGAIN;
+}
 
-	int _init(const tll::Channel::Url &url, tll::Channel *master)
-	{
-		if (auto r = Parent::_init(url, master); r)
-			return r;
+template <bool SSL>
+void WSServer<SSL>::shard_event(ShardEvent<SSL> &&ev)
+{
+	std::unique_lock<std::mutex> lock(_events_lock);
+	_events.emplace_back(std::move(ev));
+	if (_events.size() == 1) {
+		uint64_t one = 1;
+		if (write(_event_fd, &one, sizeof(one)) != (ssize_t) sizeof(one))
+			this->_log.error("Failed to notify event fd: {}", strerror(errno));
+	}
+}
 
-		auto reader = channel_props_reader(url);
+template <bool SSL>
+void WSServer<SSL>::_shard_dispatch(ShardEvent<SSL> &ev)
+{
+	if (!node_valid(ev.node)) {
+		this->_log.debug("Drop event for removed node, addr 0x{:x}", ev.addr.u64);
+		return;
+	}
 
-		auto size = reader.getT<size_t>("ring-size", 1024);
-		auto data = reader.getT<tll::util::Size>("data-size", 1024 * 1024);
+	auto & shard = *_shards[WSShard<SSL>::shard_index(ev.addr)];
+	std::visit([this, &ev, &shard](auto && c) {
+		if (ev.type == TLL_MESSAGE_CONTROL) {
+			if (ev.msgid == http_scheme::Connect::meta_id()) {
+				shard.session_open(ev.addr, ev.node);
+				RouteParams params;
+				for (auto & [k, v] : ev.params)
+					params.emplace_back(k, v);
+				c->_callback_connect(ev.addr, ev.data, ev.method, &params);
+			} else if (ev.msgid == http_scheme::Disconnect::meta_id()) {
+				shard.session_close(ev.addr);
+				c->_disconnected(nullptr, ev.addr);
+			}
+			else
+				c->_callback_control(ev.msgid, ev.addr);
+			return;
+		}
 
-		if (!reader)
-			return _log.fail(EINVAL, "Invalid url: {}", reader.error());
+		tll_msg_t msg = {};
+		msg.type = TLL_MESSAGE_DATA;
+		msg.addr = ev.addr;
+		msg.data = ev.data.data();
+		msg.size = ev.data.size();
+		c->_callback_data(&msg);
+	}, ev.node);
+}
 
-		_ring.resize(size);
-		_ring.data_resize(data);
-		return 0;
-	}
+template <bool SSL>
+int WSServer<SSL>::shard_post(const tll_msg_t *msg, const node_ptr_t<SSL> &node)
+{
+	auto idx = WSShard<SSL>::shard_index(msg->addr);
+	if (idx >= _shards.size() || !_shards[idx]->session_valid(msg->addr, node))
+		return this->_log.fail(ENOENT, "Failed to post: session 0x{:x} not found", msg->addr.u64);
+	auto & shard = *_shards[idx];
 
-	int _open(const tll::ConstConfig &url)
-	{
-		_ring.clear();
-		return Parent::_open(url);
+	if (msg->type == TLL_MESSAGE_CONTROL && msg->msgid == http_scheme::Connect::meta_id()) {
+		if (WSHTTP<SSL>::post_connect(this->_log, nullptr, msg))
+			return EINVAL;
 	}
 
-	int _post_data(Response * resp, const tll_msg_t *msg, int flags)
-	{
-		if (msg->size > _ring.data_capacity() / 2)
-			return _log.fail(EINVAL, "Message size {} is larger then half of buffer: {}", msg->size, _ring.data_capacity());
-		auto last = _ring.end();
-		do {
-			auto r = _ring.push_back(msg->data, msg->size);
-			if (r != nullptr)
-				break;
-			auto first = _ring.begin();
-			_ring.pop_front();
+	shard.post(msg);
 
-			auto it = _sessions.begin();
-			while (it != _sessions.end()) {
-				auto [addr, ws] = *(it++); // Close will remove element
-				auto user = ws->getUserData();
-				_log.info("Session {} is behind data, closing", addr);
-				if (user->position == first)
-					ws->close();
-			}
-		} while (true);
+	// Session can still be closed by client before the message reaches the shard, in this case
+	// message is dropped and Disconnect is emitted from the shard event
+	if (msg->type == TLL_MESSAGE_CONTROL && msg->msgid == http_scheme::Disconnect::meta_id())
+		shard.session_close(msg->addr);
+	else if (msg->type == TLL_MESSAGE_DATA && std::holds_alternative<WSHTTP<SSL> *>(node))
+		shard.session_close(msg->addr); // Data message is complete response
+	return 0;
+}
 
-		for (auto &[a, ws] : _sessions) {
-			auto user = ws->getUserData();
-			if (user->position == last)
-				writeable(ws, user);
-		}
-		return 0;
-	}
+template <bool SSL>
+void WSServer<SSL>::_shards_node_update(std::string_view prefix, node_ptr_t<SSL> node, bool add)
+{
+	auto wildcard = std::visit([](auto && c) { return c->wildcard; }, node);
+	auto methods = std::visit([](auto && c) { return c->methods; }, node);
+	for (auto & s : _shards)
+		s->node_update(prefix, node, wildcard, methods, add);
+}
 
-	int _post_control(Response * resp, const tll_msg_t *msg, int flags)
-	{
-		if (msg->msgid != http_scheme::Disconnect::meta_id())
-			return 0;
-		resp->end();
-		_disconnected(nullptr, msg->addr);
-		return 0;
-	}
+template <bool SSL>
+void WSServer<SSL>::_shards_stop()
+{
+	for (auto & s : _shards)
+		s->stop();
+	_shards.clear();
+}
 
-	int _post(const tll_msg_t *msg, int flags)
-	{
-		if (msg->type == TLL_MESSAGE_DATA)
-			return _post_data(nullptr, msg, flags);
-		return Parent::_post(msg, flags);
+template <bool SSL>
+int WSShard<SSL>::start()
+{
+	std::promise<int> ready;
+	auto future = ready.get_future();
+	_thread = std::thread([this, &ready]() { _run(ready); });
+	if (auto r = future.get(); r) {
+		_thread.join();
+		return r;
 	}
+	return 0;
+}
 
-	int _connected(Response * ws, std::string_view url, tll_addr_t * addr)
-	{
-		auto user = ws->getUserData();
-		user->position = _ring.end();
+template <bool SSL>
+void WSShard<SSL>::stop()
+{
+	if (!_thread.joinable())
+		return;
+	_loop->defer([this]() { _stop = true; });
+	_thread.join();
+}
 
-		return Parent::_connected(ws, url, addr);
+template <bool SSL>
+void WSShard<SSL>::_run(std::promise<int> &ready)
+{
+	_loop = uWS::Loop::get();
+
+	_app.reset(new App());
+	_server->app_setup(*_app, this);
+	_ws_dedicated = std::any_of(_router.routes().begin(), _router.routes().end(), [](auto & r) { return WSServer<SSL>::ws_dedicated(r.value); });
+	if (_ws_dedicated)
+		_server->app_ws(*_app, this, Compression::Dedicated);
+	auto cb = [this](auto *token) { this->_app_socket = token; };
+	if (_server->host().empty())
+		_app->listen(_server->port(), cb);
+	else
+		_app->listen(std::string(_server->host()), _server->port(), cb);
+
+	if (!_app_socket) {
+		_log.error("Failed to listen on port {}", _server->port());
+		_app.reset();
+		_loop->free();
+		_loop = nullptr;
+		return ready.set_value(EINVAL);
 	}
 
-	void writeable(Response * ws, User * user)
-	{
-		if (ws->getBufferedAmount() > 0)
-			return;
-		if (user->position == _ring.end())
-			return;
+	_log.info("Serving");
+	ready.set_value(0);
 
-		_log.debug("Post data to {}", user->addr.u64);
-		auto data = std::string_view((const char *) user->position->data(), user->position->size);
-		user->position++;
+	while (!_stop)
+		us_loop_step((us_loop_t *) _loop, -1);
 
-		ws->send(data, _op_code);
-	}
-};
+	_log.debug("Close US loop");
 
-int WSServer::_init(const Channel::Url &url, Channel * master)
-{
-	//if (!url.host().size())
-	//	return _log.fail(EINVAL, "No path to database");
+	// Session is copied since close callbacks free its slot
+	_slots.for_each([](uint64_t, Session s) {
+		std::visit([](auto && r) {
+			if constexpr (!std::is_same_v<std::decay_t<decltype(r)>, std::monostate>)
+				r->close();
+		}, s.resp);
+	});
 
-	if (_instance)
-		return _log.fail(EINVAL, "Only one UWS server per thread, blocked by existing: '{}'", _instance->name);
+	us_listen_socket_close(0, _app_socket);
+	_app_socket = nullptr;
 
-	_scheme_control.reset(context().scheme_load(http_scheme::scheme_string));
-	if (!_scheme_control.get())
-		return _log.fail(EINVAL, "Failed to load control scheme");
+	for (auto i = 0u; i < 100; i++)
+		us_loop_step((us_loop_t *) _loop, 0);
 
-	auto host = url.host();
-	auto sep = host.find_last_of(':');
-	if (sep == host.npos)
-		return this->_log.fail(EINVAL, "Invalid host:port pair: {}", host);
-	auto p = conv::to_any<unsigned short>(host.substr(sep + 1));
-	if (!p)
-		return this->_log.fail(EINVAL, "Invalid port '{}': {}", host.substr(sep + 1), p.error());
+	_app.reset();
+	for (auto i = 0u; i < 100; i++)
+		us_loop_step((us_loop_t *) _loop, 0);
 
-	_port = *p;
-	_host = host.substr(0, sep);
+	_loop->free();
+	_loop = nullptr;
+}
 
-	auto reader = channel_props_reader(url);
-	default_op_code = reader.getT("binary", true) ? uWS::OpCode::BINARY : uWS::OpCode::TEXT;
-	_max_payload_size = reader.getT<tll::util::Size>("max-payload-size", _max_payload_size);
-	/*
-	_table = reader.getT<std::string>("table");
-	if ((internal.caps & (caps::Input | caps::Output)) == caps::Input)
-		_autoclose = reader.getT("autoclose", false);
-		*/
-	if (!reader)
-		return _log.fail(EINVAL, "Invalid url: {}", reader.error());
+template <bool SSL>
+void WSShard<SSL>::node_update(std::string_view prefix, node_ptr_t<SSL> node, bool wildcard, unsigned methods, bool add)
+{
+	if (!_loop)
+		return;
+	if (!add) {
+		// Sessions of removed node are closed by the shard without emitting events
+		for (auto & m : _mirror) {
+			if (m.node == node)
+				m = {};
+		}
+	}
+	_loop->defer([this, prefix = std::string(prefix), node, wildcard, methods, add]() {
+		if (add) {
+			_router.add(prefix, wildcard, methods, node);
+			if (!_ws_dedicated && WSServer<SSL>::ws_dedicated(node)) {
+				_ws_dedicated = true;
+				_server->app_ws(*_app, this, Compression::Dedicated);
+			}
+			return;
+		}
 
-	_instance = this;
-	return 0;
+		if (_router.remove(prefix, wildcard, node))
+			return;
+
+		std::vector<std::pair<uint64_t, Session>> sessions;
+		_slots.for_each([&sessions, &node](uint64_t addr, const Session &s) {
+			if (s.node == node)
+				sessions.emplace_back(addr, s);
+		});
+		for (auto & [addr, s] : sessions) {
+			_slots.erase(addr);
+			std::visit([](auto && r) {
+				if constexpr (!std::is_same_v<std::decay_t<decltype(r)>, std::monostate>)
+					r->close();
+			}, s.resp);
+		}
+	});
 }
 
-int WSServer::_open(const ConstConfig &s)
+template <bool SSL>
+void WSShard<SSL>::post(const tll_msg_t *msg)
 {
-	_app_loop = uWS::Loop::get();
-	_app_loop->integrate();
+	auto ptr = std::make_shared<tll::util::OwnedMessage>(msg);
+	_loop->defer([this, ptr]() { _post(*ptr); });
+}
 
-	auto us_loop = (us_loop_t *) _app_loop;
-	auto fd = us_loop->fd;
+template <bool SSL>
+void WSShard<SSL>::_post(const tll::util::OwnedMessage &msg)
+{
+	auto session = _slot_lookup(msg.addr);
+	if (!session) {
+		_log.debug("Session 0x{:x} not found", msg.addr.u64);
+		return;
+	}
 
-	if (fd != -1) {
-		_update_fd(fd);
-		_update_dcaps(dcaps::CPOLLIN);
+	auto data = std::string_view((const char *) msg.data, msg.size);
+	if (std::holds_alternative<HttpResponse *>(session->resp)) {
+		auto resp = std::get<HttpResponse *>(session->resp);
+		if (msg.type == TLL_MESSAGE_DATA) {
+			_slot_free(msg.addr);
+			resp->writeStatus(uWS::HTTP_200_OK);
+			resp->end(data);
+		} else if (msg.msgid == http_scheme::Connect::meta_id()) {
+			WSHTTP<SSL>::post_connect(_log, resp, msg);
+		} else if (msg.msgid == http_scheme::Disconnect::meta_id()) {
+			_slot_free(msg.addr);
+			resp->end();
+		}
+	} else if (std::holds_alternative<WebSocket<SSL> *>(session->resp)) {
+		auto ws = std::get<WebSocket<SSL> *>(session->resp);
+		if (msg.type == TLL_MESSAGE_DATA) {
+			// Posting is asynchronous, so WriteFull is only a hint for producer and data is not dropped
+			auto user = ws->getUserData();
+			auto node = std::get<WSWS<SSL> *>(session->node);
+			// Compression is done by uWS compressor of the websocket route, it is not accounted in stat
+			auto compress = user->deflate && node->compression() != Compression::Off && data.size() >= node->compress_min();
+			ws->send(data, _server->default_op_code, compress);
+			if (!user->write_full && ws->getBufferedAmount() >= node->high_water()) {
+				user->write_full = true;
+				_emit(session->node, TLL_MESSAGE_CONTROL, http_scheme::WriteFull::meta_id(), msg.addr);
+			}
+		} else if (msg.msgid == http_scheme::Disconnect::meta_id()) {
+			_slot_free(msg.addr);
+			ws->end();
+		}
+	}
+}
+
+template <bool SSL>
+template <Method M>
+void WSShard<SSL>::_http(HttpResponse * resp, uWS::HttpRequest *req)
+{
+	auto uri = req->getUrl();
+	_log.debug("Requested {}", uri);
+	RouteParams params;
+	auto node = _router.lookup(uri, method_bit(M), &params);
+	if (!node || !std::holds_alternative<WSHTTP<SSL> *>(*node)) {
+		_log.debug("Requested url not found: '{}'", uri);
+		resp->writeStatus(node ? "400 Bad Request" : "404 Not Found");
+		return resp->end(node ? "WebSocket node" : "Requested url not found");
 	}
 
-	_app.reset(new uWS::App());
-	uWS::App::WebSocketBehavior<User> wsopt = {};
+	auto channel = std::get<WSHTTP<SSL> *>(*node);
+	auto size = content_length(req);
+	if (channel->recv_whole() && size > channel->body_limit()) {
+		_log.info("Request body size {} exceeds limit {}", size, channel->body_limit());
+		resp->writeStatus("413 Payload Too Large");
+		return resp->end("Request body is too large");
+	}
 
-	wsopt.compression = uWS::SHARED_COMPRESSOR;
-	wsopt.maxPayloadLength = _max_payload_size;
-	wsopt.idleTimeout = 10;
-	wsopt.maxBackpressure = 1 * 1024 * 1024;
+	auto addr = _slot_alloc(resp, *node);
+	_emit(*node, TLL_MESSAGE_CONTROL, http_scheme::Connect::meta_id(), addr, req->getFullUrl(), M, params);
 
-	/* Handlers */
-	wsopt.upgrade = [this](auto *res, auto *req, auto *context) { return this->_ws_upgrade(res, req, context); };
-	wsopt.open = [this](auto *ws) { this->_ws_open(ws); };
-	wsopt.message = [this](auto *ws, std::string_view message, uWS::OpCode opCode) { this->_ws_message(ws, message, opCode); };
-	wsopt.drain = [this](auto *ws) { this->_ws_drain(ws); };
-	wsopt.close = [this](auto *ws, int code, std::string_view message) { this->_ws_close(ws, code, message); };
-
-	_app->get("/*", [this](auto *res, auto *req) { this->_http<Method::GET>(res, req); })
-		.post("/*", [this](auto *res, auto *req) { this->_http<Method::POST>(res, req); })
-		.put("/*", [this](auto *res, auto *req) { this->_http<Method::PUT>(res, req); })
-		.head("/*", [this](auto *res, auto *req) { this->_http<Method::HEAD>(res, req); })
-		.options("/*", [this](auto *res, auto *req) { this->_http<Method::OPTIONS>(res, req); })
-		.ws<User>("/*", std::move(wsopt))
-		.listen(_port, [this](auto *token) {
-			this->_app_socket = token;
-			if (token) {
-				this->_log.info("Serving");
+	resp->onAborted([this, node = *node, addr]() {
+		if (_slot_free(addr))
+			_emit(node, TLL_MESSAGE_CONTROL, http_scheme::Disconnect::meta_id(), addr);
+	});
+	if (channel->recv_whole()) {
+		resp->onData([this, resp, node = *node, addr, body = BodyCollector(channel->body_limit(), size)](std::string_view data, bool last) mutable {
+			switch (body.append(data, last)) {
+			case BodyCollector::More:
+				return;
+			case BodyCollector::Overflow:
+				_log.info("Request body of session 0x{:x} exceeds limit {}", addr.u64, body.limit);
+				resp->writeStatus("413 Payload Too Large");
+				resp->end("Request body is too large");
+				if (_slot_free(addr))
+					_emit(node, TLL_MESSAGE_CONTROL, http_scheme::Disconnect::meta_id(), addr);
+				return;
+			case BodyCollector::Done:
+				break;
 			}
+			_emit(node, TLL_MESSAGE_DATA, 0, addr, body.body);
 		});
-
-	return 0;
+		return;
+	}
+	resp->onData([this, node = *node, addr](std::string_view data, bool last) {
+		if (data.size() == 0 && !last)
+			return;
+		_emit(node, TLL_MESSAGE_DATA, 0, addr, data);
+	});
 }
 
-int WSServer::_close()
+template <bool SSL>
+void WSShard<SSL>::_ws_upgrade(HttpResponse * resp, uWS::HttpRequest *req, us_socket_context_t *context, Compression route)
 {
-	this->_update_fd(-1);
-
-	for (auto it = _nodes.begin(); it != _nodes.end(); ) {
-		_log.debug("Close child node {}", it->first);
-		auto node = (it++)->second;
-		std::visit([](auto && c) { c->close(); }, node);
+	auto uri = req->getUrl();
+	_log.debug("Requested {}", uri);
+	// Same as WSServer::_ws_upgrade, upgrade is matched against GET routes only
+	auto node = _router.lookup(uri, method_bit(Method::GET));
+	if (!node || !std::holds_alternative<WSWS<SSL> *>(*node)) {
+		_log.debug("Requested url not found: '{}'", uri);
+		resp->writeStatus(node ? "400 Bad Request" : "404 Not Found");
+		return resp->end(node ? "HTTP node" : "Requested url not found");
 	}
 
-	_log.debug("Close US loop");
+	auto channel = std::get<WSWS<SSL> *>(*node);
+	if (channel->compression() == Compression::Dedicated && route != Compression::Dedicated)
+		return req->setYield(true);
 
-	if (_app_socket) {
-		us_listen_socket_close(0, _app_socket);
-		_app_socket = nullptr;
-	}
+	User<SSL> user = { channel };
+	auto extensions = deflate_offer(req->getHeader("sec-websocket-extensions"));
+	if (channel->compression() == Compression::Off)
+		extensions = {};
+	user.deflate = extensions.size() != 0;
 
-	if (_app_loop) {
-		for (auto i = 0u; i < 100; i++)
-			us_loop_step((us_loop_t *) _app_loop, 0);
+	resp->template upgrade<User<SSL>>(std::move(user)
+		, req->getHeader("sec-websocket-key")
+		, req->getHeader("sec-websocket-protocol")
+		, extensions
+		, context
+		);
+}
 
-		_app.reset();
-		for (auto i = 0u; i < 100; i++)
-			us_loop_step((us_loop_t *) _app_loop, 0);
+template <bool SSL>
+void WSShard<SSL>::_ws_open(WebSocket<SSL> *ws)
+{
+	auto user = ws->getUserData();
+	node_ptr_t<SSL> node = std::get<WSWS<SSL> *>(user->channel);
+	user->addr = _slot_alloc(ws, node);
+	_emit(node, TLL_MESSAGE_CONTROL, http_scheme::Connect::meta_id(), user->addr);
+}
 
-		_app_loop->free();
-		_app_loop = nullptr;
-	}
+template <bool SSL>
+void WSShard<SSL>::_ws_message(WebSocket<SSL> *ws, std::string_view message, uWS::OpCode)
+{
+	auto user = ws->getUserData();
+	node_ptr_t<SSL> node = std::get<WSWS<SSL> *>(user->channel);
+	_emit(node, TLL_MESSAGE_DATA, 0, user->addr, message);
+}
 
-	return 0;
+template <bool SSL>
+void WSShard<SSL>::_ws_drain(WebSocket<SSL> *ws)
+{
+	auto user = ws->getUserData();
+	auto node = std::get<WSWS<SSL> *>(user->channel);
+	if (!user->write_full || ws->getBufferedAmount() > node->low_water())
+		return;
+	user->write_full = false;
+	_emit(node, TLL_MESSAGE_CONTROL, http_scheme::WriteReady::meta_id(), user->addr);
 }
 
-int WSServer::_process(long timeout, int flags)
+template <bool SSL>
+void WSShard<SSL>::_ws_close(WebSocket<SSL> *ws, int code, std::string_view message)
 {
-	auto r = us_loop_step((us_loop_t *) _app_loop, 0);
-	if (r < 0)
-		return _log.fail(EINVAL, "UV run failed: {}", r);
-	return 0;
+	auto user = ws->getUserData();
+	node_ptr_t<SSL> node = std::get<WSWS<SSL> *>(user->channel);
+	if (_slot_free(user->addr))
+		_emit(node, TLL_MESSAGE_CONTROL, http_scheme::Disconnect::meta_id(), user->addr);
 }
 
-template <typename T, typename R>
-int WSNode<T, R>::_init(const Channel::Url &url, Channel * master)
+template <template <bool> class Node, bool SSL, typename R>
+int WSNode<Node, SSL, R>::_init(const Channel::Url &url, Channel * master)
 {
 	if (!master)
 		return this->_log.fail(EINVAL, "WS node channel needs master");
 
-	_master = channel_cast<WSServer>(master);
+	_master = channel_cast<WSServer<SSL>>(master);
 	if (!_master)
 		return this->_log.fail(EINVAL, "Master {} must be ws:// channel", master->name());
 
@@ -500,30 +3276,49 @@ int WSNode<T, R>::_init(const Channel::Url &url, Channel * master)
 		_prefix = "/" + _prefix;
 	if (wildcard = (_prefix.back() == '*'); wildcard)
 		_prefix = _prefix.substr(0, _prefix.size() - 1);
+
+	auto reader = this->channel_props_reader(url);
+	auto list = reader.template getT<std::string>("methods", "");
+	if (!reader)
+		return this->_log.fail(EINVAL, "Invalid url: {}", reader.error());
+	if (list.size()) {
+		auto r = method_mask(list);
+		if (!r)
+			return this->_log.fail(EINVAL, "Invalid methods list: '{}'", list);
+		methods = *r;
+	}
 	return 0;
 }
 
-template <typename T, typename R>
-int WSNode<T, R>::_open(const ConstConfig &props)
+template <template <bool> class Node, bool SSL, typename R>
+int WSNode<Node, SSL, R>::_open(const ConstConfig &props)
 {
 	if (_master->node_add(_prefix, static_cast<T *>(this)))
 		return this->_log.fail(EINVAL, "Failed to register node");
-	_addr = {};
 	return 0;
 }
 
-template <typename T, typename R>
-int WSNode<T, R>::_close()
+template <template <bool> class Node, bool SSL, typename R>
+int WSNode<Node, SSL, R>::_close()
 {
-	for (auto &[a, r] : _sessions)
-		r->close();
+	_sessions.for_each([](uint64_t, Session &s) { s.resp->close(); });
 	_sessions.clear();
 	_master->node_remove(_prefix, static_cast<T *>(this));
 	return 0;
 }
 
-template <typename T, typename R>
-int WSNode<T, R>::_connected(R * resp, std::string_view uri, tll_addr_t * addr, Method method)
+template <template <bool> class Node, bool SSL, typename R>
+template <typename... Args>
+int WSNode<Node, SSL, R>::_connected(R * resp, std::string_view uri, tll_addr_t * addr, Method method, const RouteParams * params, Args && ... args)
+{
+	addr->u64 = _sessions.insert({ resp });
+	static_cast<T *>(this)->_session_init(*addr, std::forward<Args>(args)...);
+
+	return _callback_connect(*addr, uri, method, params);
+}
+
+template <template <bool> class Node, bool SSL, typename R>
+int WSNode<Node, SSL, R>::_callback_connect(tll_addr_t addr, std::string_view uri, Method method, const RouteParams * params)
 {
 	std::vector<unsigned char> buf;
 	auto data = http_scheme::Connect::bind(buf);
@@ -532,26 +3327,35 @@ int WSNode<T, R>::_connected(R * resp, std::string_view uri, tll_addr_t * addr,
 	data.set_path(uri);
 	data.set_method(method);
 
-	*addr = _next_addr();
-	_sessions.insert(std::make_pair(addr->u64, resp));
+	if (params && params->size()) {
+		auto list = data.get_params();
+		list.resize(params->size());
+		auto i = 0u;
+		for (auto & [k, v] : *params) {
+			list[i].set_header(k);
+			list[i].set_value(v);
+			i++;
+		}
+	}
 
 	tll_msg_t msg = {};
 	msg.type = TLL_MESSAGE_CONTROL;
 	msg.msgid = data.meta_id();
-	msg.addr = *addr;
+	msg.addr = addr;
 	msg.data = buf.data();
 	msg.size = buf.size();
+	_stat_session(1, 0, 0);
+	static_cast<T *>(this)->_stat_connect(addr);
 	this->_callback(&msg);
 	return 0;
 }
 
-template <typename T, typename R>
-int WSNode<T, R>::_disconnected(R * resp, tll_addr_t addr)
+template <template <bool> class Node, bool SSL, typename R>
+int WSNode<Node, SSL, R>::_disconnected(R * resp, tll_addr_t addr)
 {
 	if (this->state() != tll::state::Closing) {
-		auto it = _sessions.find(addr.u64);
-		if (it != _sessions.end())
-			_sessions.erase(it);
+		_sessions.erase(addr.u64);
+		static_cast<T *>(this)->_session_free(addr);
 	}
 
 	std::vector<char> buf;
@@ -564,6 +3368,7 @@ int WSNode<T, R>::_disconnected(R * resp, tll_addr_t addr)
 	msg.msgid = data.meta_id();
 	msg.data = buf.data();
 	msg.size = buf.size();
+	_stat_session(0, 1, 0);
 	this->_callback(&msg);
 
 	//user->pending = {};
@@ -573,34 +3378,70 @@ int WSNode<T, R>::_disconnected(R * resp, tll_addr_t addr)
 	return 0;
 }
 
+template <bool SSL>
 template <Method M>
-void WSServer::_http(uWS::HttpResponse<false> * resp, uWS::HttpRequest *req)
+void WSServer<SSL>::_http(uWS::HttpResponse<SSL> * resp, uWS::HttpRequest *req)
 {
 	auto uri = req->getUrl();
-	_log.debug("Requested {}", uri);
-	auto node = node_lookup(uri);
+	this->_log.debug("Requested {}", uri);
+	RouteParams params;
+	auto node = node_lookup(uri, M, &params);
 	if (!node) {
-		_log.debug("Requested url not found: '{}'", uri);
+		this->_log.debug("Requested url not found: '{}'", uri);
 		resp->writeStatus("404 Not Found");
 		return resp->end("Requested url not found");
 	}
 
-	if (std::holds_alternative<WSWS *>(*node)) {
-		_log.debug("HTTP request to WS endpoint {}", uri);
+	if (std::holds_alternative<WSStatic<SSL> *>(*node))
+		return std::get<WSStatic<SSL> *>(*node)->serve(resp, req, M);
+
+	if (!std::holds_alternative<WSHTTP<SSL> *>(*node)) {
+		this->_log.debug("HTTP request to WS endpoint {}", uri);
 		resp->writeStatus("400 Bad Request");
 		return resp->end("WebSocket node");
 	}
 
-	auto channel = std::get<WSHTTP *>(*node);
-	tll_addr_t addr = {};
-	channel->_connected(resp, req->getFullUrl(), &addr, M);
+	auto channel = std::get<WSHTTP<SSL> *>(*node);
+	std::string cache_key;
+	if (M == Method::GET && channel->cache_serve(resp, req, cache_key))
+		return;
 
-	auto h = req->getHeader("content-length");
-	if (h.size()) {
-		_log.debug("Content-Length: {}", h);
+	auto size = content_length(req);
+	if (size)
+		this->_log.debug("Content-Length: {}", size);
+	if (channel->recv_whole() && size > channel->body_limit()) {
+		this->_log.info("Request body size {} exceeds limit {}", size, channel->body_limit());
+		resp->writeStatus("413 Payload Too Large");
+		return resp->end("Request body is too large");
 	}
 
+	tll_addr_t addr = {};
+	channel->_connected(resp, req->getFullUrl(), &addr, M, &params, std::move(cache_key));
+
 	resp->onAborted([channel, addr]() { channel->_disconnected(nullptr, addr); });
+	if (channel->recv_whole()) {
+		resp->onData([this, channel, resp, addr, body = BodyCollector(channel->body_limit(), size)](std::string_view data, bool last) mutable {
+			switch (body.append(data, last)) {
+			case BodyCollector::More:
+				return;
+			case BodyCollector::Overflow:
+				this->_log.info("Request body of session {} exceeds limit {}", addr.u64, body.limit);
+				resp->writeStatus("413 Payload Too Large");
+				resp->end("Request body is too large");
+				channel->_disconnected(nullptr, addr);
+				return;
+			case BodyCollector::Done:
+				break;
+			}
+			tll_msg_t msg = {};
+			msg.type = TLL_MESSAGE_DATA;
+			msg.addr = addr;
+			msg.data = body.body.data();
+			msg.size = body.body.size();
+			channel->_callback_data(&msg);
+		});
+		return;
+	}
 	resp->onData([channel, addr](std::string_view data, bool last) {
 		if (data.size() == 0 && !last)
 			return;
@@ -613,74 +3454,127 @@ void WSServer::_http(uWS::HttpResponse<false> * resp, uWS::HttpRequest *req)
 	});
 }
 
-void WSServer::_ws_upgrade(uWS::HttpResponse<false> * resp, uWS::HttpRequest *req, us_socket_context_t *context)
+template <bool SSL>
+void WSServer<SSL>::_ws_upgrade(uWS::HttpResponse<SSL> * resp, uWS::HttpRequest *req, us_socket_context_t *context, Compression route)
 {
 	auto uri = req->getUrl();
-	_log.debug("Requested {}", uri);
-	auto node = node_lookup(uri);
+	this->_log.debug("Requested {}", uri);
+	// Upgrade request is GET by RFC 6455, websocket endpoints must include it in methods list
+	auto node = node_lookup(uri, Method::GET);
 	if (!node) {
-		_log.debug("Requested url not found: '{}'", uri);
+		this->_log.debug("Requested url not found: '{}'", uri);
 		resp->writeStatus("404 Not Found");
 		return resp->end("Requested url not found");
 	}
 
-	std::variant<WSWS *, WSPub *> channel;
+	std::variant<WSWS<SSL> *, WSPub<SSL> *> channel;
 
-	if (std::holds_alternative<WSHTTP *>(*node)) {
-		_log.debug("WS request to HTTP endpoint {}", uri);
+	if (std::holds_alternative<WSHTTP<SSL> *>(*node) || std::holds_alternative<WSStatic<SSL> *>(*node)) {
+		this->_log.debug("WS request to HTTP endpoint {}", uri);
 		resp->writeStatus("400 Bad Request");
 		return resp->end("HTTP node");
-	} else if (std::holds_alternative<WSWS *>(*node)) {
-		channel = std::get<WSWS *>(*node);
-	} else if (std::holds_alternative<WSPub *>(*node)) {
-		channel = std::get<WSPub *>(*node);
+	} else if (std::holds_alternative<WSWS<SSL> *>(*node)) {
+		channel = std::get<WSWS<SSL> *>(*node);
+	} else if (std::holds_alternative<WSPub<SSL> *>(*node)) {
+		channel = std::get<WSPub<SSL> *>(*node);
+	}
+
+	auto compression = std::visit([](auto c) { return c->compression(); }, channel);
+	if (compression == Compression::Dedicated && route != Compression::Dedicated)
+		return req->setYield(true); // Served by websocket context with dedicated compressor
+
+	auto extensions = deflate_offer(req->getHeader("sec-websocket-extensions"));
+	if (compression == Compression::Off)
+		extensions = {}; // Do not negotiate permessage-deflate
+
+	User<SSL> user = { channel };
+	user.deflate = extensions.size() != 0;
+
+	if (std::holds_alternative<WSPub<SSL> *>(channel)) {
+		if (auto seq = query_param(req->getQuery(), "seq"); seq) {
+			auto r = conv::to_any<uint64_t>(*seq);
+			if (!r) {
+				this->_log.debug("Invalid seq parameter '{}': {}", *seq, r.error());
+				resp->writeStatus("400 Bad Request");
+				return resp->end("Invalid seq parameter");
+			}
+			if (auto error = std::get<WSPub<SSL> *>(channel)->resume_check(*r); error) {
+				this->_log.info("Can not resume session: {}", *error);
+				resp->writeStatus("410 Gone");
+				return resp->end(*error);
+			}
+			user.resume = *r;
+		}
+
+		if (auto topics = query_param(req->getQuery(), "topics"); topics) {
+			if (!std::get<WSPub<SSL> *>(channel)->topics_enabled()) {
+				this->_log.debug("Topics requested for node without topics: {}", uri);
+				resp->writeStatus("400 Bad Request");
+				return resp->end("Topics are not enabled");
+			}
+			user.filtered = true;
+			WSPub<SSL>::topics_split(*topics, [&user](std::string_view t) { user.topics.emplace(t); });
+		}
 	}
 
-	resp->template upgrade<User>({ channel }
+	resp->template upgrade<User<SSL>>(std::move(user)
 		, req->getHeader("sec-websocket-key")
 		, req->getHeader("sec-websocket-protocol")
-		, req->getHeader("sec-websocket-extensions")
+		, extensions
 		, context
 		);
 }
 
-void WSServer::_ws_open(WebSocket *ws)
+template <bool SSL>
+void WSServer<SSL>::_ws_open(WebSocket<SSL> *ws)
 {
 	auto user = ws->getUserData();
 	std::visit([&ws, &user](auto && c) { c->_connected(ws, "", &user->addr); }, user->channel);
 }
 
-void WSServer::_ws_message(WebSocket *ws, std::string_view message, uWS::OpCode)
+template <bool SSL>
+void WSServer<SSL>::_ws_message(WebSocket<SSL> *ws, std::string_view message, uWS::OpCode)
 {
 	auto user = ws->getUserData();
 
-	if (!std::holds_alternative<WSWS *>(user->channel))
+	if (std::holds_alternative<WSPub<SSL> *>(user->channel))
+		return std::get<WSPub<SSL> *>(user->channel)->message(user, message);
+	if (!std::holds_alternative<WSWS<SSL> *>(user->channel))
 		return;
 	tll_msg_t msg = {};
 	msg.type = TLL_MESSAGE_DATA;
 	msg.addr = user->addr;
 	msg.data = message.data();
 	msg.size = message.size();
-	std::get<WSWS *>(user->channel)->_callback_data(&msg);
+	std::get<WSWS<SSL> *>(user->channel)->_callback_data(&msg);
 }
 
-void WSServer::_ws_drain(WebSocket *ws)
+template <bool SSL>
+void WSServer<SSL>::_ws_drain(WebSocket<SSL> *ws)
 {
 	auto user = ws->getUserData();
 
-	if (std::holds_alternative<WSPub *>(user->channel))
-		return std::get<WSPub *>(user->channel)->writeable(ws, user);
+	std::visit([&ws, &user](auto && c) { c->writeable(ws, user); }, user->channel);
 }
 
-void WSServer::_ws_close(WebSocket *ws, int code, std::string_view message)
+template <bool SSL>
+void WSServer<SSL>::_ws_close(WebSocket<SSL> *ws, int code, std::string_view message)
 {
 	auto user = ws->getUserData();
+	if (std::holds_alternative<WSPub<SSL> *>(user->channel))
+		std::get<WSPub<SSL> *>(user->channel)->detach(user);
 	std::visit([&user](auto && c) { c->_disconnected(nullptr, user->addr); }, user->channel);
 }
 
-TLL_DEFINE_IMPL(WSServer);
-TLL_DEFINE_IMPL(WSHTTP);
-TLL_DEFINE_IMPL(WSWS);
-TLL_DEFINE_IMPL(WSPub);
-
-TLL_DEFINE_MODULE(WSServer, WSHTTP, WSWS, WSPub);
+TLL_DEFINE_IMPL(WSServer<false>);
+TLL_DEFINE_IMPL(WSServer<true>);
+TLL_DEFINE_IMPL(WSHTTP<false>);
+TLL_DEFINE_IMPL(WSHTTP<true>);
+TLL_DEFINE_IMPL(WSWS<false>);
+TLL_DEFINE_IMPL(WSWS<true>);
+TLL_DEFINE_IMPL(WSPub<false>);
+TLL_DEFINE_IMPL(WSPub<true>);
+TLL_DEFINE_IMPL(WSStatic<false>);
+TLL_DEFINE_IMPL(WSStatic<true>);
+
+TLL_DEFINE_MODULE(WSServer<false>, WSServer<true>, WSHTTP<false>, WSWS<false>, WSPub<false>, WSStatic<false>);
@@ -13,24 +13,26 @@
 #include "uwsc.h"
 #include "log.h"
 #include "ev-backend.h"
+#include "ev-deadline.h"
+#include "ev-loop.h"
 #include "uwsc-scheme.h"
 
 #include <chrono>
 
-#include <sys/timerfd.h>
 #include <unistd.h>
 
 using namespace std::chrono_literals;
 
 class WSClient : public tll::channel::Base<WSClient>
 {
-	int _timerfd = -1;
 	int _ws_op = UWSC_OP_BINARY;
 
 	struct uwsc_client * _client = nullptr;
 
 	struct ev_loop * _ev_loop = nullptr;
-	struct ev_io _ev_timer = {};
+	EvDeadline _deadline; // Wakes processor for uwsc timer
+	EvLoop * _ev_master = nullptr; // Shared loop owner, own loop is not created when set
+	bool _ev_released = false; // Shared loop owner is destroyed while channel was open
 
 	std::string _url;
 	std::chrono::seconds _ping_interval = 3s;
@@ -57,7 +59,17 @@ public:
 	int _process(long timeout, int flags);
 	int _post(const tll_msg_t *msg, int flags);
 
+	/// Upper bound for timer sleep, uwsc timer ticks once per second so it is never reached
+	static constexpr std::chrono::milliseconds timer_max = std::chrono::milliseconds(1000);
+
 private:
+	/// Arm timer for next tick of uwsc timer
+	int _rearm();
+	std::chrono::nanoseconds _timeout();
+
+	/// Stop using shared loop that is destroyed before the channel
+	void _ev_release();
+
 	void _on_open(uwsc_client *c);
 	void _on_error(uwsc_client *c, int err, const char * msg);
 	void _on_close(uwsc_client *cl, int code, const char * reason);
@@ -94,6 +106,13 @@ int WSClient::_init(const tll::Channel::Url &url, tll::Channel *master)
 
 	_url = fmt::format("{}://{}", url.proto(), url.host());
 
+	if (master) {
+		_ev_master = channel_cast<EvLoop>(master);
+		if (!_ev_master)
+			return _log.fail(EINVAL, "Master {} must be ev:// channel", master->name());
+		_log.info("Use shared event loop of {}", master->name());
+	}
+
 	uwsc_logger_ref();
 
 	return Base<WSClient>::_init(url, master);
@@ -101,6 +120,9 @@ int WSClient::_init(const tll::Channel::Url &url, tll::Channel *master)
 
 int WSClient::_open(const tll::ConstConfig &url)
 {
+	if (_ev_released)
+		return _log.fail(EINVAL, "Shared event loop is destroyed");
+
 	Headers headers = _headers;
 	if (auto hcfg = url.sub("header"); hcfg)
 		_fill_headers(headers, *hcfg);
@@ -108,32 +130,18 @@ int WSClient::_open(const tll::ConstConfig &url)
 	for (auto & [h, v] : headers)
 		hstring += fmt::format("{}: {}\r\n", h, v);
 
-	auto _timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (_timerfd == -1)
-		return _log.fail(EINVAL, "Failed to create timer fd: {}", strerror(errno));
-
-	_ev_loop = ev_loop_new(EVFLAG_NOENV | EVFLAG_NOSIGMASK);
-	if (!_ev_loop)
-		return _log.fail(EINVAL, "Faield to init libev event loop");
-
-	ev_io_init(&_ev_timer,
-		[](struct ev_loop *, ev_io *ev, int)
-		{
-			int64_t buf;
-			auto r = read(ev->fd, &buf, sizeof(buf));
-			(void) r;
-		},
-		_timerfd,
-		EV_READ);
-	ev_io_start(_ev_loop, &_ev_timer);
-
-	ev_run(_ev_loop, EVRUN_NOWAIT);
-
-	struct itimerspec its = {};
-	its.it_interval = { 0, 10000000 };
-	its.it_value = { 0, 1 };
-	if (timerfd_settime(_timerfd, 0, &its, nullptr))
-		return _log.fail(EINVAL, "Failed to rearm timerfd: {}", strerror(errno));
+	if (_ev_master) {
+		_ev_loop = _ev_master->loop();
+	} else {
+		_ev_loop = ev_loop_new(EVFLAG_NOENV | EVFLAG_NOSIGMASK);
+		if (!_ev_loop)
+			return _log.fail(EINVAL, "Faield to init libev event loop");
+
+		if (auto r = _deadline.init(_ev_loop); r)
+			return _log.fail(EINVAL, "Failed to create timer fd: {}", strerror(r));
+
+		ev_run(_ev_loop, EVRUN_NOWAIT);
+	}
 
 	_client = uwsc_new(_ev_loop, _url.c_str(), _ping_interval.count(), hstring.size() ? hstring.c_str() : nullptr);
 	if (!_client)
@@ -150,6 +158,12 @@ int WSClient::_open(const tll::ConstConfig &url)
 		_client->onpong = [](uwsc_client *c) { static_cast<WSClient *>(c->ext)->_on_control(c, UWSC_OP_PONG); };
 	}
 
+	if (_ev_master) {
+		// Events are dispatched by loop owner, process is needed only to finish close
+		_update_dcaps(0, dcaps::Process);
+		return _ev_master->attach(self(), [this]() { return _timeout(); }, [this]() { _ev_release(); });
+	}
+
 	auto fd = tll_ev_backend_fd(_ev_loop);
 
 	if (fd != -1) {
@@ -157,11 +171,14 @@ int WSClient::_open(const tll::ConstConfig &url)
 		_update_dcaps(dcaps::CPOLLIN);
 	}
 
-	return 0;
+	return _rearm();
 }
 
 int WSClient::_close()
 {
+	if (_ev_master)
+		_ev_master->detach(self());
+
 	this->_update_fd(-1);
 
 	if (_client) {
@@ -171,11 +188,9 @@ int WSClient::_close()
 	}
 	_client = nullptr;
 
-	if (_timerfd != -1)
-		::close(_timerfd);
-	_timerfd = -1;
+	_deadline.reset();
 
-	if (_ev_loop)
+	if (_ev_loop && !_ev_master)
 		ev_loop_destroy(_ev_loop);
 	_ev_loop = nullptr;
 
@@ -198,9 +213,37 @@ int WSClient::_process(long timeout, int flags)
 		return 0;
 	}
 
+	if (_ev_master)
+		return EAGAIN;
+
 	auto r = ev_run(_ev_loop, EVRUN_NOWAIT);
 	if (r < 0)
 		return _log.fail(EINVAL, "ev_run failed: {}", r);
+	return _rearm();
+}
+
+std::chrono::nanoseconds WSClient::_timeout()
+{
+	// Client is freed on close callback
+	std::chrono::nanoseconds timeout = timer_max;
+	if (_client && ev_is_active(&_client->timer))
+		timeout = std::min(timeout, EvDeadline::remaining(_ev_loop, &_client->timer));
+	return timeout;
+}
+
+void WSClient::_ev_release()
+{
+	_log.error("Shared event loop is destroyed while channel is open");
+	_close();
+	_ev_master = nullptr;
+	_ev_released = true;
+	state(tll::state::Error);
+}
+
+int WSClient::_rearm()
+{
+	if (auto r = _deadline.arm(_timeout()); r)
+		return _log.fail(EINVAL, "Failed to rearm timerfd: {}", strerror(r));
 	return 0;
 }
 
@@ -253,6 +296,8 @@ void WSClient::_on_close(uwsc_client *cl, int code, const char * reason)
 	_log.info("Connection closed: {} {}", code, reason);
 	_client = nullptr;
 	state(tll::state::Closing);
+	if (_ev_master)
+		_update_dcaps(dcaps::Process);
 	_dcaps_pending(true);
 }
 
@@ -1,12 +1,20 @@
 #!/usr/bin/env python3
 # vim: sts=4 sw=4 et
 
+import base64
 import decorator
+import json
 import os
 import pytest
+import resource
+import socket
+import struct
+import time
+import zlib
 
 from tll import asynctll
 from tll.channel import Context
+from tll.error import TLLError
 from tll.test_util import ports
 
 @pytest.fixture
@@ -47,6 +55,68 @@ def client(asyncloop, port, request):
     c.close()
     del c
 
+def stat_fields(context, name):
+    '''Swap stat block of the channel and return its fields as dict'''
+    for block in context.stat_list:
+        if block.name == name:
+            return {f.name: f.value for f in block.swap()}
+    raise KeyError(f"No stat block for {name}")
+
+class RawClient:
+    '''Websocket client on plain socket that reads data only when asked, emulates slow consumer'''
+    def __init__(self, port, path, rcvbuf=4096, extensions=None):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+        self.sock.connect(('127.0.0.1', port))
+        self.sock.setblocking(False)
+        key = base64.b64encode(os.urandom(16)).decode()
+        ext = f'Sec-WebSocket-Extensions: {extensions}\r\n' if extensions else ''
+        self.sock.sendall(f'GET {path} HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: {key}\r\nSec-WebSocket-Version: 13\r\n{ext}\r\n'.encode())
+        self.buf = b''
+        self.headers = {}
+        self.compressed = False # RSV1 bit of last frame
+
+    def close(self):
+        self.sock.close()
+
+    async def _fill(self, loop, size, timeout):
+        end = time.monotonic() + timeout
+        while len(self.buf) < size:
+            try:
+                data = self.sock.recv(65536)
+                if not data:
+                    raise EOFError("Connection closed")
+                self.buf += data
+            except BlockingIOError:
+                if time.monotonic() > end:
+                    raise TimeoutError(f"No data in {timeout}s")
+                await loop.sleep(0.001)
+
+    async def handshake(self, loop, timeout=1):
+        while b'\r\n\r\n' not in self.buf:
+            await self._fill(loop, len(self.buf) + 1, timeout)
+        head, self.buf = self.buf.split(b'\r\n\r\n', 1)
+        assert head.startswith(b'HTTP/1.1 101')
+        for l in head.decode().split('\r\n')[1:]:
+            k, v = l.split(':', 1)
+            self.headers[k.strip().lower()] = v.strip()
+
+    async def recv(self, loop, timeout=1):
+        '''Read one frame, return opcode and payload'''
+        await self._fill(loop, 2, timeout)
+        op, size = self.buf[0] & 0xf, self.buf[1] & 0x7f
+        self.compressed = bool(self.buf[0] & 0x40)
+        off = 2
+        if size == 126:
+            await self._fill(loop, 4, timeout)
+            size, off = struct.unpack('>H', self.buf[2:4])[0], 4
+        elif size == 127:
+            await self._fill(loop, 10, timeout)
+            size, off = struct.unpack('>Q', self.buf[2:10])[0], 10
+        await self._fill(loop, off + size, timeout)
+        data, self.buf = self.buf[off:off + size], self.buf[off + size:]
+        return op, data
+
 @asyncloop_run
 async def test(asyncloop, server, client, port):
     sub = asyncloop.Channel("uws+ws://path", master=server, name='server/ws', dump='yes');
@@ -97,3 +167,433 @@ async def test(asyncloop, server, client, port):
     assert m.type == m.Type.Control
     m = sub.unpack(m)
     assert m.SCHEME.name == 'Disconnect'
+
+@asyncloop_run
+@pytest.mark.parametrize("broadcast", ['yes', 'no'])
+async def test_pub(asyncloop, server, port, broadcast):
+    pub = asyncloop.Channel("uws+pub://path", master=server, name='server/pub', dump='yes', broadcast=broadcast);
+    client = asyncloop.Channel(f'ws://127.0.0.1:{port}/path', name='client', dump='yes')
+
+    server.open()
+    pub.open()
+    client.open()
+
+    assert await client.recv_state() == client.State.Active
+
+    m = await pub.recv(0.1)
+    assert m.type == m.Type.Control
+    assert pub.unpack(m).SCHEME.name == 'Connect'
+
+    data = [b'xxx', b'y' * 1000, b'z' * 100000]
+    for d in data:
+        pub.post(d)
+
+    for d in data:
+        m = await client.recv(0.1)
+        assert m.type == m.Type.Data
+        assert m.data.tobytes() == d
+
+    client.close()
+
+@asyncloop_run
+async def test_pub_uring(asyncloop, port):
+    server = asyncloop.Channel(f'uws://*:{port}', name='server', **{'send-batch': 'io_uring'})
+    pub = asyncloop.Channel("uws+pub://path", master=server, name='server/pub', dump='yes', broadcast='yes', **{'send-budget': '1kb'});
+    clients = [asyncloop.Channel(f'ws://127.0.0.1:{port}/path', name=f'client/{i}', dump='yes') for i in range(4)]
+
+    try:
+        server.open()
+    except TLLError:
+        pytest.skip("io_uring is not available")
+    pub.open()
+    for c in clients:
+        c.open()
+
+    for c in clients:
+        assert await c.recv_state() == c.State.Active
+        m = await pub.recv(0.1)
+        assert pub.unpack(m).SCHEME.name == 'Connect'
+
+    data = [b'xxx', b'y' * 1000, b'z' * 100000] + [f'msg{i}'.encode() for i in range(100)]
+    for d in data:
+        pub.post(d)
+
+    for c in clients:
+        for d in data:
+            m = await c.recv(0.1)
+            assert m.data.tobytes() == d
+
+    for c in clients:
+        c.close()
+    server.close()
+
+@asyncloop_run
+async def test_pub_resume(asyncloop, server, port):
+    pub = asyncloop.Channel("uws+pub://path", master=server, name='server/pub', dump='yes', **{'seq-header': 'yes', 'ring-size': '4'});
+
+    server.open()
+    pub.open()
+
+    for i in range(6):
+        pub.post(f'msg{i}'.encode())
+
+    client = asyncloop.Channel(f'ws://127.0.0.1:{port}/path?seq=1', name='client', dump='yes')
+    client.open()
+    assert await client.recv_state() == client.State.Error
+    client.close()
+
+    client = asyncloop.Channel(f'ws://127.0.0.1:{port}/path?seq=3', name='client', dump='yes')
+    client.open()
+    assert await client.recv_state() == client.State.Active
+
+    for i in range(3, 6):
+        m = await client.recv(0.1)
+        assert m.data.tobytes() == i.to_bytes(8, 'little') + f'msg{i}'.encode()
+
+    pub.post(b'msg6')
+    m = await client.recv(0.1)
+    assert m.data.tobytes() == (6).to_bytes(8, 'little') + b'msg6'
+
+    client.close()
+
+@asyncloop_run
+async def test_pub_topics(asyncloop, server, port):
+    pub = asyncloop.Channel("uws+pub://path", master=server, name='server/pub', dump='yes', topic='msgid');
+
+    server.open()
+    pub.open()
+
+    client = asyncloop.Channel(f'ws://127.0.0.1:{port}/path?topics=10,30', name='client', dump='yes')
+    client.open()
+    assert await client.recv_state() == client.State.Active
+
+    m = await pub.recv(0.1)
+    assert pub.unpack(m).SCHEME.name == 'Connect'
+
+    for i in range(4):
+        pub.post(f'msg{i}'.encode(), msgid=10 * i)
+
+    for i in (1, 3):
+        m = await client.recv(0.1)
+        assert m.data.tobytes() == f'msg{i}'.encode()
+
+    client.post(b'unsubscribe 30')
+    client.post(b'subscribe 20')
+    await asyncloop.sleep(0.01)
+
+    for i in range(4):
+        pub.post(f'msg{i}'.encode(), msgid=10 * i)
+
+    for i in (1, 2):
+        m = await client.recv(0.1)
+        assert m.data.tobytes() == f'msg{i}'.encode()
+
+    with pytest.raises(TimeoutError):
+        await client.recv(0.01)
+
+    client.close()
+
+@asyncloop_run
+@pytest.mark.parametrize("broadcast", ['yes', 'no'])
+@pytest.mark.parametrize("policy", ['close', 'skip', 'pause'])
+async def test_pub_slow_consumer(asyncloop, server, port, policy, broadcast):
+    pub = asyncloop.Channel("uws+pub://path", master=server, name='server/pub', broadcast=broadcast,
+                            **{'slow-consumer': policy, 'seq-header': 'yes', 'ring-size': '16', 'data-size': '1mb'})
+
+    server.open()
+    pub.open()
+
+    client = RawClient(port, '/path')
+    await client.handshake(asyncloop)
+
+    m = await pub.recv(0.1)
+    assert pub.unpack(m).SCHEME.name == 'Connect'
+    addr = m.addr
+
+    data = b'x' * 16384
+    slow = None
+    posted = 0
+    while slow is None and posted < 1000:
+        try:
+            pub.post(data)
+            posted += 1
+        except TLLError:
+            assert policy == 'pause'
+        try:
+            m = await pub.recv(0)
+        except TimeoutError:
+            continue
+        assert m.type == m.Type.Control
+        assert m.addr == addr
+        slow = pub.unpack(m)
+
+    assert slow is not None, f"Client was not marked as slow after {posted} messages"
+    assert slow.SCHEME.name == 'SlowConsumer'
+    assert slow.policy.name == policy.capitalize()
+    assert slow.events == 1
+
+    if policy == 'close':
+        assert slow.dropped == 0
+        m = await pub.recv(1)
+        assert m.addr == addr
+        assert pub.unpack(m).SCHEME.name == 'Disconnect'
+        client.close()
+        return
+
+    if policy == 'pause':
+        assert slow.dropped == 0
+        with pytest.raises(TLLError): pub.post(data)
+        for seq in range(posted):
+            op, r = await client.recv(asyncloop)
+            assert (op, r) == (2, struct.pack('<Q', seq) + data)
+        pub.post(data)
+        op, r = await client.recv(asyncloop)
+        assert (op, r) == (2, struct.pack('<Q', posted) + data)
+        client.close()
+        return
+
+    assert slow.dropped > 0
+    assert slow.dropped_total == slow.dropped
+
+    first = posted - 1 - slow.dropped
+    for seq in range(first):
+        op, r = await client.recv(asyncloop)
+        assert (op, r) == (2, struct.pack('<Q', seq) + data)
+
+    # Gap notice is framed as data message with sequence number of first dropped message
+    op, r = await client.recv(asyncloop)
+    assert op == 2
+    assert r[:8] == struct.pack('<Q', first)
+    assert json.loads(r[8:]) == {'gap': slow.dropped}
+
+    op, r = await client.recv(asyncloop)
+    assert (op, r) == (2, struct.pack('<Q', first + slow.dropped) + data)
+
+    client.close()
+
+def test_ws_water_marks(context, port):
+    server = context.Channel(f'uws://*:{port}', name='server', **{'max-backpressure': '1mb'})
+    with pytest.raises(TLLError): context.Channel('uws+ws://path', master=server, name='ws', **{'low-water': '1mb', 'high-water': '1kb'})
+    context.Channel('uws+ws://path', master=server, name='ws', **{'low-water': '1kb', 'high-water': '2kb'})
+
+    server.open()
+    ws = context.Channel('uws+ws://path', master=server, name='ws', **{'high-water': '2mb'})
+    with pytest.raises(TLLError): ws.open()
+    server.close()
+
+@asyncloop_run
+async def test_ws_write_full(asyncloop, context, server, port):
+    sub = asyncloop.Channel("uws+ws://path", master=server, name='server/ws', compress='off', stat='yes', **{'high-water': '64kb', 'low-water': '16kb'})
+
+    server.open()
+    sub.open()
+
+    client = RawClient(port, '/path')
+    await client.handshake(asyncloop)
+
+    m = await sub.recv(0.1)
+    assert sub.unpack(m).SCHEME.name == 'Connect'
+    addr = m.addr
+
+    data = b'x' * 4096
+    posted = 0
+    while posted < 10000:
+        try:
+            sub.post(data, addr=addr)
+        except TLLError:
+            break
+        posted += 1
+    else:
+        assert False, f"Posting is not blocked after {posted} messages"
+
+    m = await sub.recv(0.1)
+    assert m.type == m.Type.Control
+    assert sub.unpack(m).SCHEME.name == 'WriteFull'
+    assert m.addr == addr
+    with pytest.raises(TLLError): sub.post(data, addr=addr)
+
+    # Client reads, buffer is drained below low-water mark
+    for _ in range(posted):
+        op, r = await client.recv(asyncloop)
+        assert (op, r) == (2, data)
+
+    m = await sub.recv(1)
+    assert m.type == m.Type.Control
+    assert sub.unpack(m).SCHEME.name == 'WriteReady'
+    assert m.addr == addr
+
+    sub.post(data, addr=addr)
+    assert await client.recv(asyncloop) == (2, data)
+
+    client.close()
+    m = await sub.recv(1)
+    assert sub.unpack(m).SCHEME.name == 'Disconnect'
+
+    stat = stat_fields(context, 'server/ws')
+    assert (stat['conn'], stat['disc'], stat['bp']) == (1, 1, 1)
+
+@asyncloop_run
+@pytest.mark.parametrize("compress", ['off', 'shared', 'dedicated'])
+async def test_ws_compress(asyncloop, server, port, compress):
+    sub = asyncloop.Channel("uws+ws://path", master=server, name='server/ws', dump='yes', compress=compress, **{'compress-min': '16b'})
+    client = asyncloop.Channel(f'ws://127.0.0.1:{port}/path', name='client', dump='yes')
+
+    server.open()
+    sub.open()
+    client.open()
+
+    assert await client.recv_state() == client.State.Active
+
+    m = await sub.recv(0.1)
+    assert sub.unpack(m).SCHEME.name == 'Connect'
+
+    data = [b'xxx', b'y' * 1000, b'z' * 100000, b'y' * 1000]
+    for d in data:
+        sub.post(d, addr=m.addr)
+
+    for d in data:
+        r = await client.recv(0.1)
+        assert r.data.tobytes() == d
+
+    client.close()
+
+@asyncloop_run
+@pytest.mark.parametrize("node,compress", [('ws', 'shared'), ('ws', 'dedicated'), ('pub', 'shared')])
+@pytest.mark.parametrize("window", [None, 10, 15])
+async def test_compress_deflate(asyncloop, server, port, node, compress, window):
+    sub = asyncloop.Channel(f"uws+{node}://path", master=server, name=f'server/{node}', compress=compress, **{'compress-min': '16b'})
+
+    server.open()
+    sub.open()
+
+    ext = 'permessage-deflate; client_max_window_bits'
+    if window:
+        ext += f'; server_max_window_bits={window}'
+    client = RawClient(port, '/path', rcvbuf=1024 * 1024, extensions=ext)
+    await client.handshake(asyncloop)
+
+    m = await sub.recv(1)
+    assert sub.unpack(m).SCHEME.name == 'Connect'
+
+    negotiated = window != 10 # Smaller server window is refused, session is not compressed
+    if negotiated:
+        assert client.headers['sec-websocket-extensions'].startswith('permessage-deflate')
+    else:
+        assert 'sec-websocket-extensions' not in client.headers
+
+    data = [b'xxx', b'y' * 1000, bytes(range(256)) * 400, b'y' * 1000]
+    for d in data:
+        if node == 'ws':
+            sub.post(d, addr=m.addr)
+        else:
+            sub.post(d)
+
+    inflater = zlib.decompressobj(-15)
+    compressed = []
+    for d in data:
+        op, payload = await client.recv(asyncloop)
+        assert op == 2
+        compressed.append(client.compressed)
+        if client.compressed:
+            payload = inflater.decompress(payload + b'\x00\x00\xff\xff')
+        assert payload == d
+    assert any(compressed) == negotiated
+
+    client.close()
+
+def test_pub_compress(context):
+    server = context.Channel('uws://*:5010', name='server')
+    with pytest.raises(TLLError): context.Channel('uws+pub://path', master=server, name='pub', compress='dedicated', broadcast='yes')
+    with pytest.raises(TLLError): context.Channel('uws+pub://path', master=server, name='pub', compress='xxx')
+    context.Channel('uws+pub://path', master=server, name='pub', compress='dedicated')
+
+@pytest.fixture
+def nofile():
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    yield soft, hard
+    resource.setrlimit(resource.RLIMIT_NOFILE, (soft, hard))
+
+@asyncloop_run
+async def test_idle_clients(asyncloop, server, port, nofile):
+    count = 1000
+    # Client socket, libev loop and timerfd for each client and server side socket
+    need = 4 * count + 256
+    soft, hard = nofile
+    if hard != resource.RLIM_INFINITY and hard < need:
+        pytest.skip(f"Not enough file descriptors: {hard} < {need}")
+    resource.setrlimit(resource.RLIMIT_NOFILE, (max(soft, need), hard))
+
+    sub = asyncloop.Channel("uws+ws://path", master=server, name='server/ws')
+    server.open()
+    sub.open()
+
+    clients = [asyncloop.Channel(f'ws://127.0.0.1:{port}/path', name=f'client/{i}', ping='0s') for i in range(count)]
+    for c in clients:
+        c.open()
+    for c in clients:
+        assert await c.recv_state() == c.State.Active
+
+    client = asyncloop.Channel(f'ws://127.0.0.1:{port}/path', name='client', ping='1s', **{'report-ping': 'yes'})
+    client.open()
+    assert await client.recv_state() == client.State.Active
+
+    start, usage = time.monotonic(), resource.getrusage(resource.RUSAGE_SELF)
+    pongs = []
+    while len(pongs) < 4:
+        m = await client.recv(3)
+        if m.type == m.Type.Control and client.unpack(m).SCHEME.name == 'Pong':
+            pongs.append(time.monotonic())
+    dt = time.monotonic() - start
+    wakeups = (resource.getrusage(resource.RUSAGE_SELF).ru_nvcsw - usage.ru_nvcsw) / dt
+
+    # Ping is sent from uwsc timer that ticks once per second
+    errors = [abs(d - round(d)) for d in (b - a for a, b in zip(pongs, pongs[1:]))]
+    print(f"Idle wakeups: {wakeups:.0f} per second for {count} clients, timer error: {max(errors) * 1000:.1f}ms")
+
+    # Each client has one uwsc tick per second, periodic 10ms timerfd gave 100 wakeups per client
+    assert wakeups < 2 * count
+    assert max(errors) < 0.05
+
+    client.close()
+    for c in clients:
+        c.close()
+
+@asyncloop_run
+async def test_shared_loop(asyncloop, context, server, port):
+    try:
+        context.load(os.path.join(os.environ.get("BUILD_DIR", "build"), "tll-ev"))
+    except:
+        pytest.skip("ev:// channel not available")
+
+    sub = asyncloop.Channel("uws+ws://path", master=server, name='server/ws')
+    server.open()
+    sub.open()
+
+    loop = asyncloop.Channel('ev://', name='loop')
+    loop.open()
+
+    clients = [asyncloop.Channel(f'ws://127.0.0.1:{port}/path', name=f'client/{i}', master=loop) for i in range(8)]
+    for c in clients:
+        c.open()
+    for c in clients:
+        assert await c.recv_state() == c.State.Active
+        # Attached client is driven by loop owner and has no fd of its own
+        assert c.fd == -1
+
+    addr = {}
+    for i, c in enumerate(clients):
+        m = await sub.recv(0.1)
+        assert sub.unpack(m).SCHEME.name == 'Connect'
+        c.post(f'{i}'.encode())
+        m = await sub.recv(0.1)
+        assert m.data.tobytes() == f'{i}'.encode()
+        addr[i] = m.addr
+
+    for i, c in enumerate(clients):
+        sub.post(f'reply-{i}'.encode(), addr=addr[i])
+        m = await c.recv(0.1)
+        assert m.data.tobytes() == f'reply-{i}'.encode()
+
+    for c in clients:
+        c.close()
+    loop.close()
@@ -4,6 +4,13 @@
 import decorator
 import os
 import pytest
+import socket
+import ssl
+import subprocess
+import threading
+import time
+import urllib.error
+import urllib.request
 
 from tll import asynctll
 from tll.channel import Context
@@ -20,6 +27,14 @@ def context():
         pytest.skip("uws:// or curl:// channels not available")
     return ctx
 
+@pytest.fixture
+def lws(context):
+    try:
+        context.load(os.path.join(os.environ.get("BUILD_DIR", "build"), "tll-ws"))
+    except:
+        pytest.skip("LWS ws:// server is not available")
+    return context
+
 @pytest.fixture
 def server(asyncloop, port):
     c = asyncloop.Channel(f'uws://*:{port}', name='server')
@@ -48,6 +63,13 @@ def client(asyncloop, port):
     c.close()
     del c
 
+def stat_fields(context, name):
+    '''Swap stat block of the channel and return its fields as dict'''
+    for block in context.stat_list:
+        if block.name == name:
+            return {f.name: f.value for f in block.swap()}
+    raise KeyError(f"No stat block for {name}")
+
 async def check_response(c, addr, connect={}, data=None):
     m = await c.recv()
     assert (m.type, m.addr) == (m.Type.Control, addr)
@@ -222,3 +244,712 @@ async def test_server_headers(asyncloop, server, client):
 
     m = await client.recv()
     assert m.data.tobytes() == b'xxx'
+
+@asyncloop_run
+async def test_http_sharded(asyncloop, port):
+    server = asyncloop.Channel(f'uws://*:{port}', name='server', shards='2')
+    client = asyncloop.Channel(f'curl+http://127.0.0.1:{port}', transfer='control', name='client', dump='frame')
+
+    sub = asyncloop.Channel("uws+http://path", master=server, name='server/http', dump='yes');
+
+    server.open()
+    client.open()
+    sub.open()
+
+    for addr in range(4):
+        client.post({'path':'/abc'}, type=client.Type.Control, name='Connect', addr=addr)
+        await check_response(client, addr, {'code':404})
+
+        client.post({'path':'/path'}, type=client.Type.Control, name='Connect', addr=addr)
+
+        m = await sub.recv()
+        assert m.type == m.Type.Control
+        assert sub.unpack(m).path == '/path'
+
+        m = await sub.recv()
+        assert m.type == m.Type.Data
+
+        sub.post(b'hello', addr=m.addr)
+        await check_response(client, addr, {'code':200}, b'hello')
+
+        # Session is finished by response, stale address is rejected like in non-sharded mode
+        with pytest.raises(TLLError): sub.post(b'again', addr=m.addr)
+        with pytest.raises(TLLError): sub.post(b'again', addr=m.addr ^ (1 << 32))
+
+    client.close()
+    sub.close()
+    server.close()
+
+@asyncloop_run
+@pytest.mark.parametrize("shards", ['0', '2'])
+async def test_http_budget(asyncloop, port, shards):
+    server = asyncloop.Channel(f'uws://*:{port}', name='server', shards=shards, **{'budget-events': '1'})
+    client = asyncloop.Channel(f'curl+http://127.0.0.1:{port}', transfer='control', name='client', dump='frame')
+
+    sub = asyncloop.Channel("uws+http://path", master=server, name='server/http', dump='yes');
+
+    server.open()
+    client.open()
+    sub.open()
+
+    for addr in range(4):
+        client.post({'path':'/path'}, type=client.Type.Control, name='Connect', addr=addr)
+
+    for _ in range(4):
+        m = await sub.recv()
+        assert m.type == m.Type.Control
+        assert sub.unpack(m).path == '/path'
+
+        m = await sub.recv()
+        assert m.type == m.Type.Data
+        sub.post(b'hello', addr=m.addr)
+
+    result = set()
+    for _ in range(4 * 3):
+        m = await client.recv()
+        if m.type == m.Type.Data:
+            assert m.data == b'hello'
+            result.add(m.addr)
+    assert result == set(range(4))
+
+    client.close()
+    sub.close()
+    server.close()
+
+@asyncloop_run
+async def test_http_busy_poll(asyncloop, port):
+    server = asyncloop.Channel(f'uws://*:{port}', name='server', stat='yes', **{'busy-poll': '10ms'})
+    client = asyncloop.Channel(f'curl+http://127.0.0.1:{port}', transfer='control', name='client', dump='frame')
+
+    sub = asyncloop.Channel("uws+http://path", master=server, name='server/http', dump='yes');
+
+    server.open()
+    client.open()
+    sub.open()
+
+    for addr in range(2):
+        client.post({'path':'/path'}, type=client.Type.Control, name='Connect', addr=addr)
+
+        m = await sub.recv()
+        assert m.type == m.Type.Control
+
+        m = await sub.recv()
+        assert m.type == m.Type.Data
+
+        sub.post(b'hello', addr=m.addr)
+        await check_response(client, addr, {'code':200}, b'hello')
+
+    client.close()
+    sub.close()
+    server.close()
+
+@asyncloop_run
+async def test_http_stat(asyncloop, context, server, client):
+    sub = asyncloop.Channel("uws+http://path", master=server, name='server/http', stat='yes')
+
+    server.open()
+    client.open()
+    sub.open()
+
+    for addr in range(3):
+        client.post({'path':'/path'}, type=client.Type.Control, name='Connect', addr=addr)
+
+        m = await sub.recv()
+        assert m.type == m.Type.Control
+        m = await sub.recv()
+        assert m.type == m.Type.Data
+
+        if addr == 2:
+            await asyncloop.sleep(0.01)
+        sub.post(b'hello', addr=m.addr)
+        await check_response(client, addr, {'code':200}, b'hello')
+
+    for _ in range(10):
+        stat = stat_fields(context, 'server/http')
+        if stat['disc'] == 3:
+            break
+        await asyncloop.sleep(0.01)
+    assert (stat['conn'], stat['disc'], stat['bp']) == (3, 3, 0)
+
+    buckets = {k: v for k, v in stat.items() if len(k) == 4 and k[0] == 'l' and k[1:].isdigit()}
+    assert len(buckets) == 144
+    assert sum(buckets.values()) + stat['lover'] == 3
+
+    def lower(i): # Bucket lower bound in ns, same as latency_stat::lower
+        return (i if i < 8 else (8 + i % 8) << (i // 8 - 1)) << 10
+
+    # Delayed response is at least 10ms, so it is in bucket starting above 10ms / (1 + 1/8)
+    assert sum(v for k, v in buckets.items() if lower(int(k[1:])) >= 8000000) == 1
+    assert stat['lmax'] >= 10000000
+    assert stat['lsum'] >= stat['lmax']
+
+    client.close()
+    sub.close()
+
+@pytest.fixture
+def certificate(tmp_path):
+    cert, key = tmp_path / 'cert.pem', tmp_path / 'key.pem'
+    try:
+        subprocess.run(['openssl', 'req', '-x509', '-newkey', 'ec', '-pkeyopt', 'ec_paramgen_curve:P-256', '-nodes', '-days', '1',
+            '-subj', '/CN=localhost', '-keyout', str(key), '-out', str(cert)], check=True, capture_output=True)
+    except (OSError, subprocess.CalledProcessError):
+        pytest.skip("Failed to generate certificate with openssl")
+    return str(cert), str(key)
+
+@asyncloop_run
+@pytest.mark.parametrize("ktls", ['no', 'yes'])
+async def test_https(asyncloop, port, certificate, ktls):
+    cert, key = certificate
+    server = asyncloop.Channel(f'uwss://*:{port}', name='server', cert=cert, key=key, ktls=ktls)
+    sub = asyncloop.Channel("uws+http://path", master=server, name='server/http', dump='yes');
+
+    server.open()
+    sub.open()
+
+    ctx = ssl.create_default_context()
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+
+    result = []
+    def request():
+        try:
+            with urllib.request.urlopen(f'https://127.0.0.1:{port}/path', context=ctx, timeout=5) as r:
+                result.append((r.status, r.read()))
+        except Exception as e:
+            result.append(e)
+
+    for _ in range(2):
+        thread = threading.Thread(target=request)
+        thread.start()
+
+        m = await sub.recv(5)
+        assert m.type == m.Type.Control
+        assert sub.unpack(m).path == '/path'
+
+        m = await sub.recv()
+        assert m.type == m.Type.Data
+
+        sub.post(b'hello', addr=m.addr)
+        for _ in range(50):
+            if result:
+                break
+            await asyncloop.sleep(0.1)
+        thread.join()
+        assert result.pop() == (200, b'hello')
+
+    sub.close()
+    server.close()
+
+@asyncloop_run
+async def test_https_static(asyncloop, port, certificate, tmp_path):
+    cert, key = certificate
+    large = bytes(range(256)) * 4096 * 4
+    (tmp_path / 'large.bin').write_bytes(large)
+
+    server = asyncloop.Channel(f'uwss://127.0.0.1:{port}', name='server', cert=cert, key=key)
+    sub = asyncloop.Channel("uws+static://static/*", master=server, name='server/static', root=str(tmp_path), **{'mmap-max': '64kb'})
+
+    server.open()
+    sub.open()
+
+    ctx = ssl.create_default_context()
+    ctx.check_hostname = False
+    ctx.verify_mode = ssl.CERT_NONE
+
+    result = []
+    def request(headers={}):
+        try:
+            r = urllib.request.Request(f'https://127.0.0.1:{port}/static/large.bin', headers=headers)
+            with urllib.request.urlopen(r, context=ctx, timeout=5) as resp:
+                result.append((resp.status, resp.read()))
+        except Exception as e:
+            result.append(e)
+
+    for headers, expected in [({}, (200, large)), ({'Range': 'bytes=100000-'}, (206, large[100000:]))]:
+        thread = threading.Thread(target=request, args=(headers,))
+        thread.start()
+        for _ in range(50):
+            if result:
+                break
+            await asyncloop.sleep(0.1)
+        thread.join()
+        assert result.pop() == expected
+
+    sub.close()
+    server.close()
+
+@asyncloop_run
+async def test_static(asyncloop, server, port, tmp_path):
+    (tmp_path / 'index.html').write_bytes(b'<html></html>')
+    (tmp_path / 'small.txt').write_bytes(b'0123456789' * 10)
+    large = bytes(range(256)) * 4096 * 4
+    (tmp_path / 'large.bin').write_bytes(large)
+    (tmp_path / 'with space.txt').write_bytes(b'space')
+    (tmp_path / 'link.txt').symlink_to('small.txt')
+    (tmp_path / 'passwd').symlink_to('/etc/passwd')
+
+    sub = asyncloop.Channel("uws+static://static/*", master=server, name='server/static', root=str(tmp_path), **{'mmap-max': '64kb'})
+
+    server.open()
+    sub.open()
+
+    async def request(path, headers={}, method='GET'):
+        result = []
+        def run():
+            try:
+                r = urllib.request.Request(f'http://127.0.0.1:{port}{path}', headers=headers, method=method)
+                with urllib.request.urlopen(r, timeout=5) as resp:
+                    result.append((resp.status, dict(resp.headers), resp.read()))
+            except urllib.error.HTTPError as e:
+                result.append((e.code, dict(e.headers), e.read()))
+            except Exception as e:
+                result.append(e)
+        thread = threading.Thread(target=run)
+        thread.start()
+        for _ in range(50):
+            if result:
+                break
+            await asyncloop.sleep(0.1)
+        thread.join()
+        return result[0]
+
+    code, headers, body = await request('/static/')
+    assert (code, body) == (200, b'<html></html>')
+    assert headers['Content-Type'] == 'text/html'
+
+    code, headers, body = await request('/static/small.txt')
+    assert (code, body) == (200, b'0123456789' * 10)
+    etag = headers['ETag']
+
+    assert (await request('/static/small.txt', {'If-None-Match': etag}))[0] == 304
+    assert (await request('/static/small.txt', {'Range': 'bytes=5-14'}))[::2] == (206, b'5678901234')
+    assert (await request('/static/small.txt', {'Range': 'bytes=-3'}))[::2] == (206, b'789')
+    assert (await request('/static/small.txt', {'Range': 'bytes=100-'}))[0] == 416
+    assert (await request('/static/small.txt', method='HEAD'))[::2] == (200, b'')
+
+    assert (await request('/static/large.bin'))[::2] == (200, large)
+    assert (await request('/static/large.bin', {'Range': 'bytes=100000-'}))[::2] == (206, large[100000:])
+
+    assert (await request('/static/missing'))[0] == 404
+    assert (await request('/static/../test_server.py'))[0] == 404
+
+    assert (await request('/static/link.txt'))[::2] == (200, b'0123456789' * 10)
+    assert (await request('/static/passwd'))[0] == 403
+
+    assert (await request('/static/with%20space.txt'))[::2] == (200, b'space')
+    assert (await request('/static/%2e%2e/test_server.py'))[0] == 404
+    assert (await request('/static/small%2etxt'))[::2] == (200, b'0123456789' * 10)
+    assert (await request('/static/small%zztxt'))[0] == 400
+    assert (await request('/static/small.txt%00'))[0] == 400
+
+    (tmp_path / 'small.tmp').write_bytes(b'updated')
+    (tmp_path / 'small.tmp').rename(tmp_path / 'small.txt')
+    await asyncloop.sleep(0.1)
+
+    code, headers, body = await request('/static/small.txt', {'If-None-Match': etag})
+    assert (code, body) == (200, b'updated')
+    assert headers['ETag'] != etag
+
+    assert sub.state == sub.State.Active
+    sub.close()
+    server.close()
+
+@asyncloop_run
+async def test_http_stream(asyncloop, server, client):
+    sub = asyncloop.Channel("uws+http://path", master=server, name='server/http', dump='yes', stream='yes');
+
+    server.open()
+    client.open()
+    sub.open()
+
+    client.post({'path':'/path'}, type=client.Type.Control, name='Connect', addr=1)
+
+    m = await sub.recv()
+    assert m.type == m.Type.Control
+    addr = m.addr
+
+    m = await sub.recv()
+    assert m.type == m.Type.Data
+
+    sub.post({'code': 200}, name='Connect', type=sub.Type.Control, addr=addr)
+    data = [b'a' * 10, b'b' * 1000, b'c' * 100000]
+    for d in data:
+        sub.post(d, addr=addr)
+    sub.post(b'', addr=addr)
+
+    m = await client.recv()
+    assert (m.type, m.addr) == (m.Type.Control, 1)
+    assert client.unpack(m).code == 200
+
+    result = b''
+    while True:
+        m = await client.recv()
+        if m.type == m.Type.Control:
+            assert client.unpack(m).SCHEME.name == 'Disconnect'
+            break
+        result += m.data.tobytes()
+    assert result == b''.join(data)
+
+@asyncloop_run
+async def test_http_recv_whole(asyncloop, server, port):
+    client = asyncloop.Channel(f'curl+http://127.0.0.1:{port}/path', transfer='data', name='client', dump='frame')
+    sub = asyncloop.Channel("uws+http://path", master=server, name='server/http', dump='yes', recv='whole', **{'body-limit': '64kb'});
+
+    server.open()
+    client.open()
+    sub.open()
+
+    body = b''.join([bytes([i % 256]) * 1000 for i in range(60)])
+    client.post(body, addr=1)
+
+    m = await sub.recv()
+    assert m.type == m.Type.Control
+
+    m = await sub.recv()
+    assert m.type == m.Type.Data
+    assert m.data.tobytes() == body
+
+    sub.post(b'hello', addr=m.addr)
+    await check_response(client, 1, {'code':200}, b'hello')
+
+    client.post(b'x' * 100000, addr=2)
+
+    m = await client.recv()
+    assert (m.type, m.addr) == (m.Type.Control, 2)
+    assert client.unpack(m).code == 413
+
+@asyncloop_run
+async def test_http_router(asyncloop, server, client):
+    get = asyncloop.Channel("uws+http://items/{id}", master=server, name='server/get', dump='yes', methods='GET');
+    post = asyncloop.Channel("uws+http://items/{id}", master=server, name='server/post', dump='yes', methods='POST,PUT');
+    sub = asyncloop.Channel("uws+http://items/{id}/sub/*", master=server, name='server/sub', dump='yes');
+    wc = asyncloop.Channel("uws+http://items/*", master=server, name='server/wildcard', dump='yes');
+
+    server.open()
+    client.open()
+    for c in [get, post, sub, wc]:
+        c.open()
+
+    async def check(c, addr, path, method, params):
+        client.post({'path': path, 'method': method}, type=client.Type.Control, name='Connect', addr=addr)
+
+        m = await c.recv()
+        assert m.type == m.Type.Control
+        m = c.unpack(m)
+        assert m.path == path
+        assert {x.header: x.value for x in m.params} == params
+
+        m = await c.recv()
+        assert m.type == m.Type.Data
+
+        c.post(b'hello', addr=m.addr)
+        await check_response(client, addr, {'code':200}, b'hello')
+
+    await check(get, 1, '/items/10', 'GET', {'id': '10'})
+    await check(post, 2, '/items/20', 'POST', {'id': '20'})
+    await check(sub, 3, '/items/30/sub/x', 'GET', {'id': '30'})
+    await check(wc, 4, '/items/30/subx', 'GET', {})
+
+    json = asyncloop.Channel("uws+http://items/{id}.json", master=server, name='server/json')
+    with pytest.raises(TLLError): json.open()
+
+    # Removed routes do not shadow remaining ones
+    for c in [get, post, sub]:
+        c.close()
+    await check(wc, 5, '/items/10', 'GET', {})
+    await check(wc, 6, '/items/30/sub/x', 'GET', {})
+
+@asyncloop_run
+async def test_http_cache(asyncloop, server, client):
+    sub = asyncloop.Channel("uws+http://path", master=server, name='server/http', dump='yes', stat='yes', **{'cache-ttl': '10s', 'cache-headers': 'X-Key'});
+
+    server.open()
+    client.open()
+    sub.open()
+
+    async def miss(addr, path, code, body, headers=[]):
+        client.post({'path': path, 'headers': headers}, type=client.Type.Control, name='Connect', addr=addr)
+
+        m = await sub.recv()
+        assert m.type == m.Type.Control
+        m = await sub.recv()
+        assert m.type == m.Type.Data
+
+        sub.post({'code': code}, name='Connect', type=sub.Type.Control, addr=m.addr)
+        sub.post(body, addr=m.addr)
+        await check_response(client, addr, {'code': code}, body)
+
+    await miss(1, '/path?a=1', 200, b'first')
+
+    client.post({'path': '/path?a=1'}, type=client.Type.Control, name='Connect', addr=2)
+    await check_response(client, 2, {'code': 200}, b'first')
+    with pytest.raises(TimeoutError): await sub.recv(0.01)
+
+    await miss(3, '/path?a=2', 200, b'second')
+    await miss(4, '/path?a=1', 200, b'header', [{'header': 'X-Key', 'value': 'x'}])
+
+    # Not cached: error code
+    await miss(5, '/path?a=3', 404, b'error')
+    await miss(6, '/path?a=3', 404, b'error')
+
+    client.post({'path': '/path?a=2'}, type=client.Type.Control, name='Connect', addr=7)
+    await check_response(client, 7, {'code': 200}, b'second')
+    with pytest.raises(TimeoutError): await sub.recv(0.01)
+
+@asyncloop_run
+async def test_http_cache_rejected(asyncloop, server, port, client):
+    sub = asyncloop.Channel("uws+http://path", master=server, name='server/http', dump='yes', recv='whole', **{'body-limit': '1kb', 'cache-ttl': '10s'});
+
+    server.open()
+    client.open()
+    sub.open()
+
+    # Rejected GET does not leave its cache key for next request
+    raw = SlowReader(port, b'GET /path?a=1 HTTP/1.1\r\nHost: localhost\r\nContent-Length: 100000\r\n\r\n')
+    try:
+        assert (await raw.read(asyncloop, 12)).startswith(b'HTTP/1.1 413')
+    finally:
+        raw.close()
+    with pytest.raises(TimeoutError): await sub.recv(0.01)
+
+    client.post({'path': '/path?a=1', 'method': 'POST', 'size': 4}, type=client.Type.Control, name='Connect', addr=1)
+    client.post(b'post', addr=1)
+
+    m = await sub.recv()
+    assert m.type == m.Type.Control
+    m = await sub.recv()
+    assert m.type == m.Type.Data
+    sub.post(b'post', addr=m.addr)
+    await check_response(client, 1, {'code': 200}, b'post')
+
+    client.post({'path': '/path?a=1'}, type=client.Type.Control, name='Connect', addr=2)
+
+    m = await sub.recv()
+    assert m.type == m.Type.Control
+    m = await sub.recv()
+    assert m.type == m.Type.Data
+    sub.post(b'get', addr=m.addr)
+    await check_response(client, 2, {'code': 200}, b'get')
+
+class SlowReader:
+    '''Plain HTTP client with small receive buffer that reads response only when asked'''
+    def __init__(self, port, request, rcvbuf=4096):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+        self.sock.connect(('127.0.0.1', port))
+        self.sock.sendall(request)
+        self.sock.setblocking(False)
+        self.data = b''
+
+    def close(self):
+        self.sock.close()
+
+    async def read(self, loop, size, timeout=5):
+        end = time.monotonic() + timeout
+        while len(self.data) < size:
+            try:
+                chunk = self.sock.recv(65536)
+                if not chunk:
+                    break
+                self.data += chunk
+            except BlockingIOError:
+                if time.monotonic() > end:
+                    break
+                await loop.sleep(0.001)
+        return self.data
+
+@asyncloop_run
+async def test_lws_write_full(asyncloop, lws, port):
+    server = asyncloop.Channel('ws://', name='server', port=str(port))
+    sub = asyncloop.Channel('ws+sse://path', master=server, name='server/sse', **{'high-water': '64kb', 'low-water': '16kb'})
+
+    server.open()
+    sub.open()
+
+    client = SlowReader(port, b'GET /path HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n')
+
+    m = await sub.recv(1)
+    assert sub.unpack(m).SCHEME.name == 'connect'
+    addr = m.addr
+
+    data = b'x' * 4096
+    posted = 0
+    while posted < 10000:
+        try:
+            sub.post(data, addr=addr)
+        except TLLError:
+            break
+        posted += 1
+    else:
+        assert False, f"Posting is not blocked after {posted} messages"
+    assert posted == 16 # Queue reached 64kb high-water mark
+
+    m = await sub.recv(1)
+    assert (m.type, m.addr) == (m.Type.Control, addr)
+    assert sub.unpack(m).SCHEME.name == 'write_full'
+    with pytest.raises(TLLError): sub.post(data, addr=addr)
+
+    # Client reads everything, queue is drained below low-water mark
+    event = b'data: ' + data + b'\n\n'
+    body = await client.read(asyncloop, posted * len(event))
+    assert body.count(event) == posted
+
+    m = await sub.recv(1)
+    assert (m.type, m.addr) == (m.Type.Control, addr)
+    assert sub.unpack(m).SCHEME.name == 'write_ready'
+
+    sub.post(data, addr=addr)
+    body = await client.read(asyncloop, len(body) + len(event))
+    assert body.count(event) == posted + 1
+
+    client.close()
+    m = await sub.recv(1)
+    assert sub.unpack(m).SCHEME.name == 'disconnect'
+
+    sub.close()
+    server.close()
+
+@asyncloop_run
+async def test_lws_pool(asyncloop, context, lws, port):
+    server = asyncloop.Channel('ws://', name='server', port=str(port))
+    sub = asyncloop.Channel('ws+sse://path', master=server, name='server/sse', stat='yes', **{'high-water': '1mb'})
+
+    server.open()
+    sub.open()
+
+    client = SlowReader(port, b'GET /path HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n', rcvbuf=1024 * 1024)
+
+    m = await sub.recv(1)
+    assert sub.unpack(m).SCHEME.name == 'connect'
+    addr = m.addr
+
+    body = b''
+    async def send(data, count):
+        nonlocal body
+        event = b'data: ' + data + b'\n\n'
+        before = body.count(event)
+        for _ in range(count):
+            sub.post(data, addr=addr)
+        body = await client.read(asyncloop, len(body) + count * len(event))
+        assert body.count(event) == before + count
+
+    # Buffers are allocated for first batch and reused by second one when queue is drained
+    await send(b'x' * 1000, 4)
+    await send(b'y' * 1000, 4)
+
+    # Messages larger then 64kb bypass the pool
+    large = bytes(range(256)) * 400
+    await send(large, 1)
+    await send(large, 1)
+
+    stat = stat_fields(context, 'server/sse')
+    assert (stat['phit'], stat['pmiss'], stat['pbig']) == (4, 4, 2)
+
+    client.close()
+    sub.close()
+    server.close()
+
+async def http_response(loop, client, timeout=5):
+    '''Read HTTP response with Content-Length from SlowReader, return status code and body'''
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        data = await client.read(loop, len(client.data) + 1, end - time.monotonic())
+        head, sep, body = data.partition(b'\r\n\r\n')
+        if not sep:
+            continue
+        lines = head.decode().split('\r\n')
+        headers = {k.strip().lower(): v.strip() for k, v in (l.split(':', 1) for l in lines[1:])}
+        if len(body) >= int(headers.get('content-length', 0)):
+            return int(lines[0].split()[1]), body
+    assert False, f"Incomplete response: {client.data}"
+
+async def lws_body(sub, addr):
+    '''Collect request body until body_complete control message'''
+    body = b''
+    while True:
+        m = await sub.recv(1)
+        assert m.addr == addr
+        if m.type == m.Type.Control:
+            assert sub.unpack(m).SCHEME.name == 'body_complete'
+            return body
+        body += m.data.tobytes()
+
+@asyncloop_run
+async def test_lws_http_empty_post(asyncloop, lws, port):
+    server = asyncloop.Channel('ws://', name='server', port=str(port))
+    sub = asyncloop.Channel('ws+http://path', master=server, name='server/http')
+
+    server.open()
+    sub.open()
+
+    client = SlowReader(port, b'POST /path HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: 0\r\n\r\n')
+
+    m = await sub.recv(1)
+    assert sub.unpack(m).SCHEME.name == 'connect'
+
+    # Empty body does not delay response
+    sub.post(b'response', addr=m.addr)
+    assert await http_response(asyncloop, client) == (200, b'response')
+
+    client.close()
+    sub.close()
+    server.close()
+
+@asyncloop_run
+async def test_lws_http_chunked(asyncloop, lws, port):
+    server = asyncloop.Channel('ws://', name='server', port=str(port))
+    sub = asyncloop.Channel('ws+http://path', master=server, name='server/http')
+
+    server.open()
+    sub.open()
+
+    client = SlowReader(port, b'POST /path HTTP/1.1\r\nHost: 127.0.0.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n')
+
+    m = await sub.recv(1)
+    assert sub.unpack(m).SCHEME.name == 'connect'
+    addr = m.addr
+
+    # Response is posted before body is complete and is held until last chunk is received
+    sub.post(b'response', addr=addr)
+    assert await client.read(asyncloop, 1, timeout=0.05) == b''
+
+    client.sock.sendall(b'6\r\n world\r\n0\r\n\r\n')
+    assert await lws_body(sub, addr) == b'hello world'
+    assert await http_response(asyncloop, client) == (200, b'response')
+
+    client.close()
+    sub.close()
+    server.close()
+
+@asyncloop_run
+async def test_lws_http_rx_pause(asyncloop, lws, port):
+    server = asyncloop.Channel('ws://', name='server', port=str(port))
+    sub = asyncloop.Channel('ws+http://path', master=server, name='server/http')
+
+    server.open()
+    sub.open()
+
+    client = SlowReader(port, b'POST /path HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: 10\r\n\r\nfirst')
+
+    m = await sub.recv(1)
+    assert sub.unpack(m).SCHEME.name == 'connect'
+    addr = m.addr
+
+    m = await sub.recv(1)
+    assert (m.type, m.addr, m.data.tobytes()) == (m.Type.Data, addr, b'first')
+
+    sub.post({}, name='rx_pause', type=sub.Type.Control, addr=addr)
+    client.sock.sendall(b'other')
+    with pytest.raises(TimeoutError): await sub.recv(0.05)
+
+    sub.post({}, name='rx_resume', type=sub.Type.Control, addr=addr)
+    assert await lws_body(sub, addr) == b'other'
+
+    sub.post(b'response', addr=addr)
+    assert await http_response(asyncloop, client) == (200, b'response')
+
+    with pytest.raises(TLLError): sub.post({}, name='rx_pause', type=sub.Type.Control, addr=addr + 1000)
+
+    client.close()
+    sub.close()
+    server.close()